@@ -0,0 +1,56 @@
+#ifndef BONFIRE_ACPI_H
+#define BONFIRE_ACPI_H
+
+#include <kernel/types.h>
+#include <kernel/smp.h>
+
+/* ACPI table discovery (RSDP -> RSDT/XSDT) and the MADT summary the APIC
+ * code needs. Tables are read in place through the direct map. */
+
+#define ACPI_MAX_IOAPICS  4
+#define ACPI_MAX_ISOS     16
+
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_ioapic {
+    uint8_t id;
+    uint32_t addr;
+    uint32_t gsi_base;
+};
+
+/* Interrupt source override: ISA IRQ source is wired to gsi. */
+struct acpi_iso {
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;     /* MPS INTI flags: polarity bits 0-1, trigger bits 2-3 */
+};
+
+struct acpi_madt_info {
+    uint64_t lapic_addr;
+    bool has_8259;                       /* PCAT_COMPAT: legacy PICs present */
+    int cpu_count;
+    uint8_t cpu_apic_ids[MAX_CPUS];      /* enabled processors, BSP first when found */
+    int ioapic_count;
+    struct acpi_ioapic ioapics[ACPI_MAX_IOAPICS];
+    int iso_count;
+    struct acpi_iso isos[ACPI_MAX_ISOS];
+};
+
+/* Find the RSDP and parse the MADT. Returns 0, or -1 without ACPI. */
+int acpi_init(void);
+/* Table by signature ("APIC", "MCFG", ...), or NULL. */
+const struct acpi_sdt_header *acpi_find_table(const char *sig);
+/* MADT summary; cpu_count is 0 if there was none. */
+const struct acpi_madt_info *acpi_madt(void);
+
+#endif /* BONFIRE_ACPI_H */
@@ -0,0 +1,129 @@
+#ifndef BONFIRE_ASYNC_H
+#define BONFIRE_ASYNC_H
+
+#include <kernel/types.h>
+#include <kernel/wait.h>
+#include <kernel/timer.h>
+
+/*
+ * Stackless async tasks (process/async.c). A task is a function the
+ * executor polls plus a few words of state: it runs until it has to wait,
+ * records where to continue (a GCC label address) and returns
+ * ASYNC_PENDING. Whatever it waits for wakes it, and the next poll jumps
+ * straight back to that point. Nothing is kept on a stack in between, so a
+ * flow in flight costs sizeof(struct async_task) plus its own state rather
+ * than a process with a 64 KiB stack.
+ *
+ * Each CPU runs its ready tasks in the SOFTIRQ_ASYNC softirq, so a task
+ * runs on the CPU that woke it, with interrupts on, and must not block
+ * (no wait_event, sleep_ms or long busy-waits). Locals do not survive an
+ * await: keep state in the structure that embeds the task (first member,
+ * so the task pointer casts back), and compute pointers before
+ * ASYNC_BEGIN. At most one await per source line.
+ *
+ *     struct blink { struct async_task task; int i; };
+ *
+ *     static int blink_fn(struct async_task *t)
+ *     {
+ *         struct blink *b = (struct blink *)t;
+ *         ASYNC_BEGIN(t);
+ *         for (b->i = 0; b->i < 3; b->i++)
+ *             async_sleep(t, 100);
+ *         ASYNC_END(t, 0);
+ *     }
+ */
+
+#define ASYNC_PENDING 0           /* poll result: waiting, call again once woken */
+#define ASYNC_DONE    1           /* finished, result set */
+
+/* async_task.state */
+#define ASYNC_IDLE      0         /* waiting for a wake-up */
+#define ASYNC_QUEUED    1         /* on a CPU's ready queue */
+#define ASYNC_RUNNING   2         /* being polled */
+#define ASYNC_WOKEN     3         /* woken while being polled: poll again */
+#define ASYNC_FINISHED  4         /* result set; executor still waking joiners */
+#define ASYNC_RELEASED  5         /* executor done with it: may be freed */
+
+struct async_task;
+typedef int (*async_fn)(struct async_task *t);
+
+struct async_task {
+    async_fn fn;
+    void *resume;                 /* label to continue at; NULL = the top */
+    uint32_t state;               /* ASYNC_IDLE.. */
+    int result;                   /* ASYNC_END value */
+    struct async_task *next;      /* ready queue (struct cpu) */
+    struct wait_queue *waiting;   /* queue it is linked on, under its lock */
+    struct async_task *wait_next;
+    uint32_t deadline;            /* timer_get_ms of the await in progress, 0 = none */
+    struct timer timer;           /* wakes it at the deadline */
+    struct wait_queue join_wait;  /* async_join */
+    void (*on_done)(struct async_task *t);   /* last thing the executor does */
+};
+
+/* Queue t to run fn on this CPU. on_done (may be NULL) runs once it has
+ * finished and may free it; otherwise the owner keeps t alive until
+ * async_join returns. */
+void async_start(struct async_task *t, async_fn fn, void (*on_done)(struct async_task *t));
+/* Make t runnable (IRQ-safe). No-op if it is queued or finished. */
+void async_wake(struct async_task *t);
+/* Process context: sleep until t has finished and return its result. */
+int async_join(struct async_task *t);
+bool async_done(const struct async_task *t);
+/* SOFTIRQ_ASYNC: poll this CPU's ready tasks. */
+void async_softirq(void);
+
+/* Used by the await macros. */
+void async_wait_prepare(struct async_task *t, struct wait_queue *wq);
+void async_wait_finish(struct async_task *t, struct wait_queue *wq);
+
+static inline uint32_t async_deadline(uint32_t ms)
+{
+    uint32_t d = timer_get_ms() + ms;
+    return d ? d : 1;
+}
+
+static inline bool async_timed_out(const struct async_task *t)
+{
+    return t->deadline && (int32_t)(timer_get_ms() - t->deadline) >= 0;
+}
+
+#define __ASYNC_CAT2(a, b) a##b
+#define __ASYNC_CAT(a, b)  __ASYNC_CAT2(a, b)
+#define __ASYNC_LABEL      __ASYNC_CAT(__async_resume_, __LINE__)
+
+#define ASYNC_BEGIN(t)                                              \
+    do { if ((t)->resume) goto *(t)->resume; } while (0)
+
+#define ASYNC_END(t, res)                                           \
+    do { (t)->result = (res); return ASYNC_DONE; } while (0)
+
+#define __async_wait(t, wq, cond, deadline_ms)                      \
+    do {                                                            \
+        (t)->deadline = (deadline_ms);                              \
+        (t)->resume = &&__ASYNC_LABEL;                              \
+    __ASYNC_LABEL:                                                  \
+        if (!(cond) && !async_timed_out(t)) {                       \
+            async_wait_prepare((t), (wq));                          \
+            if (!(cond) && !async_timed_out(t)) return ASYNC_PENDING; \
+        }                                                           \
+        async_wait_finish((t), (wq));                               \
+    } while (0)
+
+/* Continue once cond holds; wake_up(&wq) makes the task check again. */
+#define async_wait_event(t, wq, cond)  __async_wait(t, &(wq), cond, 0)
+/* Same, giving up after ms; test cond afterwards to tell which. */
+#define async_wait_event_timeout(t, wq, cond, ms)                   \
+    __async_wait(t, &(wq), cond, async_deadline(ms))
+/* Continue after ms milliseconds. */
+#define async_sleep(t, ms)  __async_wait(t, NULL, false, async_deadline(ms))
+/* Let the other ready tasks on this CPU run first. */
+#define async_yield(t)                                              \
+    do {                                                            \
+        (t)->resume = &&__ASYNC_LABEL;                              \
+        async_wake(t);                                              \
+        return ASYNC_PENDING;                                       \
+    __ASYNC_LABEL: ;                                                \
+    } while (0)
+
+#endif /* BONFIRE_ASYNC_H */
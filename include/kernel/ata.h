@@ -2,6 +2,7 @@
 #define BONFIRE_ATA_H
 
 #include <kernel/types.h>
+#include <kernel/wait.h>
 
 #define ATA_SECTOR_SIZE 512
 
@@ -10,4 +11,29 @@ int ata_read_sectors(uint32_t lba, uint32_t count, void *buf);
 /* Write sectors. Returns 0 on success. */
 int ata_write_sectors(uint32_t lba, uint32_t count, const void *buf);
 
+/*
+ * Queued requests: ata_submit returns at once and the "ata" worker thread
+ * does the transfer, then sets status and wakes ata_wait. The disk has no
+ * completion interrupt (PIO), so that one thread busy-waits on it for
+ * every request in flight. Wait with
+ *     wait_event(ata_wait, r.status != ATA_REQ_PENDING)
+ * or async_wait_event in a task; the request is free to reuse once status
+ * has changed, the driver never touches it again.
+ */
+#define ATA_REQ_PENDING 1
+
+struct ata_request {
+    uint32_t lba;
+    uint32_t count;
+    void *buf;
+    bool write;
+    int status;                   /* ATA_REQ_PENDING, then 0 or -1 */
+    struct ata_request *next;
+};
+
+extern struct wait_queue ata_wait;
+
+void ata_init(void);              /* starts the worker; after workqueue_init */
+void ata_submit(struct ata_request *r);
+
 #endif /* BONFIRE_ATA_H */
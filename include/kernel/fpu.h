@@ -0,0 +1,31 @@
+#ifndef BONFIRE_FPU_H
+#define BONFIRE_FPU_H
+
+#include <kernel/types.h>
+
+/*
+ * Lazy x87/SSE/AVX state switching. A process gets a save area (XSAVE format,
+ * or FXSAVE without XSAVE) on its first SIMD instruction. The scheduler sets
+ * CR0.TS when it switches to a process whose state is not in this CPU's
+ * registers, so the next x87/SSE/AVX instruction traps (#NM) and fpu_trap
+ * loads it; a process that used the FPU is saved when it is switched out.
+ * Interrupt handlers must not use SIMD: nothing saves the state around them.
+ */
+
+struct cpu;
+struct process;
+
+/* BSP, once: enable the FPU (fpu_init_cpu) and size the save area. */
+void fpu_init(void);
+/* Every CPU: CR0/CR4 and XCR0 (x87, SSE and AVX when present); sets CR0.TS. */
+void fpu_init_cpu(void);
+/* #NM handler. False if the state could not be allocated. */
+bool fpu_trap(void);
+/* Scheduler, interrupts off, switching c from prev to next. */
+void fpu_switch(struct cpu *c, struct process *prev, struct process *next);
+/* Drop p's save area (reaper, after p has left every CPU). */
+void fpu_free(struct process *p);
+bool fpu_has_avx(void);
+uint32_t fpu_state_size(void);
+
+#endif /* BONFIRE_FPU_H */
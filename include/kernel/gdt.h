@@ -0,0 +1,48 @@
+#ifndef BONFIRE_GDT_H
+#define BONFIRE_GDT_H
+
+#include <kernel/types.h>
+
+/* Selectors. Kernel code/data match the boot GDT in boot.asm; the user
+ * slots are in the order SYSRET expects (STAR base 0x18: SS = base + 8,
+ * CS = base + 16). User selectors carry RPL 3 when loaded. */
+#define GDT_KERNEL_CODE  0x08
+#define GDT_KERNEL_DATA  0x10
+#define GDT_USER_CODE32  0x18    /* compatibility mode; unused, fixes the layout */
+#define GDT_USER_DATA    0x20
+#define GDT_USER_CODE    0x28
+#define GDT_TSS          0x30
+
+#define USER_CS          (GDT_USER_CODE | 3)
+#define USER_SS          (GDT_USER_DATA | 3)
+
+/* Interrupt stack table slots (TSS.IST1..7) */
+#define IST_PAGE_FAULT   1    /* #PF: may fire on an uncommitted or overflowed stack */
+#define IST_DOUBLE_FAULT 2
+
+#define IST_STACK_ORDER  1    /* 8 KiB per IST stack, from page_alloc */
+
+#define GDT_ENTRIES      8    /* null, kernel code/data, user code32/data/code, TSS (two slots) */
+
+struct tss {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed));
+
+/* Per-CPU descriptor tables (embedded in struct cpu). */
+struct cpu_gdt {
+    uint64_t gdt[GDT_ENTRIES];
+    struct tss tss;
+} __attribute__((aligned(16)));
+
+/* Build g (segments, TSS with IST stacks), load it and the task register
+ * on the calling CPU. tss.rsp[0] (the stack for interrupts from ring 3) is
+ * set by the scheduler whenever it switches to a user process. Returns 0, or -1 if the IST stacks cannot be allocated. */
+int gdt_init(struct cpu_gdt *g);
+
+#endif /* BONFIRE_GDT_H */
@@ -9,7 +9,12 @@
 #define IDT_TYPE_INTR  0x0E   /* 64-bit interrupt gate */
 #define IDT_TYPE_TRAP  0x0F   /* 64-bit trap gate */
 
+#define EXC_DEVICE_NOT_AVAILABLE 7
+#define EXC_DOUBLE_FAULT 8
+#define EXC_PAGE_FAULT   14
+
 void idt_init(void);
+void idt_load(void);
 void idt_set_gate(uint8_t n, uint64_t handler, uint16_t selector, uint8_t type);
 
 #endif /* BONFIRE_IDT_H */
@@ -0,0 +1,27 @@
+#ifndef BONFIRE_IOAPIC_H
+#define BONFIRE_IOAPIC_H
+
+#include <kernel/types.h>
+
+/*
+ * I/O APIC (arch/ioapic.c): each chip owns a range of global system
+ * interrupts (GSIs) starting at its MADT gsi_base and turns each one into a
+ * message to a local APIC, per a 64-bit redirection entry. arch/irq.c maps
+ * ISA IRQs onto GSIs; this is only the chip.
+ */
+
+/* Redirection entry bits (low word) */
+#define IOAPIC_POLARITY_LOW  (1u << 13)
+#define IOAPIC_TRIGGER_LEVEL (1u << 15)
+#define IOAPIC_MASKED        (1u << 16)
+
+/* Map every I/O APIC in the MADT and mask all its inputs. Returns the
+ * number found (0: none, stay on the 8259). */
+int ioapic_init(void);
+/* Program gsi: fixed delivery of vector to the local APIC apic_id,
+ * physical destination; flags are IOAPIC_* bits. -1 if no chip has gsi. */
+int ioapic_route(uint32_t gsi, uint8_t vector, uint32_t flags, uint32_t apic_id);
+int ioapic_set_masked(uint32_t gsi, bool masked);
+int ioapic_set_dest(uint32_t gsi, uint32_t apic_id);
+
+#endif /* BONFIRE_IOAPIC_H */
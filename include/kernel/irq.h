@@ -15,10 +15,66 @@
 #define IRQ_BASE  32
 #define IRQ0      (IRQ_BASE + 0)
 #define IRQ1      (IRQ_BASE + 1)   /* keyboard */
+#define ISA_IRQS  16
 
+/* ISA IRQ n is always delivered on vector IRQ_BASE + n, through the 8259
+ * pair until irq_route_apic switches to the I/O APIC (arch/irq.c). */
 void irq_init(void);
+/* After smp_init: route through the I/O APIC if the MADT lists one. */
+void irq_route_apic(void);
+bool irq_apic_mode(void);
 void irq_eoi(uint8_t irq);
 void irq_mask_set(uint8_t irq);
 void irq_mask_clear(uint8_t irq);
+/* Deliver irq to CPU index cpu from now on. -1 on the 8259, for an
+ * unwired IRQ or an offline CPU, and for IRQ0, which stays on the BSP. */
+int irq_set_affinity(uint8_t irq, int cpu);
+
+struct irq_route {
+    int gsi;                      /* I/O APIC input (8259 pin), -1 if unwired */
+    int cpu;                      /* destination CPU index */
+    bool masked;
+    bool level;                   /* level-triggered */
+    bool active_low;
+};
+
+bool irq_get_route(uint8_t irq, struct irq_route *out);
+
+/* Vectors handed out at run time (MSI/MSI-X), each with a stub of its own
+ * (idt_asm.asm); EOI is to the local APIC, before fn runs. */
+#define IRQ_DYN_BASE   0x30
+#define IRQ_DYN_COUNT  64
+
+typedef void (*irq_handler_fn)(void *arg);
+
+/* Free vector now calling fn(arg) in hard interrupt context, or -1. */
+int irq_alloc_vector(irq_handler_fn fn, void *arg);
+void irq_free_vector(int vector);
+/* Run the handler of a dynamic vector (idt_irq_handler). */
+void irq_dispatch(uint8_t vector);
+
+/* Interrupts-off section tracing (process/softirq.c); see irqoff_trace_enable. */
+extern volatile bool irqoff_tracing;
+void irqoff_trace_start(void);
+void irqoff_trace_stop(void);
+
+/* Disable interrupts, returning the previous RFLAGS for irq_restore. */
+static inline uint64_t irq_save(void)
+{
+    uint64_t flags;
+    __asm__ volatile ("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    if (__builtin_expect(irqoff_tracing, 0) && (flags & 0x200))
+        irqoff_trace_start();
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags)
+{
+    if (flags & 0x200) {
+        if (__builtin_expect(irqoff_tracing, 0))
+            irqoff_trace_stop();
+        __asm__ volatile ("sti" : : : "memory");
+    }
+}
 
 #endif /* BONFIRE_IRQ_H */
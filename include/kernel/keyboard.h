@@ -7,11 +7,17 @@
 
 /* Non-blocking: get next character if available (0 = none). */
 char keyboard_getchar(void);
+/* Blocking: sleep until a character arrives. */
+char keyboard_getchar_wait(void);
+/* Blocking with a limit: 0 if nothing arrived within ms milliseconds. */
+char keyboard_getchar_timeout(uint32_t ms);
 /* Non-blocking: get next key event (scancode, down=1/0). Returns 0 if none. */
 int keyboard_get_scancode(uint8_t *scancode, int *down);
 /* Discard all pending scancode events. */
 void keyboard_clear_scancodes(void);
-/* Called from IRQ handler when scancode is received. */
+/* IRQ1: read the scancode and raise SOFTIRQ_INPUT. */
 void keyboard_irq_handler(void);
+/* SOFTIRQ_INPUT: decode the scancodes read since the last run. */
+void keyboard_softirq(void);
 
 #endif /* BONFIRE_KEYBOARD_H */
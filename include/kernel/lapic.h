@@ -0,0 +1,32 @@
+#ifndef BONFIRE_LAPIC_H
+#define BONFIRE_LAPIC_H
+
+#include <kernel/types.h>
+
+/* Local APIC (xAPIC, MMIO) */
+
+#define LAPIC_SPURIOUS_VECTOR  0xFF
+#define LAPIC_TIMER_VECTOR     0xEF   /* per-CPU one-shot timer (scheduler stub) */
+#define IPI_RESCHEDULE         0xF0   /* run the scheduler (scheduler stub) */
+#define IPI_TLB_SHOOTDOWN      0xF1   /* reload CR3 */
+
+/* Map the registers (first call) and enable the APIC on the calling CPU. */
+void lapic_init(uint64_t phys);
+bool lapic_present(void);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void lapic_send_ipi_others(uint8_t vector);
+/* Timer. Count mode runs at bus clock / 16; lapic_timer_calibrate measures it
+ * against the PIT and returns ticks per ms (0 if there is no APIC). */
+uint32_t lapic_timer_calibrate(void);
+bool lapic_timer_has_tsc_deadline(void);
+/* Interrupt this CPU once after count ticks (0 cancels). */
+void lapic_timer_oneshot(uint32_t count);
+/* TSC-deadline mode: interrupt this CPU once the TSC reaches tsc (0 cancels). */
+void lapic_timer_deadline(uint64_t tsc);
+/* AP start-up: INIT (assert + deassert) then STARTUP at page << 12. */
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_sipi(uint32_t apic_id, uint8_t page);
+
+#endif /* BONFIRE_LAPIC_H */
@@ -0,0 +1,58 @@
+#ifndef BONFIRE_MEMSTAT_H
+#define BONFIRE_MEMSTAT_H
+
+#include <kernel/types.h>
+
+/*
+ * Per-allocator usage counters and an optional allocation-trace ring.
+ * Allocators embed a struct mem_stats, register it once and report every
+ * allocation/free. The shell's meminfo prints them.
+ */
+
+#define MEMSTAT_BUCKETS  16    /* size histogram: <=16, <=32, ... , <=256 KiB, >256 KiB */
+#define MEMSTAT_MAX      8
+#define MEMTRACE_SIZE    256
+
+struct mem_stats {
+    const char *name;
+    size_t in_use;          /* bytes currently allocated (block sizes) */
+    size_t peak;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t reallocs;      /* resized in place */
+    uint64_t failures;
+    uint64_t hist[MEMSTAT_BUCKETS];
+    /* Filled in by refresh() on demand: */
+    size_t free_bytes;
+    size_t largest_free;
+    void (*refresh)(struct mem_stats *s);
+    void *owner;
+};
+
+enum memtrace_op { MEMTRACE_ALLOC, MEMTRACE_FREE, MEMTRACE_REALLOC, MEMTRACE_FAIL };
+
+struct memtrace_entry {
+    uint32_t ms;
+    uint8_t op;
+    const char *name;
+    const void *ptr;
+    size_t size;
+};
+
+void memstat_register(struct mem_stats *s, const char *name, void (*refresh)(struct mem_stats *), void *owner);
+void memstat_alloc(struct mem_stats *s, const void *ptr, size_t size);
+void memstat_free(struct mem_stats *s, const void *ptr, size_t size);
+void memstat_realloc(struct mem_stats *s, const void *ptr, size_t old_size, size_t new_size);
+void memstat_fail(struct mem_stats *s, size_t size);
+
+/* Registered allocators, i = 0.. until NULL. Calls refresh() first. */
+struct mem_stats *memstat_get(int i);
+/* Fragmentation in percent: 100 * (1 - largest_free / free_bytes). */
+unsigned memstat_frag_percent(const struct mem_stats *s);
+
+void memtrace_enable(bool on);
+bool memtrace_enabled(void);
+/* Copy out up to max entries, oldest first. Returns count. */
+int memtrace_read(struct memtrace_entry *out, int max);
+
+#endif /* BONFIRE_MEMSTAT_H */
@@ -2,10 +2,76 @@
 #define BONFIRE_MM_H
 
 #include <kernel/types.h>
+#include <kernel/multiboot.h>
 
-/* Simple bump allocator (no free). For full heap, add free-list later. */
-void heap_init(void *region, size_t size);
+#define PAGE_SIZE        4096
+#define PAGE_SHIFT       12
+#define CACHE_LINE_SIZE  64
+
+/* Buddy allocator: blocks of 2^0 .. 2^PAGE_MAX_ORDER pages (4 KiB .. 4 MiB). */
+#define PAGE_MAX_ORDER   10
+
+/* Physical RAM is identity-mapped (paging.h direct map), so kernel pointers are physical addresses. */
+#define phys_to_virt(pa)  ((void *)(uintptr_t)(pa))
+#define virt_to_phys(va)  ((uint64_t)(uintptr_t)(va))
+
+/* Largest request served from a kmalloc size class; bigger ones get whole pages. */
+#define KMALLOC_MAX_SLAB 2048
+
+/* Page flags */
+#define PG_RESERVED  0x01   /* not managed (kernel image, holes, mem_map) */
+#define PG_BUDDY     0x02   /* head of a free buddy block */
+#define PG_SLAB      0x04   /* slab page owned by a kmem_cache */
+#define PG_LARGE     0x08   /* head of a multi-page kmalloc allocation */
+
+struct kmem_cache;
+
+/* One descriptor per physical frame (mem_map). */
+struct page {
+    uint8_t flags;
+    uint8_t order;                 /* block order (head page of allocated/free block) */
+    uint16_t inuse;                /* PG_SLAB: objects handed out */
+    struct kmem_cache *cache;      /* PG_SLAB: owning cache */
+    void *freelist;                /* PG_SLAB: first free object */
+    struct page *prev, *next;      /* buddy free list or cache partial list */
+};
+
+/* Physical page frames (buddy system) built from the multiboot memory map. */
+void page_init(const struct multiboot_info *mb);
+/* Free frames below end that were outside the direct map at page_init time. */
+void page_add_mapped(uint64_t end);
+uint64_t page_ram_top(void);
+void *page_alloc(unsigned order);
+void page_free(void *addr);
+struct page *virt_to_page(const void *addr);
+void *page_to_virt(const struct page *page);
+size_t page_total_count(void);
+size_t page_free_count(void);
+/* Bytes in the largest free buddy block. */
+size_t page_largest_free(void);
+
+/* Kernel stacks: KSTACK_SIZE bytes above an unmapped guard page, committed on
+ * first touch. kstack_alloc returns the lowest usable byte (stack top is
+ * base + KSTACK_SIZE) or NULL when all KSTACK_MAX slots are taken. Freed
+ * stacks are pooled, still committed, and handed out first. kstack_free may
+ * send a TLB shootdown, so call it with interrupts enabled. */
+#define KSTACK_SIZE  (64 * 1024)
+#define KSTACK_MAX   1024
+void *kstack_alloc(void);
+void kstack_free(void *base);
+unsigned kstack_pooled(void);     /* stacks waiting in the pool */
+/* #PF helpers: commit a stack page / is addr a guard page of a live stack. */
+bool kstack_handle_fault(uint64_t addr);
+bool kstack_is_guard(uint64_t addr);
+
+/* Kernel heap: size-class slab allocator on top of page_alloc. */
+void heap_init(void);
 void *kmalloc(size_t size);
-void kfree(void *ptr);  /* no-op for bump allocator */
+void kfree(void *ptr);
+
+/* Fixed-size object caches. align 0 = cache-line aligned (or packed for objects < 64 bytes). */
+struct kmem_cache *kmem_cache_create(const char *name, size_t obj_size, size_t align);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
 
 #endif /* BONFIRE_MM_H */
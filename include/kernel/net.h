@@ -6,6 +6,7 @@
 #define NET_IPV4_LOOPBACK 0x7F000001u
 
 void net_init(void);
+/* Process received packets and due retransmissions (run by the net RX work). */
 void net_poll(void);
 
 /* ICMP echo to IPv4 address (loopback only unless a NIC driver is present). */
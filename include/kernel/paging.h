@@ -0,0 +1,118 @@
+#ifndef BONFIRE_PAGING_H
+#define BONFIRE_PAGING_H
+
+#include <kernel/types.h>
+
+/* Page-table entry bits (4-level paging) */
+#define PTE_PRESENT   (1UL << 0)
+#define PTE_WRITE     (1UL << 1)
+#define PTE_USER      (1UL << 2)
+#define PTE_PWT       (1UL << 3)
+#define PTE_PCD       (1UL << 4)
+#define PTE_ACCESSED  (1UL << 5)
+#define PTE_DIRTY     (1UL << 6)
+#define PTE_HUGE      (1UL << 7)    /* PS: 2 MiB (PD) or 1 GiB (PDPT) page */
+#define PTE_PAT       (1UL << 7)    /* PAT index bit in a 4 KiB PTE */
+#define PTE_GLOBAL    (1UL << 8)
+#define PTE_OWNED     (1UL << 9)    /* software: frame freed with its address space */
+#define PTE_PAT_HUGE  (1UL << 12)   /* PAT index bit in a 2 MiB / 1 GiB entry */
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000UL
+
+#define PAGE_SIZE_2M  (2UL * 1024 * 1024)
+#define PAGE_SIZE_1G  (1024UL * 1024 * 1024)
+
+/* Direct map: physical RAM identity-mapped through PML4[0] (at most 512 GiB). */
+#define DIRECT_MAP_MAX  (512UL * PAGE_SIZE_1G)
+
+/* MMIO window: device ranges are mapped here by mmio_map (PML4[1]). */
+#define MMIO_VIRT_BASE  (512UL * PAGE_SIZE_1G)
+#define MMIO_VIRT_SIZE  (512UL * PAGE_SIZE_1G)
+
+/* Demand-zero window: paging_reserve_zero hands out ranges here (PML4[2]). */
+#define LAZY_VIRT_BASE  (1024UL * PAGE_SIZE_1G)
+#define LAZY_VIRT_SIZE  (512UL * PAGE_SIZE_1G)
+
+/* Kernel stacks: guard-paged, demand-committed slots (mm/kstack.c, PML4[3]). */
+#define KSTACK_VIRT_BASE  (1536UL * PAGE_SIZE_1G)
+
+/* The kernel windows above share their page tables with every address
+ * space: each PML4 copies these entries. */
+#define KERNEL_PML4_SLOTS  4
+
+/* User address spaces (PML4[4]): the .user image read-only at
+ * USER_TEXT_BASE, the clock page just below it and a stack just below
+ * USER_STACK_TOP. */
+#define USER_VIRT_BASE  (2048UL * PAGE_SIZE_1G)
+#define USER_VIRT_SIZE  (512UL * PAGE_SIZE_1G)
+#define USER_TEXT_BASE  (USER_VIRT_BASE + PAGE_SIZE_2M)
+#define USER_VCLOCK_BASE (USER_TEXT_BASE - PAGE_SIZE)   /* vclock.h, read-only */
+#define USER_STACK_TOP  (USER_VIRT_BASE + USER_VIRT_SIZE)
+#define USER_STACK_SIZE (64UL * 1024)
+
+/* #PF error code bits */
+#define PF_PRESENT  (1UL << 0)   /* protection violation (page was present) */
+#define PF_WRITE    (1UL << 1)
+#define PF_USER     (1UL << 2)
+
+/* Memory types, programmed into the PAT by paging_init. */
+enum page_cache {
+    CACHE_WB,        /* write-back (RAM) */
+    CACHE_WT,        /* write-through */
+    CACHE_UC_MINUS,  /* uncached, MTRR may override to WC */
+    CACHE_UC,        /* strong uncached (device registers) */
+    CACHE_WC,        /* write-combining (framebuffers) */
+    CACHE_WP,        /* write-protect */
+};
+
+/* Extend the boot direct map over all RAM and program the PAT. Call after page_init. */
+void paging_init(void);
+/* Program the PAT on the calling CPU (paging_init does the BSP; APs call this). */
+void paging_init_cpu(void);
+/* End of the identity-mapped physical range (boot.asm map until paging_init). */
+uint64_t paging_direct_map_end(void);
+bool paging_has_1g_pages(void);
+
+/* Map [virt, virt+size) to phys in the kernel page tables using the largest pages
+ * alignment allows. flags: PTE_* (PTE_PRESENT implied). Returns 0 or -1. */
+int paging_map(uint64_t virt, uint64_t phys, size_t size, uint64_t flags);
+void paging_unmap(uint64_t virt, size_t size);
+/* Translate virt; returns -1 (all ones) if not mapped. */
+uint64_t paging_virt_to_phys(uint64_t virt);
+/* PTE_PWT/PTE_PCD/PTE_PAT bits selecting cache (4 KiB form; paging_map converts). */
+uint64_t paging_cache_flags(enum page_cache cache);
+
+/* Map a device range with the given memory type; returns its virtual address or NULL. */
+void *mmio_map(uint64_t phys, size_t size, enum page_cache cache);
+void mmio_unmap(void *virt, size_t size);
+
+/* Reserve kernel virtual memory that reads as zero; frames are allocated and
+ * mapped on first touch by the page-fault handler. Returns NULL when the
+ * window is exhausted. */
+void *paging_reserve_zero(size_t size);
+/* Back the page containing virt with a freshly zeroed frame. Returns 0 or -1. */
+int paging_map_zero(uint64_t virt);
+/* Called from the #PF handler: commit a zeroed frame if addr lies in a
+ * demand-zero range or a kernel stack. Returns false if the fault is not
+ * ours to fix (including kernel stack guard pages). */
+bool paging_handle_fault(uint64_t addr, uint64_t error);
+
+/*
+ * Address spaces for ring-3 processes: a PML4 of its own, sharing the
+ * kernel windows and mapping 4 KiB user pages in the user window.
+ */
+uint64_t *paging_space_create(void);    /* NULL if out of memory */
+/* Free the user page tables and every PTE_OWNED frame. Not loaded anywhere. */
+void paging_space_destroy(uint64_t *pml4);
+/* Map existing frames (not freed with the space). flags: PTE_USER etc. */
+int paging_space_map(uint64_t *pml4, uint64_t virt, uint64_t phys, size_t size, uint64_t flags);
+/* Back [virt, virt+size) with zeroed frames owned by the space. */
+int paging_space_alloc(uint64_t *pml4, uint64_t virt, size_t size, uint64_t flags);
+/* Load pml4 on the calling CPU (NULL = kernel tables); no-op if loaded. */
+void paging_space_switch(uint64_t *pml4);
+/* True if every byte of [virt, virt+size) is a user page of pml4 (and
+ * writable if write). An empty range is ok only at a mapped user page, so a
+ * zero-length buffer is judged like a one-byte one. System calls check
+ * their pointers with this. */
+bool paging_user_ok(uint64_t *pml4, uint64_t virt, size_t size, bool write);
+
+#endif /* BONFIRE_PAGING_H */
@@ -0,0 +1,104 @@
+#ifndef BONFIRE_PCI_H
+#define BONFIRE_PCI_H
+
+#include <kernel/types.h>
+#include <kernel/irq.h>
+
+/*
+ * PCI (drivers/pci.c). Configuration space is reached through ECAM when
+ * ACPI has an MCFG table (segment 0 only) and through ports 0xCF8/0xCFC
+ * otherwise. pci_init walks the buses from the host bridge down through
+ * PCI-to-PCI bridges and sizes every BAR; drivers register a table of
+ * vendor/device IDs and are probed for each matching function, whether
+ * they register before or after the scan.
+ */
+
+#define PCI_MAX_DEVS   64
+#define PCI_ANY_ID     0xFFFF
+
+/* Configuration header (type 0) */
+#define PCI_VENDOR_ID    0x00
+#define PCI_DEVICE_ID    0x02
+#define PCI_COMMAND      0x04
+#define PCI_STATUS       0x06
+#define PCI_REVISION     0x08
+#define PCI_HEADER_TYPE  0x0E
+#define PCI_BAR0         0x10
+#define PCI_CAP_PTR      0x34
+#define PCI_INTERRUPT_LINE 0x3C
+#define PCI_INTERRUPT_PIN  0x3D
+
+#define PCI_COMMAND_IO       (1u << 0)
+#define PCI_COMMAND_MEMORY   (1u << 1)
+#define PCI_COMMAND_MASTER   (1u << 2)
+#define PCI_COMMAND_INTX_OFF (1u << 10)
+#define PCI_STATUS_CAP_LIST  (1u << 4)
+
+#define PCI_CAP_MSI   0x05
+#define PCI_CAP_MSIX  0x11
+
+struct pci_bar {
+    uint64_t addr;                /* bus address (port number for I/O) */
+    uint64_t size;                /* 0: not implemented */
+    bool io;
+    bool prefetch;                /* memory the device lets us prefetch/combine */
+    void *virt;                   /* pci_map_bar, once mapped */
+};
+
+struct pci_driver;
+
+struct pci_dev {
+    uint8_t bus, slot, fn;
+    uint16_t vendor, device;
+    uint8_t class, subclass, prog_if, revision;
+    uint8_t irq_line, irq_pin;    /* legacy INTx, as firmware left it */
+    struct pci_bar bar[6];        /* a 64-bit BAR fills its slot; the next is empty */
+    const struct pci_driver *driver;
+    void *driver_data;
+    volatile uint32_t *msix_table;   /* mapped by pci_enable_msix */
+};
+
+struct pci_id {
+    uint16_t vendor, device;      /* PCI_ANY_ID matches anything */
+};
+
+struct pci_driver {
+    const char *name;
+    const struct pci_id *ids;     /* ends with vendor 0 */
+    /* 0 claims the device; anything else leaves it for another driver. */
+    int (*probe)(struct pci_dev *d, const struct pci_id *id);
+    struct pci_driver *next;      /* registry link, owned by pci.c */
+};
+
+/* Enumerate and probe registered drivers. Call after irq_route_apic. */
+void pci_init(void);
+bool pci_ecam(void);              /* config space through MCFG, not ports */
+int pci_dev_count(void);
+struct pci_dev *pci_dev_get(int i);   /* NULL past the end */
+/* Probe drv against every device not yet claimed, now or once pci_init
+ * has scanned. Boot code only: registration and probing are not locked. */
+void pci_register_driver(struct pci_driver *drv);
+
+uint8_t pci_read8(const struct pci_dev *d, uint16_t off);
+uint16_t pci_read16(const struct pci_dev *d, uint16_t off);
+uint32_t pci_read32(const struct pci_dev *d, uint16_t off);
+void pci_write16(const struct pci_dev *d, uint16_t off, uint16_t v);
+void pci_write32(const struct pci_dev *d, uint16_t off, uint32_t v);
+
+/* Turn on memory/I/O decoding for the BARs the device has. */
+void pci_enable_device(struct pci_dev *d);
+void pci_set_master(struct pci_dev *d);
+/* Map a memory BAR: registers uncached, prefetchable BARs write-combining.
+ * NULL for I/O or absent BARs (use bar[n].addr with inb/outb). */
+void *pci_map_bar(struct pci_dev *d, int n);
+/* Offset of capability id in config space, or 0. */
+uint8_t pci_find_cap(const struct pci_dev *d, uint8_t id);
+
+/* Message-signalled interrupts: allocate a vector (irq_alloc_vector),
+ * point the device at CPU index cpu and disable INTx. Return the vector,
+ * or -1 if the device lacks the capability or vectors ran out. */
+int pci_enable_msi(struct pci_dev *d, irq_handler_fn fn, void *arg, int cpu);
+/* MSI-X table entry 'entry'; call once per entry the driver uses. */
+int pci_enable_msix(struct pci_dev *d, unsigned entry, irq_handler_fn fn, void *arg, int cpu);
+
+#endif /* BONFIRE_PCI_H */
@@ -25,6 +25,11 @@ typedef int64_t off_t;
 
 extern int errno;
 
+struct stat {
+    uint32_t st_mode;
+    uint32_t st_size;
+};
+
 int open(const char *path, int flags);
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t write(int fd, const void *buf, size_t count);
@@ -35,11 +40,6 @@ int chdir(const char *path);
 int mkdir(const char *path);
 int stat(const char *path, struct stat *st);
 
-struct stat {
-    uint32_t st_mode;
-    uint32_t st_size;
-};
-
 #define S_IFREG  0100000
 #define S_IFDIR  0040000
 
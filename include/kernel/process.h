@@ -2,32 +2,152 @@
 #define BONFIRE_PROCESS_H
 
 #include <kernel/types.h>
+#include <kernel/mm.h>
+#include <kernel/timer.h>
+#include <kernel/wait.h>
 
-#define PROCESS_STACK_SIZE  (64 * 1024)   /* 64 KiB per process */
-#define MAX_PROCESSES       8
+#define PROCESS_STACK_SIZE  KSTACK_SIZE   /* 64 KiB reserved, committed on demand */
+
+/* Scheduler priority levels, 0 = highest. A process starts at its base level
+ * and drops one level each time it uses a whole slice; boosts restore it. */
+#define SCHED_LEVELS        8
+#define SCHED_PRIO_HIGH     0
+#define SCHED_PRIO_NORMAL   2
+#define SCHED_PRIO_LOW      5
+
+/* process.on_cpu: who requeues a process that is being switched out */
+#define ON_CPU_NONE     0         /* off every CPU */
+#define ON_CPU_RUNNING  1         /* current somewhere (or its stack still is) */
+#define ON_CPU_REQUEUE  2         /* ditto, and scheduler_switch_done must queue it */
+
+struct cpu;
 
 enum process_state {
     PROC_RUNNABLE,
     PROC_RUNNING,
     PROC_BLOCKED,
+    PROC_ZOMBIE,                  /* exited, stack not yet reclaimed */
+    PROC_DEAD,                    /* stack reclaimed; PCB kept for process_join */
 };
 
 struct process {
     uint64_t pid;
     enum process_state state;
     uint64_t saved_rsp;           /* kernel stack pointer when not running */
-    uint8_t *kernel_stack;        /* base of allocated stack */
-    struct process *next;         /* round-robin list */
+    uint8_t *kernel_stack;        /* base of the stack (kstack_alloc) */
+    struct cpu *cpu;              /* CPU it last ran on */
+    uint32_t last_ran_ms;         /* when it was last switched out */
+    uint32_t slice_end_ms;        /* end of the current time slice */
+    int level;                    /* current run queue level */
+    int base_level;               /* priority set at creation */
+    uint32_t on_cpu;              /* ON_CPU_* */
+    struct wait_queue *wait_queue;  /* wait.c: queue we are linked on */
+    struct process *wait_next;
+    struct timer timeout;         /* wait.c: wakes us at the deadline */
+    int exit_code;
+    uint32_t refs;                /* the running process + the join handle */
+    struct wait_queue exit_wait;  /* process_join waiters */
+    struct process *all_next;     /* process table */
+    struct process *all_prev;
+    struct process *reap_next;
+    struct process *rq_next;      /* cpu->rq_overflow */
+    void *fpu_state;              /* fpu.c save area, allocated on first use */
+    struct cpu *fpu_cpu;          /* CPU its FPU state was last loaded on */
+    const char *name;             /* shown by top; NULL = unnamed */
+    uint64_t runtime_tsc;         /* TSC cycles run, interrupt time excluded */
+    uint64_t nvcsw;               /* switches out by blocking or yielding */
+    uint64_t nivcsw;              /* switches out by preemption */
+    uint64_t *pml4;               /* ring-3 address space; NULL = kernel thread */
+};
+
+/* One process_list entry. */
+struct process_info {
+    uint64_t pid;
+    const char *name;
+    enum process_state state;
+    int level;
+    uint32_t cpu;                 /* index of the CPU it last ran on */
+    uint64_t runtime_tsc;
+    uint64_t nvcsw;
+    uint64_t nivcsw;
+};
+
+/* Per-CPU scheduler counters (struct cpu), shown by the shell's sched command. */
+struct sched_stats {
+    uint64_t switches;            /* context switches */
+    uint64_t steals;              /* processes taken from other CPUs */
+    uint64_t stolen;              /* processes other CPUs took from this one */
+    uint64_t steal_skips;         /* steals passed over because the process was cache-hot */
+    uint64_t migrations;          /* switches to a process that last ran elsewhere */
+    uint64_t demotions;           /* slices used up (process dropped a level) */
+    uint64_t boosts;
+    uint64_t idle_ms;             /* time in the idle process */
+    uint64_t busy_ms;
+    uint32_t load_avg;            /* runnable processes, x256, decayed every 10 ms */
 };
 
 void process_init(void);
 struct process *process_current(void);
-void process_create(void (*entry)(void));
-/* Called from timer IRQ; returns new rsp to switch to (may be same). */
-uint64_t scheduler_tick(uint64_t current_rsp);
-/* Start running the first process (call once after creating processes). */
+/* Start a process at entry; returning from entry calls process_exit(0). The
+ * result is a join handle: pass it to process_join or process_detach exactly
+ * once, or the PCB outlives the process. NULL if out of memory or stacks. */
+struct process *process_create(void (*entry)(void));   /* SCHED_PRIO_NORMAL */
+struct process *process_create_prio(void (*entry)(void), int level);
+/* Same, calling entry(arg). */
+struct process *process_create_arg(void (*entry)(void *), void *arg, int level);
+/* Start a ring-3 process in a new address space, at entry (a symbol in the
+ * .user section, see syscall.h) with arg in rdi. It ends with SYS_EXIT; a
+ * fault kills it. Same join handle rules as process_create. */
+struct process *process_create_user(const void *entry, uint64_t arg, int level);
+void process_set_priority(struct process *p, int level);
+void process_set_name(struct process *p, const char *name);   /* static string */
+/* End the calling process. Its stack goes back to the pool via the reaper. */
+void process_exit(int code) __attribute__((noreturn));
+/* Wait for p to exit, free it and return its exit code. */
+int process_join(struct process *p);
+/* Nobody will join p: free it as soon as it has exited. */
+void process_detach(struct process *p);
+uint32_t process_count(void);     /* live and unjoined processes, idle excluded */
+/* Copy up to max entries of the process table (idle excluded); returns the
+ * number copied. Runtimes include the slice in progress, approximately. */
+int process_list(struct process_info *out, int max);
+/* p's runtime_tsc plus its slice in progress if it is on a CPU right now. */
+uint64_t process_runtime(const struct process *p);
+/* Turn the calling context (an AP's boot stack) into this CPU's idle process. */
+void process_adopt_idle(void);
+/* Interrupt entries (idt_asm.asm): the PIT IRQ (no local APIC), the local
+ * APIC timer and IPI_RESCHEDULE. Each may switch away and return later. */
+void scheduler_tick(void);
+void scheduler_timer(void);
+void scheduler_ipi(void);
+/* Switch away from the current process; the caller has set PROC_BLOCKED with
+ * interrupts off (wait.c). Returns once the process has been woken. */
+void process_block(void);
+/* Give the CPU to another runnable process of the same or a higher level,
+ * if there is one; the caller stays runnable. */
+void process_yield(void);
+/* PROC_BLOCKED -> runnable and queued. False if p was not blocked. IRQ-safe. */
+bool process_wake(struct process *p);
+/* Back from wait_prepare, blocked or not: make p plain running again. */
+void process_resume_self(struct process *p);
+/* Requeue the process just switched away from and drain softirqs; runs on
+ * the new stack. */
+void scheduler_switch_done(void);
+/* Runnable processes on c, including the one running (idle excluded). */
+uint32_t scheduler_load(const struct cpu *c);
+uint32_t scheduler_queued(const struct cpu *c);
+/* Start running this CPU's first process (BSP, once after creating processes). */
 void scheduler_first_run(void);
 
-extern void context_switch_to(uint64_t new_rsp);
+/* context_switch.asm. Push the callee-saved registers, store rsp in
+ * *save_rsp and resume the context saved at new_rsp: its registers are
+ * popped and it returns from its own context_switch call (or, the first
+ * time, into process_start). Interrupts off. */
+extern void context_switch(uint64_t *save_rsp, uint64_t new_rsp);
+/* Same without saving anything (boot context, first run). */
+extern void context_switch_to(uint64_t new_rsp) __attribute__((noreturn));
+/* A new process's first return address: scheduler_switch_done, then the
+ * interrupt frame process_setup_stack built, then iretq into entry. */
+extern void process_start(void);
 
 #endif /* BONFIRE_PROCESS_H */
@@ -0,0 +1,80 @@
+#ifndef BONFIRE_SEQLOCK_H
+#define BONFIRE_SEQLOCK_H
+
+#include <kernel/types.h>
+#include <kernel/spinlock.h>
+#include <kernel/cpu.h>
+
+/*
+ * Sequence counts for read-mostly data (a clock, calibration values):
+ * readers never write shared memory and never block the writer. A writer
+ * makes the count odd, updates, and makes it even again; a reader copies
+ * the data between read_seqbegin and read_seqretry and starts over if the
+ * count was odd or moved. Readers must only copy: what they read may be
+ * torn until read_seqretry says otherwise.
+ *
+ *     do {
+ *         seq = read_seqbegin(&s);
+ *         copy = data;
+ *     } while (read_seqretry(&s, seq));
+ *
+ * seqcount_t needs writers to be serialised some other way (a single
+ * writer, or a lock held already); seqlock_t adds a spinlock for that.
+ * A writer that an interrupt handler may preempt on the same CPU, with
+ * readers in that handler, must use the _irqsave forms or the reader spins
+ * forever.
+ */
+
+typedef struct {
+    volatile uint32_t seq;
+} seqcount_t;
+
+#define SEQCOUNT_INIT { 0 }
+
+static inline uint32_t read_seqbegin(const seqcount_t *s)
+{
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+        cpu_relax();
+    return seq;
+}
+
+/* True if the data read since read_seqbegin may be inconsistent. */
+static inline bool read_seqretry(const seqcount_t *s, uint32_t start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_seqcount_end(seqcount_t *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+typedef struct {
+    seqcount_t count;
+    spinlock_t lock;              /* serialises writers */
+} seqlock_t;
+
+#define SEQLOCK_INIT { SEQCOUNT_INIT, SPINLOCK_INIT }
+
+static inline uint64_t write_seqlock_irqsave(seqlock_t *sl)
+{
+    uint64_t flags = spin_lock_irqsave(&sl->lock);
+    write_seqcount_begin(&sl->count);
+    return flags;
+}
+
+static inline void write_sequnlock_irqrestore(seqlock_t *sl, uint64_t flags)
+{
+    write_seqcount_end(&sl->count);
+    spin_unlock_irqrestore(&sl->lock, flags);
+}
+
+#endif /* BONFIRE_SEQLOCK_H */
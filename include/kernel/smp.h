@@ -0,0 +1,87 @@
+#ifndef BONFIRE_SMP_H
+#define BONFIRE_SMP_H
+
+#include <kernel/types.h>
+#include <kernel/gdt.h>
+#include <kernel/spinlock.h>
+#include <kernel/wsdeque.h>
+#include <kernel/process.h>
+#include <kernel/timer.h>
+#include <kernel/softirq.h>
+
+/*
+ * Per-CPU state and AP bring-up. Each CPU's GS base points at its struct cpu,
+ * so this_cpu() is a single %gs-relative load. Ring 3 runs with the user GS
+ * base loaded instead; every entry from ring 3 swaps it back (swapgs).
+ */
+
+#define MAX_CPUS 16
+
+struct async_task;
+
+struct cpu {
+    struct cpu *self;              /* %gs:0, read by this_cpu() */
+    uint64_t syscall_rsp;          /* %gs:8: kernel stack top of the user process */
+    uint64_t user_rsp;             /* %gs:16: scratch for syscall_entry */
+    uint32_t index;                /* 0 = BSP */
+    uint32_t apic_id;
+    volatile bool online;
+    volatile bool tlb_flush_pending;
+    /* Scheduler (process.c) */
+    struct ws_deque rq[SCHED_LEVELS];  /* runnable processes waiting, per level */
+    uint32_t rq_bitmap;            /* levels that may be non-empty; owner clears */
+    struct process *rq_overflow;   /* FIFO of processes whose deque was full; owner only */
+    struct process *rq_overflow_tail;
+    uint32_t rq_overflow_n;
+    struct process *current;
+    struct process *idle;          /* never queued, never stolen */
+    struct process *prev;          /* requeued by scheduler_switch_done */
+    uint32_t balance_failed;       /* steals passed over as cache-hot in a row */
+    uint32_t acct_ms;              /* stats accounted up to here */
+    uint32_t timer_deadline;       /* armed local APIC timer (timer.c), 0 = none */
+    uint32_t next_boost_ms;
+    uint64_t run_tsc;              /* current charged up to here (TSC) */
+    uint64_t run_irq_tsc;          /* irq_tsc at run_tsc */
+    struct timer_base timers;      /* timer wheel (timer_wheel.c) */
+    struct process *fpu_owner;     /* whose FPU state the registers hold (fpu.c) */
+    /* Deferred work and interrupt latency (softirq.c) */
+    uint32_t softirq_pending;      /* 1 << SOFTIRQ_* */
+    bool in_softirq;
+    bool need_resched;             /* scheduler entered during softirqs */
+    uint64_t hardirq_tsc;          /* entry of the hard interrupt in progress */
+    uint64_t irqoff_tsc;           /* start of the traced interrupts-off section */
+    uint64_t irq_tsc;              /* hard + soft interrupt time, never reset */
+    struct irq_stats irq;
+    /* Async task executor (async.c) */
+    spinlock_t async_lock;
+    struct async_task *async_head; /* ready queue, FIFO */
+    struct async_task *async_tail;
+    uint64_t async_polls;
+    struct sched_stats stats;
+    struct cpu_gdt gdt;
+};
+
+extern struct cpu cpus[MAX_CPUS];
+
+static inline struct cpu *this_cpu(void)
+{
+    struct cpu *c;
+    __asm__ volatile ("mov %%gs:0, %0" : "=r"(c));
+    return c;
+}
+
+/* Set up cpus[0] (GS base, GDT/TSS) on the BSP. Call after page_init/heap_init. */
+void smp_init_bsp(void);
+/* Parse the MADT, enable the local APIC and start every AP. */
+void smp_init(void);
+int smp_cpu_count(void);          /* CPUs online */
+struct cpu *smp_cpu(int index);   /* NULL if index is not online */
+
+/* Fixed IPI to every other online CPU. */
+void smp_send_ipi_others(uint8_t vector);
+/* Flush every other CPU's TLB and wait for them (after unmapping kernel pages). */
+void smp_tlb_shootdown(void);
+/* IPI_TLB_SHOOTDOWN handler. */
+void smp_tlb_flush_ipi(void);
+
+#endif /* BONFIRE_SMP_H */
@@ -0,0 +1,52 @@
+#ifndef BONFIRE_SOFTIRQ_H
+#define BONFIRE_SOFTIRQ_H
+
+#include <kernel/types.h>
+
+/*
+ * Softirqs (process/softirq.c): work a hard interrupt handler defers to the
+ * end of the interrupt. softirq_raise marks a vector pending on the calling
+ * CPU; irq_exit runs the pending handlers on that CPU with interrupts back
+ * on, before returning to the interrupted code. Handlers never run nested
+ * and are not preempted (the scheduler waits until they are done), but they
+ * must not block. Work that needs to sleep goes on a workqueue instead.
+ */
+
+enum softirq_nr {
+    SOFTIRQ_TIMER,                /* timer wheel callbacks (timer_wheel.c) */
+    SOFTIRQ_INPUT,                /* keyboard scancode decoding (keyboard.c) */
+    SOFTIRQ_ASYNC,                /* async task executor (async.c) */
+    SOFTIRQ_COUNT
+};
+
+/* Per-CPU interrupt latency counters (struct cpu), shown by the shell's
+ * irqstat command. Times are TSC cycles. */
+struct irq_stats {
+    uint64_t hardirqs;            /* hard interrupts taken */
+    uint64_t hardirq_cycles;      /* spent in hard interrupt handlers */
+    uint64_t hardirq_max;
+    uint64_t softirqs[SOFTIRQ_COUNT];  /* handler runs per vector */
+    uint64_t softirq_cycles;      /* spent running softirqs (interrupts on) */
+    uint64_t softirq_max;         /* longest single drain */
+    uint64_t irqoff_max;          /* longest irq_save..irq_restore (tracing on) */
+    uint64_t irqoff_sections;     /* sections measured */
+};
+
+/* Mark nr pending on this CPU. Call with interrupts off (any interrupt
+ * handler); it runs at the end of the current or the next interrupt. */
+void softirq_raise(enum softirq_nr nr);
+/* Hard interrupt entry and exit bookkeeping, interrupts off. irq_exit also
+ * drains pending softirqs unless one is already running on this CPU. */
+void irq_enter(void);
+void irq_exit(void);
+/* True while this CPU is running softirq handlers. */
+bool in_softirq(void);
+/* True in a hard interrupt handler or a softirq: irq_exit comes next. */
+bool in_interrupt(void);
+
+/* Measure interrupts-off sections (irq.h hooks). Resets the counters. */
+void irqoff_trace_enable(bool on);
+bool irqoff_trace_enabled(void);
+void irq_stats_reset(void);
+
+#endif /* BONFIRE_SOFTIRQ_H */
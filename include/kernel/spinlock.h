@@ -0,0 +1,90 @@
+#ifndef BONFIRE_SPINLOCK_H
+#define BONFIRE_SPINLOCK_H
+
+#include <kernel/types.h>
+#include <kernel/irq.h>
+#include <kernel/cpu.h>
+
+/*
+ * Test-and-test-and-set spinlock. The _irqsave forms also disable local
+ * interrupts, which is what every lock shared with an interrupt handler
+ * (allocators, run queues) must use. Under contention whichever CPU wins
+ * the cache line gets it next; ticketlock_t below is the fair alternative.
+ * Related: seqlock.h (read-mostly data), spsc_ring.h (lock-free queues).
+ */
+
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock(spinlock_t *l)
+{
+    while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED))
+            cpu_relax();
+}
+
+static inline bool spin_trylock(spinlock_t *l)
+{
+    return __atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+static inline void spin_unlock(spinlock_t *l)
+{
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t spin_lock_irqsave(spinlock_t *l)
+{
+    uint64_t flags = irq_save();
+    spin_lock(l);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *l, uint64_t flags)
+{
+    spin_unlock(l);
+    irq_restore(flags);
+}
+
+/*
+ * Ticket lock: waiters are served in arrival order, so none can starve
+ * while others keep re-taking the lock. One atomic add to take, a plain
+ * release store to drop. At most 65535 waiters.
+ */
+
+typedef struct {
+    volatile uint16_t next;       /* next ticket to hand out */
+    volatile uint16_t owner;      /* ticket now served */
+} ticketlock_t;
+
+#define TICKETLOCK_INIT { 0, 0 }
+
+static inline void ticket_lock(ticketlock_t *l)
+{
+    uint16_t t = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != t)
+        cpu_relax();
+}
+
+static inline void ticket_unlock(ticketlock_t *l)
+{
+    __atomic_store_n(&l->owner, (uint16_t)(l->owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline uint64_t ticket_lock_irqsave(ticketlock_t *l)
+{
+    uint64_t flags = irq_save();
+    ticket_lock(l);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(ticketlock_t *l, uint64_t flags)
+{
+    ticket_unlock(l);
+    irq_restore(flags);
+}
+
+#endif /* BONFIRE_SPINLOCK_H */
@@ -0,0 +1,97 @@
+#ifndef BONFIRE_SPSC_RING_H
+#define BONFIRE_SPSC_RING_H
+
+#include <kernel/types.h>
+
+/*
+ * Lock-free single-producer/single-consumer rings, typed by macro:
+ *
+ *     SPSC_RING(name, type, size)
+ *
+ * defines struct name (zeroed = empty) and name_push/_pop/_count, plus
+ * zero-copy name_slot/_publish (producer) and name_peek/_consume
+ * (consumer) for large elements. size must be a power of two.
+ * One producer and one consumer may run at the same time, on different
+ * CPUs or as interrupt handler and interrupted code, with no lock. Several
+ * producers (or consumers) must be serialised by a lock of their own.
+ * head and tail run free (mod 2^32). The producer fills a slot and then
+ * publishes it with a release store of head; the consumer's acquire load
+ * of head therefore sees the slot filled, and likewise for tail the other
+ * way. Each index sits on its own cache line so the two sides do not
+ * bounce one line between them.
+ */
+
+#define SPSC_CACHELINE 64
+
+#define SPSC_RING(name, type, size)                                             \
+_Static_assert(((size) & ((size) - 1)) == 0, #name ": size not a power of two"); \
+                                                                                \
+struct name {                                                                   \
+    uint32_t head __attribute__((aligned(SPSC_CACHELINE)));  /* producer */    \
+    uint32_t tail __attribute__((aligned(SPSC_CACHELINE)));  /* consumer */    \
+    type buf[size];                                                             \
+};                                                                              \
+                                                                                \
+/* Producer: the next free slot, NULL if full. */                               \
+static inline type *name##_slot(struct name *r)                                 \
+{                                                                               \
+    uint32_t head = r->head;                                                    \
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= (size))           \
+        return NULL;                                                            \
+    return &r->buf[head & ((size) - 1)];                                        \
+}                                                                               \
+                                                                                \
+/* Producer: make the slot from name##_slot visible to the consumer. */         \
+static inline void name##_publish(struct name *r)                               \
+{                                                                               \
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);                  \
+}                                                                               \
+                                                                                \
+static inline bool name##_push(struct name *r, type v)                          \
+{                                                                               \
+    type *slot = name##_slot(r);                                                \
+    if (!slot) return false;                                                    \
+    *slot = v;                                                                  \
+    name##_publish(r);                                                          \
+    return true;                                                                \
+}                                                                               \
+                                                                                \
+/* Consumer: the oldest element, NULL if empty. */                              \
+static inline type *name##_peek(struct name *r)                                 \
+{                                                                               \
+    uint32_t tail = r->tail;                                                    \
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)                    \
+        return NULL;                                                            \
+    return &r->buf[tail & ((size) - 1)];                                        \
+}                                                                               \
+                                                                                \
+/* Consumer: done with the element from name##_peek; the slot is reused. */     \
+static inline void name##_consume(struct name *r)                               \
+{                                                                               \
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);                  \
+}                                                                               \
+                                                                                \
+static inline bool name##_pop(struct name *r, type *out)                        \
+{                                                                               \
+    type *slot = name##_peek(r);                                                \
+    if (!slot) return false;                                                    \
+    *out = *slot;                                                               \
+    name##_consume(r);                                                          \
+    return true;                                                                \
+}                                                                               \
+                                                                                \
+/* Consumer: discard everything published so far. */                            \
+static inline void name##_drain(struct name *r)                                 \
+{                                                                               \
+    __atomic_store_n(&r->tail, __atomic_load_n(&r->head, __ATOMIC_ACQUIRE),     \
+                     __ATOMIC_RELEASE);                                         \
+}                                                                               \
+                                                                                \
+/* Anyone: elements queued (a snapshot; tail first, so never negative). */    \
+static inline uint32_t name##_count(const struct name *r)                       \
+{                                                                               \
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);                \
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;                  \
+}
+
+#endif /* BONFIRE_SPSC_RING_H */
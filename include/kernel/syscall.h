@@ -0,0 +1,47 @@
+#ifndef BONFIRE_SYSCALL_H
+#define BONFIRE_SYSCALL_H
+
+#include <kernel/types.h>
+
+/*
+ * System calls from ring 3 (SYSCALL instruction, arch/syscall_entry.asm).
+ * rax = number, arguments in rdi, rsi, rdx, r10, r8, r9; the result comes
+ * back in rax, a negative errno value on failure. rcx and r11 are
+ * clobbered (the CPU keeps the return rip and rflags there); every other
+ * register is preserved. The numbers are ABI: user code (src/kernel/user)
+ * has its own copy, so only ever append.
+ */
+
+#define SYS_READ    0
+#define SYS_WRITE   1
+#define SYS_OPEN    2
+#define SYS_CLOSE   3
+#define SYS_LSEEK   4
+#define SYS_GETCWD  5
+#define SYS_CHDIR   6
+#define SYS_MKDIR   7
+#define SYS_STAT    8
+#define SYS_EXIT    9
+#define SYS_YIELD   10
+#define SYS_GETPID  11
+#define SYS_COUNT   12
+
+/* syscall_entry passes all six argument registers; none of the calls
+ * needs more than three yet. */
+typedef int64_t (*syscall_fn)(uint64_t a0, uint64_t a1, uint64_t a2);
+
+/* Indexed by rax in syscall_entry (posix/syscall.c). */
+extern const syscall_fn syscall_table[SYS_COUNT];
+
+/* Program EFER.SCE, STAR, LSTAR and SFMASK on the calling CPU. */
+void syscall_init_cpu(void);
+
+/* The ring-3 image: everything in the .user section (linker.ld), mapped
+ * read-only into each user address space at USER_TEXT_BASE. */
+extern const uint8_t __user_start[], __user_end[];
+
+/* Entry points in src/kernel/user, for process_create_user. */
+extern const uint8_t user_syscall_bench[];   /* arg n: exits with cycles per call */
+extern const uint8_t user_clock_bench[];     /* arg n: exits with cycles per clock read */
+
+#endif /* BONFIRE_SYSCALL_H */
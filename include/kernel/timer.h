@@ -2,9 +2,74 @@
 #define BONFIRE_TIMER_H
 
 #include <kernel/types.h>
+#include <kernel/spinlock.h>
 
+/* Calibrate the TSC and the local APIC timer; falls back to a periodic PIT
+ * tick at hz when there is no local APIC. */
 void timer_init(unsigned hz);
-void timer_tick(void);       /* call from IRQ0 handler */
+bool timer_oneshot(void);    /* true: per-CPU one-shot timers, no PIT tick */
+void timer_tick(void);       /* call from IRQ0 handler (PIT fallback) */
 uint32_t timer_get_ms(void); /* milliseconds since boot */
+/* Monotonic time since boot from the TSC (10 ms steps on the PIT fallback). */
+uint64_t timer_get_ns(void);
+uint64_t timer_get_us(void);
+uint32_t timer_tsc_khz(void);   /* 0 if the TSC could not be calibrated */
+bool timer_tsc_invariant(void); /* constant rate across P/C-states (CPUID) */
+/* Interrupt the calling CPU at when_ms (timer_get_ms time). Only the earliest
+ * armed deadline is kept; it is forgotten once it fires (timer_expired). */
+void timer_arm(uint32_t when_ms);
+void timer_expired(void);    /* call from the local APIC timer handler */
+void timer_udelay(uint32_t us); /* busy-wait on PIT channel 2; no interrupts needed */
+
+/*
+ * Timer wheel (timer_wheel.c): callbacks at a timer_get_ms deadline. Each CPU
+ * has a four-level hierarchical wheel of 64 slots (1 ms, 64 ms, 4 s and 4 min
+ * granularity, about 4.6 hours per turn); later deadlines wait in the top
+ * level and are requeued as it turns. Insert and cancel are O(1). Callbacks
+ * run in the SOFTIRQ_TIMER softirq on the CPU that added the timer, with
+ * interrupts on, so they must be short and must not block (process_wake,
+ * wake_up, queue_work or setting a flag). The caller owns struct
+ * timer (zeroed = idle); it must stay alive until it fires or is cancelled.
+ */
+
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SIZE   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+struct timer_base;
+
+struct timer {
+    struct timer *next;
+    struct timer **pprev;         /* NULL when not pending */
+    uint32_t expires;             /* timer_get_ms deadline */
+    void (*fn)(void *arg);
+    void *arg;
+    struct timer_base *base;      /* wheel it was last queued on */
+    uint32_t slot;                /* level * TIMER_WHEEL_SIZE + index */
+};
+
+struct timer_base {
+    spinlock_t lock;
+    uint32_t clk;                 /* next millisecond to process */
+    uint32_t pending;             /* timers queued */
+    struct timer *running;        /* callback in progress, lock dropped */
+    uint64_t bitmap[TIMER_WHEEL_LEVELS];  /* non-empty slots */
+    struct timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+};
+
+/* Queue t on this CPU's wheel to call fn(arg) once timer_get_ms() reaches
+ * deadline_ms. A pending t is moved. */
+void timer_add(struct timer *t, uint32_t deadline_ms, void (*fn)(void *arg), void *arg);
+/* Dequeue t. False if it was not pending (already fired, or never added).
+ * If its callback is running on another CPU, waits for it to return, so the
+ * caller may free what arg points at afterwards. */
+bool timer_cancel(struct timer *t);
+bool timer_pending(const struct timer *t);
+/* Run this CPU's expired callbacks, and report when the wheel next needs to
+ * run (0 = nothing queued). The scheduler raises SOFTIRQ_TIMER once that
+ * time has come; timer_wheel_softirq runs the wheel and re-arms. */
+void timer_wheel_run(uint32_t now);
+uint32_t timer_wheel_next(void);
+void timer_wheel_softirq(void);
 
 #endif /* BONFIRE_TIMER_H */
@@ -0,0 +1,48 @@
+#ifndef BONFIRE_TLSF_H
+#define BONFIRE_TLSF_H
+
+#include <kernel/types.h>
+#include <kernel/memstat.h>
+#include <kernel/spinlock.h>
+
+/*
+ * Two-Level Segregated Fit allocator: O(1) malloc/free with boundary tags
+ * and immediate coalescing in both directions. One struct tlsf is one arena
+ * (the DOOM and Red Alert hosts each own one). On first use an arena reserves
+ * its whole limit as demand-zero memory (paging_reserve_zero), falling back
+ * to growing by buddy blocks from page_alloc.
+ */
+
+#define TLSF_ALIGN      16
+#define TLSF_SL_LOG2    4                       /* 16 second-level lists per class */
+#define TLSF_SL_COUNT   (1 << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT   (TLSF_SL_LOG2 + 4)      /* sizes below 256 share first level 0 */
+#define TLSF_FL_COUNT   32
+
+struct tlsf_block;
+
+struct tlsf {
+    const char *name;
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[TLSF_FL_COUNT];
+    struct tlsf_block *free[TLSF_FL_COUNT][TLSF_SL_COUNT];
+    size_t pool_bytes;   /* memory added to the arena so far */
+    size_t limit;        /* grow from page_alloc while pool_bytes stays below this */
+    size_t growing;      /* claimed by tlsf_grow calls still adding their pool */
+    size_t free_bytes;   /* payload bytes on the free lists */
+    spinlock_t lock;
+    struct mem_stats stats;
+};
+
+void tlsf_init(struct tlsf *t, const char *name, size_t limit);
+/* Hand a memory range to the arena. Returns 0, or -1 if it is too small. */
+int tlsf_add_pool(struct tlsf *t, void *mem, size_t bytes);
+void *tlsf_malloc(struct tlsf *t, size_t size);
+void tlsf_free(struct tlsf *t, void *ptr);
+/* Grows in place into a free neighbour when it can, otherwise moves. */
+void *tlsf_realloc(struct tlsf *t, void *ptr, size_t size);
+size_t tlsf_usable_size(const void *ptr);
+/* Size of the biggest free block (scans one segregated list). */
+size_t tlsf_largest_free(struct tlsf *t);
+
+#endif /* BONFIRE_TLSF_H */
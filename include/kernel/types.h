@@ -11,6 +11,7 @@ typedef signed int         int32_t;
 typedef signed long        int64_t;
 typedef uint64_t           size_t;
 typedef int64_t            ssize_t;
+typedef uint64_t           uintptr_t;
 
 #define NULL ((void *)0)
 #define true  1
@@ -0,0 +1,53 @@
+#ifndef BONFIRE_VCLOCK_H
+#define BONFIRE_VCLOCK_H
+
+#include <kernel/types.h>
+#include <kernel/cpu.h>
+#include <kernel/mm.h>
+#include <kernel/seqlock.h>
+
+/*
+ * Clock data page (drivers/timer.c): everything needed to turn a TSC read
+ * into nanoseconds since boot. The kernel publishes it, and it is mapped
+ * read-only at USER_VCLOCK_BASE in every user address space, so reading
+ * the clock never enters the kernel (user/vclock.asm in ring 3,
+ * vclock_read_ns here). seq is a seqcount (seqlock.h): readers retry
+ * while it is odd or changed under them.
+ * The field offsets are ABI for user/vclock.asm: only append.
+ */
+
+#define VCLOCK_NONE  0            /* not calibrated yet: offset_ns only */
+#define VCLOCK_TSC   1            /* offset_ns + (tsc - tsc_base) * tsc_ns_mult */
+#define VCLOCK_TICK  2            /* PIT fallback: offset_ns advances per tick */
+
+struct vclock_data {
+    seqcount_t seq;               /* +0: odd while an update is in progress */
+    uint32_t mode;                /* +4: VCLOCK_* */
+    uint64_t tsc_base;            /* +8: TSC at offset_ns */
+    uint64_t tsc_ns_mult;         /* +16: ns per TSC tick, 32.32 fixed point */
+    uint64_t offset_ns;           /* +24: boot-time offset */
+    uint32_t tsc_khz;             /* +32 */
+};
+
+/* A page to itself, since all of it is visible to ring 3. */
+union vclock_page {
+    struct vclock_data data;
+    uint8_t bytes[PAGE_SIZE];
+};
+
+extern union vclock_page vclock_page;
+
+static inline uint64_t vclock_read_ns(const struct vclock_data *v)
+{
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = read_seqbegin(&v->seq);
+        ns = v->offset_ns;
+        if (v->mode == VCLOCK_TSC)
+            ns += (uint64_t)(((unsigned __int128)(rdtsc() - v->tsc_base) * v->tsc_ns_mult) >> 32);
+    } while (read_seqretry(&v->seq, seq));
+    return ns;
+}
+
+#endif /* BONFIRE_VCLOCK_H */
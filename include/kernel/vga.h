@@ -31,5 +31,7 @@ void vga_set_color(uint8_t fg, uint8_t bg);
 void vga_putchar(char c);
 void vga_puts(const char *s);
 void vga_putdec(uint32_t n);
+/* 0x + 8 hex digits, or 16 when n does not fit in 32 bits. */
+void vga_puthex(uint64_t n);
 
 #endif /* BONFIRE_VGA_H */
@@ -0,0 +1,66 @@
+#ifndef BONFIRE_WAIT_H
+#define BONFIRE_WAIT_H
+
+#include <kernel/types.h>
+#include <kernel/spinlock.h>
+#include <kernel/timer.h>
+
+/*
+ * Wait queues: a process blocks (PROC_BLOCKED, off every run queue) until
+ * someone calls wake_up on the queue, or until its timeout passes. wake_up is
+ * safe from interrupt handlers. Wake-ups may be spurious, so always wait for a
+ * condition with wait_event / wait_event_timeout rather than the raw calls.
+ * Async tasks (async.h) wait on the same queues without blocking anything.
+ */
+
+struct process;
+struct async_task;
+
+struct wait_queue {
+    spinlock_t lock;
+    struct process *head;         /* FIFO through process.wait_next */
+    struct process *tail;
+    struct async_task *tasks;     /* through async_task.wait_next */
+};
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, NULL, NULL, NULL }
+
+void wait_queue_init(struct wait_queue *wq);
+void wake_up(struct wait_queue *wq);        /* every waiter */
+void wake_up_one(struct wait_queue *wq);    /* the longest waiting process, else a task */
+
+/* Low level. wait_prepare disables interrupts, queues the caller on wq (may be
+ * NULL) and, if deadline_ms is non-zero, on this CPU's timer wheel, then marks
+ * it blocked. wait_block switches away until woken. wait_finish dequeues and
+ * restores the interrupt flag returned by wait_prepare. */
+uint64_t wait_prepare(struct wait_queue *wq, uint32_t deadline_ms);
+void wait_block(void);
+void wait_finish(struct wait_queue *wq, uint64_t flags);
+
+#define wait_event(wq, cond)                                        \
+    do {                                                            \
+        while (!(cond)) {                                           \
+            uint64_t __wf = wait_prepare(&(wq), 0);                 \
+            if (!(cond)) wait_block();                              \
+            wait_finish(&(wq), __wf);                               \
+        }                                                           \
+    } while (0)
+
+/* True once cond holds, false if ms milliseconds pass first. A deadline
+ * that wraps to 0 would mean none to wait_prepare, so it becomes 1. */
+#define wait_event_timeout(wq, cond, ms)                            \
+    ({                                                              \
+        uint32_t __wend = timer_get_ms() + (ms);                    \
+        bool __wok;                                                 \
+        while (!(__wok = (cond)) && (int32_t)(__wend - timer_get_ms()) > 0) { \
+            uint64_t __wf = wait_prepare(&(wq), __wend ? __wend : 1); \
+            if (!(cond)) wait_block();                              \
+            wait_finish(&(wq), __wf);                               \
+        }                                                           \
+        __wok;                                                      \
+    })
+
+/* Block the calling process for at least ms milliseconds; 0 just yields. */
+void sleep_ms(uint32_t ms);
+
+#endif /* BONFIRE_WAIT_H */
@@ -0,0 +1,52 @@
+#ifndef BONFIRE_WORKQUEUE_H
+#define BONFIRE_WORKQUEUE_H
+
+#include <kernel/types.h>
+#include <kernel/spinlock.h>
+#include <kernel/wait.h>
+
+/*
+ * Workqueues (process/workqueue.c): deferred work that runs in a kernel
+ * thread, so unlike a softirq it may block and take as long as it needs.
+ * Each queue has one worker, so its items run in the order queued and never
+ * concurrently with each other. queue_work is IRQ-safe; an item already
+ * queued is not queued twice, but one queued again while it runs runs again.
+ * The caller owns struct work and keeps it alive while it is busy.
+ */
+
+struct work;
+typedef void (*work_fn)(struct work *w);
+
+#define WORK_PENDING  (1u << 0)   /* on a queue */
+#define WORK_RUNNING  (1u << 1)   /* fn in progress */
+
+struct work {
+    struct work *next;
+    work_fn fn;
+    uint32_t flags;               /* WORK_* */
+};
+
+#define WORK_INIT(f) { NULL, (f), 0 }
+
+struct workqueue {
+    const char *name;
+    spinlock_t lock;
+    struct work *head;            /* FIFO */
+    struct work *tail;
+    struct wait_queue wait;       /* the worker sleeps here */
+    struct process *worker;
+    uint64_t done;                /* items run */
+};
+
+/* Shared queue for short jobs (the reaper, net RX). */
+extern struct workqueue *system_wq;
+
+void workqueue_init(void);        /* creates system_wq; after process_init */
+/* New queue with its worker at scheduler level 'level'. NULL if out of memory. */
+struct workqueue *workqueue_create(const char *name, int level);
+/* False if w was already pending. */
+bool queue_work(struct workqueue *wq, struct work *w);
+bool schedule_work(struct work *w);   /* on system_wq */
+bool work_busy(const struct work *w); /* pending or running */
+
+#endif /* BONFIRE_WORKQUEUE_H */
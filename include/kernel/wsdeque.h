@@ -0,0 +1,34 @@
+#ifndef BONFIRE_WSDEQUE_H
+#define BONFIRE_WSDEQUE_H
+
+#include <kernel/types.h>
+
+/*
+ * Chase-Lev work-stealing deque of processes (one per CPU run queue).
+ * Only the owning CPU pushes, at the bottom, with interrupts off. Anyone may
+ * take from the top with a single CAS; the scheduler takes its own work from
+ * the top too, so a CPU's queue stays round-robin and no lock is shared.
+ * Capacity is fixed and ws_push refuses when full; the scheduler then keeps
+ * the process on its CPU's overflow list (process.c).
+ */
+
+#define WS_DEQUE_SIZE 64              /* power of two */
+
+struct process;
+
+struct ws_deque {
+    volatile int64_t top;             /* next to steal; only ever increases */
+    volatile int64_t bottom;          /* next free slot; owner only */
+    struct process *buf[WS_DEQUE_SIZE];
+};
+
+/* Owner only. Returns 0, or -1 if the deque is full. */
+int ws_push(struct ws_deque *d, struct process *p);
+/* Take the oldest entry. NULL if empty or another CPU won the race. */
+struct process *ws_steal(struct ws_deque *d);
+/* Entry ws_steal would return next (racy hint, may be stale). */
+struct process *ws_peek(const struct ws_deque *d);
+/* Number of queued entries (racy snapshot). */
+int ws_size(const struct ws_deque *d);
+
+#endif /* BONFIRE_WSDEQUE_H */
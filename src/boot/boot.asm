@@ -1,6 +1,6 @@
 ; BonfireOS Boot Stub (x86_64 via Long Mode)
 ; 1) Multiboot 1: GRUB loads kernel, jumps here in 32-bit.
-; 2) We set up minimal page tables, GDT, then switch to long mode.
+; 2) We identity-map RAM (1 GiB or 2 MiB pages), load a GDT, then switch to long mode.
 ; 3) We jump to 64-bit code which calls kernel_main(magic, multiboot_info).
 
 %define MB_MAGIC  0x1BADB002
@@ -13,6 +13,15 @@
 %define EFER_LME       (1 << 8)
 %define CR0_PG         (1 << 31)
 %define CR0_PE         (1 << 0)
+%define CPUID_PDPE1GB  (1 << 26)
+%define MBOOT_LOADER_MAGIC 0x2BADB002
+%define MBI_FLAG_MMAP  (1 << 6)
+%define MBI_MMAP_LEN   44
+%define MBI_MMAP_ADDR  48
+%define MMAP_AVAILABLE 1
+; Without 1 GiB pages the boot map covers this many GiB with 2 MiB pages;
+; paging_init maps the rest of RAM.
+%define BOOT_PD_COUNT  4
 
 section .multiboot
 align 4
@@ -23,10 +32,11 @@ multiboot_header:
 
 section .bss
 align 4096
-; Page tables: identity map first 2 MiB (covers kernel at 1 MiB)
+; Page tables: direct (identity) map of RAM with 1 GiB or 2 MiB pages
 pml4:    resb 4096
 pdpt:    resb 4096
-pd:      resb 4096
+pd:      resb 4096 * BOOT_PD_COUNT
+boot_tables_end:
 ; GDT for long mode (code + data)
 gdt_desc:
     resw 1
@@ -37,6 +47,9 @@ align 4
 ; Passed from 32-bit to 64-bit
 multiboot_magic: dd 0
 multiboot_info:  dd 0
+; GiB of physical memory identity-mapped here (read by paging.c)
+global boot_direct_map_gib
+boot_direct_map_gib: dd 0
 
 ; GDT for long mode: null, code 0x08, data 0x10
 gdt:
@@ -62,28 +75,111 @@ _start:
     mov dword [multiboot_magic], eax
     mov dword [multiboot_info], ebx
 
-    ; Clear BSS
-    mov edi, __bss_start
-.clear_bss:
-    cmp edi, __bss_end
-    jge .bss_done
-    mov byte [edi], 0
-    inc edi
-    jmp .clear_bss
-.bss_done:
-
-    ; Identity-map first 2 MiB: PML4[0] -> PDPT -> PD -> 2 MiB page
+    ; Zero the boot page tables; the rest of BSS is cleared in long mode
+    mov edi, pml4
+    mov ecx, (boot_tables_end - pml4) / 4
+    xor eax, eax
+    rep stosd
+
+    ; Top of RAM from the multiboot memory map, in GiB rounded up -> ebp
+    mov ebp, 1
+    cmp dword [multiboot_magic], MBOOT_LOADER_MAGIC
+    jne .ram_done
+    mov ebx, [multiboot_info]
+    test dword [ebx], MBI_FLAG_MMAP
+    jz .ram_done
+    mov esi, [ebx + MBI_MMAP_ADDR]
+    mov edi, esi
+    add edi, [ebx + MBI_MMAP_LEN]
+.ram_next:
+    cmp esi, edi
+    jae .ram_done
+    cmp dword [esi + 20], MMAP_AVAILABLE
+    jne .ram_skip
+    mov eax, [esi + 4]              ; base (low, high)
+    mov edx, [esi + 8]
+    add eax, [esi + 12]             ; + length (low, high)
+    adc edx, [esi + 16]
+    add eax, 0x3FFFFFFF             ; round up to 1 GiB
+    adc edx, 0
+    shrd eax, edx, 30
+    cmp eax, ebp
+    jbe .ram_skip
+    mov ebp, eax
+.ram_skip:
+    add esi, [esi]                  ; entry size excludes the size field
+    add esi, 4
+    jmp .ram_next
+.ram_done:
+    cmp ebp, 512                    ; one PDPT = 512 GiB
+    jbe .ram_clamped
+    mov ebp, 512
+.ram_clamped:
+
+    ; PML4[0] -> PDPT
     mov eax, pdpt
     or eax, PAGE_PRESENT | PAGE_WRITE
     mov dword [pml4], eax
 
-    mov eax, pd
+    ; 1 GiB pages if CPUID.80000001h:EDX.Page1GB
+    mov eax, 0x80000000
+    cpuid
+    cmp eax, 0x80000001
+    jb .map_2m
+    mov eax, 0x80000001
+    cpuid
+    test edx, CPUID_PDPE1GB
+    jz .map_2m
+
+    ; PDPT[i] = i GiB, huge
+    xor ecx, ecx
+.map_1g_next:
+    mov eax, ecx
+    shl eax, 30
+    or eax, PAGE_PRESENT | PAGE_WRITE | PAGE_HUGE
+    mov edx, ecx
+    shr edx, 2
+    mov dword [pdpt + ecx * 8], eax
+    mov dword [pdpt + ecx * 8 + 4], edx
+    inc ecx
+    cmp ecx, ebp
+    jb .map_1g_next
+    jmp .map_done
+
+.map_2m:
+    cmp ebp, BOOT_PD_COUNT
+    jbe .map_2m_pdpt
+    mov ebp, BOOT_PD_COUNT
+.map_2m_pdpt:
+    ; PDPT[i] -> pd + i * 4 KiB
+    xor ecx, ecx
+.map_pdpt_next:
+    mov eax, ecx
+    shl eax, 12
+    add eax, pd
     or eax, PAGE_PRESENT | PAGE_WRITE
-    mov dword [pdpt], eax
-
-    mov eax, 0
+    mov dword [pdpt + ecx * 8], eax
+    inc ecx
+    cmp ecx, ebp
+    jb .map_pdpt_next
+    ; pd[i] = i * 2 MiB, huge, for ebp * 512 entries
+    mov edi, ebp
+    shl edi, 9
+    xor ecx, ecx
+.map_pd_next:
+    mov eax, ecx
+    shl eax, 21
     or eax, PAGE_PRESENT | PAGE_WRITE | PAGE_HUGE
-    mov dword [pd], eax
+    mov edx, ecx
+    shr edx, 11
+    mov dword [pd + ecx * 8], eax
+    mov dword [pd + ecx * 8 + 4], edx
+    inc ecx
+    cmp ecx, edi
+    jb .map_pd_next
+
+.map_done:
+    mov dword [boot_direct_map_gib], ebp
 
     ; Load CR3 (PML4)
     mov eax, pml4
@@ -127,6 +223,19 @@ long_mode_entry:
     mov ss, ax
     mov rsp, __stack_top
 
+    ; Clear the rest of BSS around the (live) page tables, 8 bytes per store
+    xor eax, eax
+    mov rdi, __bss_start
+    mov rcx, pml4
+    sub rcx, rdi
+    shr rcx, 3
+    rep stosq
+    mov rdi, boot_tables_end
+    mov rcx, __bss_end
+    sub rcx, rdi
+    shr rcx, 3
+    rep stosq
+
     ; kernel_main(uint32_t magic, uint32_t multiboot_info_phys)
     mov edi, dword [multiboot_magic]
     mov esi, dword [multiboot_info]
@@ -0,0 +1,181 @@
+/**
+ * ACPI tables: locate the RSDP in the EBDA or the BIOS ROM area, walk the
+ * RSDT/XSDT and summarise the MADT (local APICs, I/O APICs, ISA overrides).
+ * Multiboot 1 does not hand us the RSDP, so it is found by the classic scan.
+ */
+
+#include <kernel/acpi.h>
+#include <kernel/mm.h>
+#include <kernel/paging.h>
+#include <kernel/types.h>
+
+#define EBDA_SEG_PTR   0x40E
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END   0x100000
+
+#define MADT_LAPIC           0
+#define MADT_IOAPIC          1
+#define MADT_ISO             2
+#define MADT_LAPIC_OVERRIDE  5
+#define MADT_LAPIC_ENABLED   (1u << 0)
+#define MADT_PCAT_COMPAT     (1u << 0)
+
+struct acpi_rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+    /* ACPI 2.0+ */
+    uint32_t length;
+    uint64_t xsdt_addr;
+    uint8_t ext_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct madt {
+    struct acpi_sdt_header hdr;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed));
+
+static const struct acpi_sdt_header *root;   /* RSDT or XSDT */
+static bool root_is_xsdt;
+static struct acpi_madt_info madt_info;
+
+/* Tables above the direct map, mapped once each. Only the boot path looks
+ * tables up, so this needs no lock. */
+#define ACPI_MAPPED_MAX 32
+static struct {
+    uint64_t phys;
+    const struct acpi_sdt_header *h;
+} mapped[ACPI_MAPPED_MAX];
+static int nmapped;
+
+static bool checksum_ok(const void *p, size_t len)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++) sum += b[i];
+    return sum == 0;
+}
+
+static const void *table_ptr(uint64_t phys)
+{
+    if (phys < paging_direct_map_end()) return phys_to_virt(phys);
+    for (int i = 0; i < nmapped; i++)
+        if (mapped[i].phys == phys) return mapped[i].h;
+    if (nmapped == ACPI_MAPPED_MAX) return NULL;
+    /* Firmware tables above RAM. The header's page is mapped whole anyway, so
+     * map to its end; only a table running past it needs a second, full map. */
+    size_t first = PAGE_SIZE - (phys & (PAGE_SIZE - 1));
+    if (first < sizeof(struct acpi_sdt_header)) first += PAGE_SIZE;
+    const struct acpi_sdt_header *h = mmio_map(phys, first, CACHE_WB);
+    if (!h) return NULL;
+    if (h->length > first) {
+        uint32_t len = h->length;
+        mmio_unmap((void *)h, first);
+        if ((h = mmio_map(phys, len, CACHE_WB)) == NULL) return NULL;
+    }
+    mapped[nmapped].phys = phys;
+    mapped[nmapped++].h = h;
+    return h;
+}
+
+static const struct acpi_rsdp *scan_rsdp(uint64_t start, uint64_t end)
+{
+    for (uint64_t a = start; a + sizeof(struct acpi_rsdp) <= end; a += 16) {
+        const char *s = (const char *)phys_to_virt(a);
+        if (s[0] == 'R' && s[1] == 'S' && s[2] == 'D' && s[3] == ' ' &&
+            s[4] == 'P' && s[5] == 'T' && s[6] == 'R' && s[7] == ' ' && checksum_ok(s, 20))
+            return (const struct acpi_rsdp *)s;
+    }
+    return NULL;
+}
+
+static bool sig_eq(const char *a, const char *b)
+{
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && a[3] == b[3];
+}
+
+const struct acpi_sdt_header *acpi_find_table(const char *sig)
+{
+    if (!root) return NULL;
+    size_t esize = root_is_xsdt ? 8 : 4;
+    size_t n = (root->length - sizeof(*root)) / esize;
+    const uint8_t *ents = (const uint8_t *)(root + 1);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t phys = root_is_xsdt ? *(const uint64_t *)(ents + i * 8) : *(const uint32_t *)(ents + i * 4);
+        const struct acpi_sdt_header *h = (const struct acpi_sdt_header *)table_ptr(phys);
+        if (h && sig_eq(h->signature, sig) && checksum_ok(h, h->length)) return h;
+    }
+    return NULL;
+}
+
+static void parse_madt(const struct madt *m)
+{
+    madt_info.lapic_addr = m->lapic_addr;
+    madt_info.has_8259 = (m->flags & MADT_PCAT_COMPAT) != 0;
+    const uint8_t *p = (const uint8_t *)(m + 1);
+    const uint8_t *end = (const uint8_t *)m + m->hdr.length;
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        switch (p[0]) {
+        case MADT_LAPIC:
+            if ((*(const uint32_t *)(p + 4) & MADT_LAPIC_ENABLED) && madt_info.cpu_count < MAX_CPUS)
+                madt_info.cpu_apic_ids[madt_info.cpu_count++] = p[3];
+            break;
+        case MADT_IOAPIC:
+            if (madt_info.ioapic_count < ACPI_MAX_IOAPICS) {
+                struct acpi_ioapic *io = &madt_info.ioapics[madt_info.ioapic_count++];
+                io->id = p[2];
+                io->addr = *(const uint32_t *)(p + 4);
+                io->gsi_base = *(const uint32_t *)(p + 8);
+            }
+            break;
+        case MADT_ISO:
+            if (madt_info.iso_count < ACPI_MAX_ISOS) {
+                struct acpi_iso *iso = &madt_info.isos[madt_info.iso_count++];
+                iso->source = p[3];
+                iso->gsi = *(const uint32_t *)(p + 4);
+                iso->flags = *(const uint16_t *)(p + 8);
+            }
+            break;
+        case MADT_LAPIC_OVERRIDE:
+            madt_info.lapic_addr = *(const uint64_t *)(p + 4);
+            break;
+        }
+        p += p[1];
+    }
+}
+
+int acpi_init(void)
+{
+    /* BDA word at 0x40E; hide the constant address from -Warray-bounds. */
+    const uint16_t *bda = phys_to_virt(EBDA_SEG_PTR);
+    __asm__ ("" : "+r"(bda));
+    uint64_t ebda = (uint64_t)*bda << 4;
+    const struct acpi_rsdp *rsdp = NULL;
+    if (ebda >= 0x80000 && ebda < 0xA0000) rsdp = scan_rsdp(ebda, ebda + 1024);
+    if (!rsdp) rsdp = scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+    if (!rsdp) return -1;
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_addr && checksum_ok(rsdp, rsdp->length)) {
+        root = (const struct acpi_sdt_header *)table_ptr(rsdp->xsdt_addr);
+        root_is_xsdt = true;
+    } else {
+        root = (const struct acpi_sdt_header *)table_ptr(rsdp->rsdt_addr);
+        root_is_xsdt = false;
+    }
+    if (!root || !checksum_ok(root, root->length)) {
+        root = NULL;
+        return -1;
+    }
+    const struct madt *m = (const struct madt *)acpi_find_table("APIC");
+    if (m) parse_madt(m);
+    return 0;
+}
+
+const struct acpi_madt_info *acpi_madt(void)
+{
+    return &madt_info;
+}
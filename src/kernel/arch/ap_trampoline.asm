@@ -0,0 +1,90 @@
+; AP start-up trampoline.
+; smp.c copies ap_trampoline_start..ap_trampoline_end to AP_TRAMPOLINE_BASE
+; (below 1 MiB) and points the STARTUP IPI at it. Each AP goes real mode ->
+; protected mode -> long mode on the kernel page tables, then calls the C entry
+; in ap_tramp_entry with rdi = ap_tramp_cpu on the stack in ap_tramp_stack.
+
+%define AP_TRAMPOLINE_BASE 0x8000
+%define TRAMP(x) (AP_TRAMPOLINE_BASE + ((x) - ap_trampoline_start))
+
+%define CR0_PE    (1 << 0)
+%define CR0_PG    (1 << 31)
+%define CR4_PAE   (1 << 5)
+%define EFER_MSR  0xC0000080
+%define EFER_LME  (1 << 8)
+
+section .text
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_tramp_cr3
+global ap_tramp_stack
+global ap_tramp_cpu
+global ap_tramp_entry
+
+[bits 16]
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [TRAMP(tramp_gdt_desc)]
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+    jmp dword 0x08:TRAMP(ap_pm32)
+
+[bits 32]
+ap_pm32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov eax, cr4
+    or eax, CR4_PAE
+    mov cr4, eax
+    mov eax, [TRAMP(ap_tramp_cr3)]
+    mov cr3, eax
+    mov ecx, EFER_MSR
+    rdmsr
+    or eax, EFER_LME
+    wrmsr
+    mov eax, cr0
+    or eax, CR0_PG
+    mov cr0, eax
+    jmp 0x18:TRAMP(ap_lm64)
+
+[bits 64]
+ap_lm64:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor eax, eax
+    mov fs, ax
+    mov gs, ax
+    mov rsp, [TRAMP(ap_tramp_stack)]
+    mov rdi, [TRAMP(ap_tramp_cpu)]
+    mov rax, [TRAMP(ap_tramp_entry)]
+    call rax
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+align 8
+tramp_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF   ; 0x08: 32-bit code
+    dq 0x00CF92000000FFFF   ; 0x10: data
+    dq 0x00AF9A000000FFFF   ; 0x18: 64-bit code
+tramp_gdt_desc:
+    dw 4 * 8 - 1
+    dd TRAMP(tramp_gdt)
+
+align 8
+; Filled in by smp.c in the low-memory copy
+ap_tramp_cr3:   dq 0
+ap_tramp_stack: dq 0
+ap_tramp_cpu:   dq 0
+ap_tramp_entry: dq 0
+ap_trampoline_end:
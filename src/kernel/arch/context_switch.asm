@@ -1,7 +1,31 @@
-; Context switch: load new stack pointer and return via iretq (as from interrupt).
-; void context_switch_to(uint64_t new_rsp);
-; The stack at new_rsp must have: rax, rbx, rcx, rdx, rsi, rdi, rbp, r8..r15, vector, iret frame.
+; Context switch between kernel stacks. A process that is not running has
+; rsp saved pointing at: r15, r14, r13, r12, rbx, rbp, return address. Only
+; the callee-saved registers are kept; everything else was saved by whoever
+; called into the scheduler (the C compiler, or an interrupt stub's full
+; frame further up the stack).
+
+extern scheduler_switch_done
+
+; void context_switch(uint64_t *save_rsp, uint64_t new_rsp);
+global context_switch
+context_switch:
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+    mov rsp, rsi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    ret
 
+; void context_switch_to(uint64_t new_rsp);
 global context_switch_to
 context_switch_to:
     mov rsp, rdi
@@ -9,6 +33,20 @@ context_switch_to:
     pop r14
     pop r13
     pop r12
+    pop rbx
+    pop rbp
+    ret
+
+; First return of a new process: below its switch frame is an interrupt-style
+; frame (rax..r15, vector, iret frame) that starts the entry function. A
+; ring-3 entry needs the user GS base loaded, as on any return to ring 3.
+global process_start
+process_start:
+    call scheduler_switch_done
+    pop r15
+    pop r14
+    pop r13
+    pop r12
     pop r11
     pop r10
     pop r9
@@ -21,4 +59,8 @@ context_switch_to:
     pop rbx
     pop rax
     add rsp, 8   ; skip vector
+    test byte [rsp + 8], 3
+    jz .kernel
+    swapgs
+.kernel:
     iretq
@@ -0,0 +1,151 @@
+/**
+ * Lazy FPU/SSE/AVX context switching.
+ * Each CPU remembers whose state its registers hold (struct cpu.fpu_owner)
+ * and each process on which CPU its registers were last loaded (fpu_cpu);
+ * both must match for the registers to be current, so a PCB that is freed and
+ * reused never inherits stale ownership. Switching to anyone else sets
+ * CR0.TS; the #NM trap then restores from the process's save area, using
+ * XRSTOR when the CPU has XSAVE and FXRSTOR otherwise. State is saved at
+ * switch-out only if CR0.TS is clear, i.e. the process touched the FPU during
+ * that slice, with XSAVEOPT when available so unmodified components are
+ * skipped. Saving at switch-out (rather than on the next trap) keeps a
+ * process's state out of a CPU it may migrate away from.
+ */
+
+#include <kernel/fpu.h>
+#include <kernel/process.h>
+#include <kernel/smp.h>
+#include <kernel/mm.h>
+#include <kernel/cpu.h>
+#include <kernel/types.h>
+
+#define CPUID1_ECX_XSAVE  (1u << 26)
+#define CPUID1_ECX_AVX    (1u << 28)
+#define CPUIDD1_EAX_XSAVEOPT (1u << 0)
+#define XCR0_X87          (1UL << 0)
+#define XCR0_SSE          (1UL << 1)
+#define XCR0_AVX          (1UL << 2)
+
+#define FXSAVE_SIZE       512
+#define FPU_FCW_INIT      0x037F   /* all x87 exceptions masked, 64-bit precision */
+#define FPU_MXCSR_INIT    0x1F80   /* all SSE exceptions masked, round to nearest */
+
+static bool has_xsave, has_xsaveopt, has_avx;
+static uint64_t xcr0;
+static uint32_t state_size = FXSAVE_SIZE;
+static struct kmem_cache *fpu_cache;
+
+static inline void clts(void)
+{
+    __asm__ volatile ("clts" : : : "memory");
+}
+
+static inline void stts(void)
+{
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static void save(void *area)
+{
+    uint32_t lo = (uint32_t)xcr0, hi = (uint32_t)(xcr0 >> 32);
+    if (has_xsaveopt)
+        __asm__ volatile ("xsaveopt64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    else if (has_xsave)
+        __asm__ volatile ("xsave64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    else
+        __asm__ volatile ("fxsave64 (%0)" : : "r"(area) : "memory");
+}
+
+static void restore(const void *area)
+{
+    uint32_t lo = (uint32_t)xcr0, hi = (uint32_t)(xcr0 >> 32);
+    if (has_xsave)
+        __asm__ volatile ("xrstor64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    else
+        __asm__ volatile ("fxrstor64 (%0)" : : "r"(area) : "memory");
+}
+
+/* Power-on state: an all-zero XSAVE header means every component is in its
+ * init state; FXRSTOR takes the control words from the legacy area. */
+static void *alloc_state(void)
+{
+    uint8_t *area = kmem_cache_alloc(fpu_cache);
+    if (!area) return NULL;
+    uint64_t *w = (uint64_t *)area;
+    for (uint32_t i = 0; i < state_size / 8; i++) w[i] = 0;
+    *(uint16_t *)(area + 0) = FPU_FCW_INIT;
+    *(uint32_t *)(area + 24) = FPU_MXCSR_INIT;
+    return area;
+}
+
+void fpu_init_cpu(void)
+{
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (has_xsave) cr4 |= CR4_OSXSAVE;
+    write_cr4(cr4);
+    if (has_xsave) xsetbv(0, xcr0);
+    __asm__ volatile ("fninit");
+    stts();
+}
+
+void fpu_init(void)
+{
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    has_xsave = (c & CPUID1_ECX_XSAVE) != 0;
+    if (has_xsave) {
+        has_avx = (c & CPUID1_ECX_AVX) != 0;
+        cpuid(0xD, 0, &a, &b, &c, &d);
+        xcr0 = (XCR0_X87 | XCR0_SSE | (has_avx ? XCR0_AVX : 0)) & a;
+        cpuid(0xD, 1, &a, &b, &c, &d);
+        has_xsaveopt = (a & CPUIDD1_EAX_XSAVEOPT) != 0;
+    }
+    fpu_init_cpu();
+    if (has_xsave) {
+        cpuid(0xD, 0, &a, &b, &c, &d);   /* EBX: area size for the XCR0 just set */
+        state_size = b;
+    }
+    fpu_cache = kmem_cache_create("fpu", state_size, 64);
+}
+
+bool fpu_trap(void)
+{
+    struct cpu *c = this_cpu();
+    struct process *p = c->current;
+    clts();
+    if (!p || p == c->idle) {
+        c->fpu_owner = NULL;      /* boot code: the owner's copy is already saved */
+        return true;
+    }
+    if (c->fpu_owner == p && p->fpu_cpu == c) return true;
+    if (!p->fpu_state && !(p->fpu_state = alloc_state())) return false;
+    restore(p->fpu_state);
+    c->fpu_owner = p;
+    p->fpu_cpu = c;
+    return true;
+}
+
+void fpu_switch(struct cpu *c, struct process *prev, struct process *next)
+{
+    if (prev && c->fpu_owner == prev && !(read_cr0() & CR0_TS))
+        save(prev->fpu_state);
+    if (c->fpu_owner == next && next->fpu_cpu == c) clts();
+    else stts();
+}
+
+void fpu_free(struct process *p)
+{
+    if (p->fpu_state) kmem_cache_free(fpu_cache, p->fpu_state);
+    p->fpu_state = NULL;
+}
+
+bool fpu_has_avx(void)
+{
+    return has_avx && (xcr0 & XCR0_AVX);
+}
+
+uint32_t fpu_state_size(void)
+{
+    return state_size;
+}
@@ -0,0 +1,63 @@
+/**
+ * Kernel GDT and TSS, one set per CPU.
+ * Long mode ignores most segmentation, but the TSS still provides the
+ * interrupt stack table: page faults and double faults switch to their own
+ * stacks so a fault on a lazily committed or overflowed kernel stack can
+ * still be handled, and its rsp0 is where interrupts from ring 3 land.
+ */
+
+#include <kernel/gdt.h>
+#include <kernel/mm.h>
+#include <kernel/types.h>
+
+struct gdt_ptr {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed));
+
+static void set_tss_desc(uint64_t *gdt, int n, uint64_t base, uint32_t limit)
+{
+    gdt[n] = (limit & 0xFFFF)
+           | ((base & 0xFFFFFF) << 16)
+           | ((uint64_t)0x89 << 40)                 /* present, 64-bit TSS (available) */
+           | ((uint64_t)((limit >> 16) & 0xF) << 48)
+           | (((base >> 24) & 0xFF) << 56);
+    gdt[n + 1] = base >> 32;
+}
+
+static uint64_t ist_stack(void)
+{
+    uint8_t *s = (uint8_t *)page_alloc(IST_STACK_ORDER);
+    return s ? (uint64_t)(s + ((size_t)PAGE_SIZE << IST_STACK_ORDER)) : 0;
+}
+
+int gdt_init(struct cpu_gdt *g)
+{
+    g->gdt[0] = 0;
+    g->gdt[1] = 0x00AF9A000000FFFFUL;   /* 64-bit code, DPL 0 */
+    g->gdt[2] = 0x00AF92000000FFFFUL;   /* data */
+    g->gdt[3] = 0x00CFFA000000FFFFUL;   /* 32-bit code, DPL 3 */
+    g->gdt[4] = 0x00AFF2000000FFFFUL;   /* data, DPL 3 */
+    g->gdt[5] = 0x00AFFA000000FFFFUL;   /* 64-bit code, DPL 3 */
+    g->tss.ist[IST_PAGE_FAULT - 1] = ist_stack();
+    g->tss.ist[IST_DOUBLE_FAULT - 1] = ist_stack();
+    if (!g->tss.ist[IST_PAGE_FAULT - 1] || !g->tss.ist[IST_DOUBLE_FAULT - 1]) return -1;
+    g->tss.iomap_base = sizeof(g->tss);
+    set_tss_desc(g->gdt, GDT_TSS / 8, (uint64_t)&g->tss, sizeof(g->tss) - 1);
+
+    struct gdt_ptr gdtp = { sizeof(g->gdt) - 1, (uint64_t)g->gdt };
+    __asm__ volatile ("lgdt %0" : : "m"(gdtp));
+    /* Reload the segment registers: APs arrive on the trampoline's CS. */
+    __asm__ volatile ("pushq %0\n\t"
+                      "leaq 1f(%%rip), %%rax\n\t"
+                      "pushq %%rax\n\t"
+                      "lretq\n"
+                      "1:\n\t"
+                      "movw %w1, %%ax\n\t"
+                      "movw %%ax, %%ds\n\t"
+                      "movw %%ax, %%es\n\t"
+                      "movw %%ax, %%ss"
+                      : : "i"(GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA) : "rax", "memory");
+    __asm__ volatile ("ltr %w0" : : "r"((uint16_t)GDT_TSS));
+    return 0;
+}
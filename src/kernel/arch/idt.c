@@ -6,6 +6,15 @@
 #include <kernel/idt.h>
 #include <kernel/irq.h>
 #include <kernel/keyboard.h>
+#include <kernel/lapic.h>
+#include <kernel/smp.h>
+#include <kernel/gdt.h>
+#include <kernel/mm.h>
+#include <kernel/process.h>
+#include <kernel/paging.h>
+#include <kernel/cpu.h>
+#include <kernel/fpu.h>
+#include <kernel/vga.h>
 #include <kernel/port.h>
 
 /* External assembly handlers - exceptions 0-31 */
@@ -30,6 +39,14 @@ extern void irq44(void);
 extern void irq45(void);
 extern void irq46(void);
 extern void irq47(void);
+/* Local APIC: reschedule and TLB shootdown IPIs, spurious */
+extern void lapic_timer_irq(void);
+extern void resched_irq(void);
+extern void irq241(void);
+extern void spurious_irq(void);
+/* Dynamic vectors: IRQ_DYN_COUNT stubs, IRQ_STUB_SIZE bytes apart */
+extern const uint8_t irq_dyn_stubs[];
+#define IRQ_STUB_SIZE 16
 
 struct idt_entry {
     uint16_t offset_low;
@@ -55,8 +72,8 @@ static void set_gate(uint8_t n, uint64_t handler, uint16_t sel, uint8_t type)
     idt[n].offset_mid  = (uint16_t)((handler >> 16) & 0xFFFF);
     idt[n].offset_high = (uint32_t)((handler >> 32) & 0xFFFFFFFF);
     idt[n].selector    = sel;
-    idt[n].ist         = 0;
-    idt[n].type_attr   = type | 0x60; /* DPL=0, present */
+    idt[n].ist         = 0;   /* idt_init sets IST slots afterwards */
+    idt[n].type_attr   = type | 0x80; /* present, DPL 0 */
     idt[n].zero        = 0;
 }
 
@@ -78,6 +95,9 @@ void idt_init(void)
     };
     for (int i = 0; i < 32; i++)
         set_gate(i, (uint64_t)exc_handlers[i], 0x08, IDT_TYPE_INTR);
+    /* Faults on a kernel stack (lazy commit, guard page) need a stack of their own. */
+    idt[EXC_PAGE_FAULT].ist = IST_PAGE_FAULT;
+    idt[EXC_DOUBLE_FAULT].ist = IST_DOUBLE_FAULT;
 
     /* IRQ 0-15 -> vectors 32-47 */
     uint64_t *irq_handlers[] = {
@@ -89,20 +109,79 @@ void idt_init(void)
     for (int i = 0; i < 16; i++)
         set_gate(IRQ_BASE + i, (uint64_t)irq_handlers[i], 0x08, IDT_TYPE_INTR);
 
+    for (int i = 0; i < IRQ_DYN_COUNT; i++)
+        set_gate(IRQ_DYN_BASE + i, (uint64_t)(irq_dyn_stubs + i * IRQ_STUB_SIZE), 0x08, IDT_TYPE_INTR);
+
+    set_gate(LAPIC_TIMER_VECTOR, (uint64_t)lapic_timer_irq, 0x08, IDT_TYPE_INTR);
+    set_gate(IPI_RESCHEDULE, (uint64_t)resched_irq, 0x08, IDT_TYPE_INTR);
+    set_gate(IPI_TLB_SHOOTDOWN, (uint64_t)irq241, 0x08, IDT_TYPE_INTR);
+    set_gate(LAPIC_SPURIOUS_VECTOR, (uint64_t)spurious_irq, 0x08, IDT_TYPE_INTR);
+
+    idt_load();
+}
+
+/* The table is shared; each AP only needs to load it. */
+void idt_load(void)
+{
     __asm__ volatile ("lidt %0" : : "m"(idtp));
 }
 
 void idt_irq_handler(uint64_t vector)
 {
+    irq_enter();
     if (vector >= IRQ_BASE && vector < IRQ_BASE + 16)
         irq_eoi((uint8_t)(vector - IRQ_BASE));
-    if (vector == IRQ_BASE + 1)
+    else
+        lapic_eoi();
+    if (vector >= IRQ_DYN_BASE && vector < IRQ_DYN_BASE + IRQ_DYN_COUNT)
+        irq_dispatch((uint8_t)vector);
+    else if (vector == IRQ_BASE + 1)
         keyboard_irq_handler();
+    else if (vector == IPI_TLB_SHOOTDOWN)
+        smp_tlb_flush_ipi();
+    irq_exit();
 }
 
-void idt_exception_handler(uint64_t vector)
+/* frame points at the CPU-pushed rip, cs, rflags, rsp, ss. */
+void idt_exception_handler(uint64_t vector, uint64_t error, const uint64_t *frame)
 {
-    (void)vector;
-    /* TODO: print exception and halt or continue */
+    uint64_t cr2 = 0;
+    if (vector == EXC_DEVICE_NOT_AVAILABLE && fpu_trap()) return;
+    if ((frame[1] & 3) && vector != EXC_DOUBLE_FAULT) {
+        /* Ring 3: kill the process, not the system. */
+        vga_puts("\npid ");
+        vga_putdec((uint32_t)process_current()->pid);
+        vga_puts(" killed: exception ");
+        vga_putdec((uint32_t)vector);
+        vga_puts(" rip ");
+        vga_puthex(frame[0]);
+        if (vector == EXC_PAGE_FAULT) {
+            vga_puts(" addr ");
+            vga_puthex(read_cr2());
+        }
+        vga_putchar('\n');
+        process_exit(-1);
+    }
+    if (vector == EXC_PAGE_FAULT || vector == EXC_DOUBLE_FAULT) {
+        cr2 = read_cr2();
+        if (vector == EXC_PAGE_FAULT && paging_handle_fault(cr2, error)) return;
+        if (kstack_is_guard(cr2)) {
+            struct process *p = process_current();
+            vga_puts("\nKernel stack overflow, pid ");
+            vga_putdec(p ? (uint32_t)p->pid : 0);
+        }
+    }
+    vga_puts("\nException ");
+    vga_putdec((uint32_t)vector);
+    vga_puts(" error ");
+    vga_puthex(error);
+    vga_puts(" rip ");
+    vga_puthex(frame[0]);
+    if (cr2) {
+        vga_puts(" addr ");
+        vga_puthex(cr2);
+    }
+    vga_puts("\nSystem halted.\n");
+    __asm__ volatile ("cli");
     for (;;) __asm__ volatile ("hlt");
 }
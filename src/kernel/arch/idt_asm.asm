@@ -1,9 +1,21 @@
 ; IDT handler stubs: call C handler with vector number, then EOI for IRQs
-; IRQ 0 (vector 32): timer -> scheduler_tick then context switch
+; IRQ 0 (vector 32) and the reschedule IPI: scheduler then context switch
 
 extern idt_irq_handler
 extern idt_exception_handler
 extern scheduler_tick
+extern scheduler_ipi
+extern scheduler_timer
+
+; Interrupts from ring 3 arrive with the user GS base loaded: swap in the
+; per-CPU one (smp.h) on entry and back on exit. %1 = offset of the saved
+; CS from rsp.
+%macro SWAPGS_IF_USER 1
+    test byte [rsp + %1], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
 
 %macro IRQ 1
 global irq%1
@@ -12,10 +24,16 @@ irq%1:
     jmp irq_common
 %endmacro
 
-; Timer IRQ: save state, call scheduler_tick(rsp), switch to returned rsp
-global timer_irq
-timer_irq:
-    push qword 32
+; Scheduler entry: save the interrupted state and call %3, which may switch
+; to another process (context_switch) and return here only once this one is
+; resumed. Vector 32 = PIT timer (scheduler_tick), 0xEF = local APIC timer
+; (scheduler_timer), IPI_RESCHEDULE = scheduler_ipi. Voluntary switches
+; (process_block, process_yield) call the scheduler directly.
+%macro SCHED_IRQ 3
+global %1
+%1:
+    push qword %2
+    SWAPGS_IF_USER 16
     push rax
     push rbx
     push rcx
@@ -31,9 +49,7 @@ timer_irq:
     push r13
     push r14
     push r15
-    mov rdi, rsp
-    call scheduler_tick
-    mov rsp, rax
+    call %3
     pop r15
     pop r14
     pop r13
@@ -49,17 +65,39 @@ timer_irq:
     pop rcx
     pop rbx
     pop rax
+    SWAPGS_IF_USER 16
     add rsp, 8
     iretq
+%endmacro
+
+SCHED_IRQ timer_irq, 32, scheduler_tick
+SCHED_IRQ lapic_timer_irq, 0xEF, scheduler_timer
+SCHED_IRQ resched_irq, 0xF0, scheduler_ipi
+
+; Local APIC spurious interrupt: no EOI
+global spurious_irq
+spurious_irq:
+    iretq
 
+; Exceptions: frame is always [vector][error code]; the CPU pushes the error
+; code only for some vectors, so the others push a 0 in its place.
 %macro EXC 1
 global exc%1
+exc%1:
+    push qword 0
+    push qword %1
+    jmp exc_common
+%endmacro
+
+%macro EXC_ERR 1
+global exc%1
 exc%1:
     push qword %1
     jmp exc_common
 %endmacro
 
 irq_common:
+    SWAPGS_IF_USER 16
     push rax
     push rbx
     push rcx
@@ -92,10 +130,12 @@ irq_common:
     pop rcx
     pop rbx
     pop rax
+    SWAPGS_IF_USER 16
     add rsp, 8
     iretq
 
 exc_common:
+    SWAPGS_IF_USER 24
     push rax
     push rbx
     push rcx
@@ -111,7 +151,9 @@ exc_common:
     push r13
     push r14
     push r15
-    mov rdi, [rsp + 15*8]
+    mov rdi, [rsp + 15*8]   ; vector
+    mov rsi, [rsp + 16*8]   ; error code
+    lea rdx, [rsp + 17*8]   ; CPU frame (rip, cs, rflags, rsp, ss)
     call idt_exception_handler
     pop r15
     pop r14
@@ -128,7 +170,8 @@ exc_common:
     pop rcx
     pop rbx
     pop rax
-    add rsp, 8
+    SWAPGS_IF_USER 24
+    add rsp, 16
     iretq
 
 ; CPU exceptions 0-31
@@ -140,20 +183,20 @@ EXC 4
 EXC 5
 EXC 6
 EXC 7
-EXC 8
+EXC_ERR 8
 EXC 9
-EXC 10
-EXC 11
-EXC 12
-EXC 13
-EXC 14
+EXC_ERR 10
+EXC_ERR 11
+EXC_ERR 12
+EXC_ERR 13
+EXC_ERR 14
 EXC 15
 EXC 16
-EXC 17
+EXC_ERR 17
 EXC 18
 EXC 19
 EXC 20
-EXC 21
+EXC_ERR 21
 EXC 22
 EXC 23
 EXC 24
@@ -161,11 +204,11 @@ EXC 25
 EXC 26
 EXC 27
 EXC 28
-EXC 29
-EXC 30
+EXC_ERR 29
+EXC_ERR 30
 EXC 31
 
-; IRQs 0-15 (PIC) — vector 32 = timer_irq, rest = irq33..irq47
+; ISA IRQs 0-15 (8259 or I/O APIC) — vector 32 = timer_irq, rest = irq33..irq47
 IRQ 33
 IRQ 34
 IRQ 35
@@ -181,3 +224,21 @@ IRQ 44
 IRQ 45
 IRQ 46
 IRQ 47
+
+; Dynamic vectors (MSI/MSI-X, irq_alloc_vector): one fixed-size stub per
+; vector from IRQ_DYN_BASE, so idt.c finds stub i at irq_dyn_stubs + 16*i.
+IRQ_DYN_BASE  equ 0x30              ; must match irq.h
+IRQ_DYN_COUNT equ 64
+global irq_dyn_stubs
+align 16
+irq_dyn_stubs:
+%assign v IRQ_DYN_BASE
+%rep IRQ_DYN_COUNT
+    align 16
+    push qword v
+    jmp irq_common
+%assign v v+1
+%endrep
+
+; Inter-processor interrupts handled through irq_common
+IRQ 241     ; IPI_TLB_SHOOTDOWN
@@ -0,0 +1,111 @@
+/**
+ * I/O APIC: redirection table programming.
+ * The registers sit behind an index/data pair (IOREGSEL, IOWIN), so every
+ * access selects and then reads or writes under the chip's lock. Entries
+ * are written high word first and low word last, and the mask bit lives in
+ * the low word, so a masked entry is never live with half its new contents.
+ */
+
+#include <kernel/ioapic.h>
+#include <kernel/acpi.h>
+#include <kernel/paging.h>
+#include <kernel/mm.h>
+#include <kernel/spinlock.h>
+#include <kernel/types.h>
+
+#define IOREGSEL      0x00
+#define IOWIN         0x10
+#define IOAPIC_VER    0x01
+#define IOAPIC_REDTBL 0x10        /* two registers per entry */
+
+struct ioapic {
+    volatile uint32_t *regs;
+    uint32_t gsi_base;
+    uint32_t count;               /* redirection entries */
+    spinlock_t lock;
+};
+
+static struct ioapic ioapics[ACPI_MAX_IOAPICS];
+static int nioapics;
+
+static uint32_t reg_read(struct ioapic *io, uint32_t reg)
+{
+    io->regs[IOREGSEL / 4] = reg;
+    return io->regs[IOWIN / 4];
+}
+
+static void reg_write(struct ioapic *io, uint32_t reg, uint32_t v)
+{
+    io->regs[IOREGSEL / 4] = reg;
+    io->regs[IOWIN / 4] = v;
+}
+
+static struct ioapic *find(uint32_t gsi, uint32_t *pin)
+{
+    for (int i = 0; i < nioapics; i++) {
+        struct ioapic *io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->count) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return NULL;
+}
+
+int ioapic_init(void)
+{
+    const struct acpi_madt_info *m = acpi_madt();
+    for (int i = 0; i < m->ioapic_count && nioapics < ACPI_MAX_IOAPICS; i++) {
+        struct ioapic *io = &ioapics[nioapics];
+        io->regs = (volatile uint32_t *)mmio_map(m->ioapics[i].addr, PAGE_SIZE, CACHE_UC);
+        if (!io->regs) continue;
+        io->gsi_base = m->ioapics[i].gsi_base;
+        io->count = ((reg_read(io, IOAPIC_VER) >> 16) & 0xFF) + 1;
+        io->lock = (spinlock_t)SPINLOCK_INIT;
+        for (uint32_t pin = 0; pin < io->count; pin++) {
+            reg_write(io, IOAPIC_REDTBL + pin * 2, IOAPIC_MASKED);
+            reg_write(io, IOAPIC_REDTBL + pin * 2 + 1, 0);
+        }
+        nioapics++;
+    }
+    return nioapics;
+}
+
+int ioapic_route(uint32_t gsi, uint8_t vector, uint32_t flags, uint32_t apic_id)
+{
+    uint32_t pin;
+    struct ioapic *io = find(gsi, &pin);
+    if (!io) return -1;
+    uint64_t f = spin_lock_irqsave(&io->lock);
+    reg_write(io, IOAPIC_REDTBL + pin * 2, IOAPIC_MASKED);
+    reg_write(io, IOAPIC_REDTBL + pin * 2 + 1, apic_id << 24);
+    reg_write(io, IOAPIC_REDTBL + pin * 2, vector | flags);
+    spin_unlock_irqrestore(&io->lock, f);
+    return 0;
+}
+
+int ioapic_set_masked(uint32_t gsi, bool masked)
+{
+    uint32_t pin;
+    struct ioapic *io = find(gsi, &pin);
+    if (!io) return -1;
+    uint64_t f = spin_lock_irqsave(&io->lock);
+    uint32_t lo = reg_read(io, IOAPIC_REDTBL + pin * 2);
+    lo = masked ? lo | IOAPIC_MASKED : lo & ~IOAPIC_MASKED;
+    reg_write(io, IOAPIC_REDTBL + pin * 2, lo);
+    spin_unlock_irqrestore(&io->lock, f);
+    return 0;
+}
+
+/* The destination is the high word alone, so one write retargets the pin;
+ * an interrupt already in flight is still delivered to the old CPU. */
+int ioapic_set_dest(uint32_t gsi, uint32_t apic_id)
+{
+    uint32_t pin;
+    struct ioapic *io = find(gsi, &pin);
+    if (!io) return -1;
+    uint64_t f = spin_lock_irqsave(&io->lock);
+    reg_write(io, IOAPIC_REDTBL + pin * 2 + 1, apic_id << 24);
+    spin_unlock_irqrestore(&io->lock, f);
+    return 0;
+}
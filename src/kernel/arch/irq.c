@@ -1,15 +1,50 @@
 /**
- * PIC (8259) initialization and EOI.
- * Remap IRQs to 32-47 so they don't overlap CPU exception vectors.
+ * ISA interrupt routing: 8259 PIC at boot, I/O APIC once the MADT is known.
+ * irq_init remaps the PICs to vectors 32-47 so they don't overlap CPU
+ * exceptions. irq_route_apic, after smp_init, masks both PICs and programs
+ * the I/O APIC to deliver each ISA IRQ to the same vector, following the
+ * MADT interrupt source overrides (IRQ0 is usually wired to GSI 2); from
+ * then on EOIs go to the local APIC, a single MMIO write instead of one or
+ * two port writes, and each IRQ can be sent to any online CPU.
+ * Vectors IRQ_DYN_BASE.. are allocated at run time to MSI/MSI-X sources,
+ * which bypass both controllers and message the local APIC directly.
  */
 
 #include <kernel/irq.h>
+#include <kernel/ioapic.h>
+#include <kernel/lapic.h>
+#include <kernel/acpi.h>
+#include <kernel/smp.h>
 #include <kernel/port.h>
+#include <kernel/spinlock.h>
 
 #define ICW1_ICW4   0x01
 #define ICW1_INIT   0x10
 #define ICW4_8086   0x01
 
+#define ISO_POLARITY_MASK  0x3     /* MPS INTI flags */
+#define ISO_POLARITY_LOW   0x3
+#define ISO_TRIGGER_MASK   0xC
+#define ISO_TRIGGER_LEVEL  0xC
+
+struct isa_route {
+    int gsi;                      /* -1: not wired (e.g. the cascade) */
+    uint32_t flags;               /* IOAPIC_POLARITY_LOW, IOAPIC_TRIGGER_LEVEL */
+    int cpu;                      /* destination, index into cpus[] */
+};
+
+static struct isa_route routes[ISA_IRQS];
+static uint16_t irq_masked = 0xFFFC;  /* IRQ0 (timer) and IRQ1 (keyboard) open */
+static bool apic_mode;
+
+struct dyn_vector {
+    irq_handler_fn fn;            /* NULL: free */
+    void *arg;
+};
+
+static struct dyn_vector dyn[IRQ_DYN_COUNT];
+static spinlock_t dyn_lock = SPINLOCK_INIT;
+
 void irq_init(void)
 {
     outb(PIC1_CMD, ICW1_INIT | ICW1_ICW4);
@@ -28,28 +63,143 @@ void irq_init(void)
     io_wait();
     outb(PIC2_DATA, ICW4_8086);
     io_wait();
-    /* Unmask IRQ0 (timer) and IRQ1 (keyboard); mask the rest */
-    outb(PIC1_DATA, 0xFC);
+    outb(PIC1_DATA, (uint8_t)irq_masked);
+    outb(PIC2_DATA, (uint8_t)(irq_masked >> 8));
+}
+
+static void find_routes(void)
+{
+    const struct acpi_madt_info *m = acpi_madt();
+    uint16_t overridden = 0;
+    for (int irq = 0; irq < ISA_IRQS; irq++) {
+        routes[irq].gsi = irq;    /* ISA default: identity, edge, active high */
+        routes[irq].flags = 0;
+        routes[irq].cpu = 0;
+    }
+    for (int i = 0; i < m->iso_count; i++) {
+        const struct acpi_iso *iso = &m->isos[i];
+        if (iso->source >= ISA_IRQS) continue;
+        struct isa_route *r = &routes[iso->source];
+        r->gsi = (int)iso->gsi;
+        if ((iso->flags & ISO_POLARITY_MASK) == ISO_POLARITY_LOW) r->flags |= IOAPIC_POLARITY_LOW;
+        if ((iso->flags & ISO_TRIGGER_MASK) == ISO_TRIGGER_LEVEL) r->flags |= IOAPIC_TRIGGER_LEVEL;
+        overridden |= (uint16_t)(1u << iso->source);
+    }
+    /* An IRQ whose identity line another IRQ took over is not wired. */
+    for (int i = 0; i < m->iso_count; i++) {
+        const struct acpi_iso *iso = &m->isos[i];
+        if (iso->source < ISA_IRQS && iso->gsi < ISA_IRQS && iso->gsi != iso->source &&
+            !(overridden & (1u << iso->gsi)))
+            routes[iso->gsi].gsi = -1;
+    }
+    routes[2].gsi = -1;           /* the cascade never fires on its own */
+}
+
+void irq_route_apic(void)
+{
+    if (!lapic_present() || ioapic_init() == 0) return;
+    find_routes();
+    uint64_t flags = irq_save();
+    for (int irq = 0; irq < ISA_IRQS; irq++) {
+        struct isa_route *r = &routes[irq];
+        if (r->gsi < 0) continue;
+        uint32_t f = r->flags | ((irq_masked >> irq) & 1 ? IOAPIC_MASKED : 0);
+        if (ioapic_route((uint32_t)r->gsi, (uint8_t)(IRQ_BASE + irq), f, cpus[0].apic_id) != 0)
+            r->gsi = -1;
+    }
+    outb(PIC1_DATA, 0xFF);
     outb(PIC2_DATA, 0xFF);
+    apic_mode = true;
+    irq_restore(flags);
+}
+
+bool irq_apic_mode(void)
+{
+    return apic_mode;
+}
+
+static void set_masked(uint8_t irq, bool on)
+{
+    uint64_t flags = irq_save();
+    irq_masked = on ? irq_masked | (uint16_t)(1u << irq) : irq_masked & (uint16_t)~(1u << irq);
+    if (apic_mode) {
+        if (routes[irq].gsi >= 0) ioapic_set_masked((uint32_t)routes[irq].gsi, on);
+    } else if (irq < 8) {
+        outb(PIC1_DATA, (uint8_t)irq_masked);
+    } else {
+        outb(PIC2_DATA, (uint8_t)(irq_masked >> 8));
+    }
+    irq_restore(flags);
 }
 
 void irq_mask_set(uint8_t irq)
 {
-    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
-    uint8_t mask = inb(port) | (1 << (irq & 7));
-    outb(port, mask);
+    if (irq < ISA_IRQS) set_masked(irq, true);
 }
 
 void irq_mask_clear(uint8_t irq)
 {
-    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
-    uint8_t mask = inb(port) & ~(1 << (irq & 7));
-    outb(port, mask);
+    if (irq < ISA_IRQS) set_masked(irq, false);
 }
 
 void irq_eoi(uint8_t irq)
 {
+    if (apic_mode) {
+        lapic_eoi();
+        return;
+    }
     if (irq >= 8)
         outb(PIC2_CMD, PIC_EOI);
     outb(PIC1_CMD, PIC_EOI);
 }
+
+int irq_set_affinity(uint8_t irq, int cpu)
+{
+    /* IRQ0 drives the PIT tick, the clock page's single writer (timer.c). */
+    if (!apic_mode || irq == 0 || irq >= ISA_IRQS || routes[irq].gsi < 0) return -1;
+    struct cpu *c = smp_cpu(cpu);
+    if (!c) return -1;
+    if (ioapic_set_dest((uint32_t)routes[irq].gsi, c->apic_id) != 0) return -1;
+    routes[irq].cpu = cpu;
+    return 0;
+}
+
+bool irq_get_route(uint8_t irq, struct irq_route *out)
+{
+    if (irq >= ISA_IRQS) return false;
+    out->gsi = apic_mode ? routes[irq].gsi : (irq == 2 ? -1 : irq);
+    out->cpu = apic_mode ? routes[irq].cpu : 0;
+    out->masked = (irq_masked >> irq) & 1;
+    out->level = apic_mode && (routes[irq].flags & IOAPIC_TRIGGER_LEVEL);
+    out->active_low = apic_mode && (routes[irq].flags & IOAPIC_POLARITY_LOW);
+    return true;
+}
+
+int irq_alloc_vector(irq_handler_fn fn, void *arg)
+{
+    int vector = -1;
+    uint64_t flags = spin_lock_irqsave(&dyn_lock);
+    for (int i = 0; i < IRQ_DYN_COUNT; i++) {
+        if (dyn[i].fn) continue;
+        dyn[i].arg = arg;
+        __atomic_store_n(&dyn[i].fn, fn, __ATOMIC_RELEASE);
+        vector = IRQ_DYN_BASE + i;
+        break;
+    }
+    spin_unlock_irqrestore(&dyn_lock, flags);
+    return vector;
+}
+
+/* The source must already be disabled: a late interrupt finds no handler. */
+void irq_free_vector(int vector)
+{
+    if (vector < IRQ_DYN_BASE || vector >= IRQ_DYN_BASE + IRQ_DYN_COUNT) return;
+    __atomic_store_n(&dyn[vector - IRQ_DYN_BASE].fn, NULL, __ATOMIC_RELEASE);
+}
+
+void irq_dispatch(uint8_t vector)
+{
+    struct dyn_vector *d = &dyn[vector - IRQ_DYN_BASE];
+    irq_handler_fn fn = __atomic_load_n(&d->fn, __ATOMIC_ACQUIRE);
+    if (fn) fn(d->arg);
+}
@@ -0,0 +1,151 @@
+/**
+ * Local APIC: enable, EOI, inter-processor interrupts and the timer.
+ * The register page is mapped uncached through mmio_map once; every CPU sees
+ * its own APIC at the same address.
+ */
+
+#include <kernel/lapic.h>
+#include <kernel/paging.h>
+#include <kernel/mm.h>
+#include <kernel/irq.h>
+#include <kernel/cpu.h>
+#include <kernel/timer.h>
+#include <kernel/types.h>
+
+#define MSR_APIC_BASE      0x1B
+#define MSR_TSC_DEADLINE   0x6E0
+#define CPUID_TSC_DEADLINE (1u << 24)   /* leaf 1 ECX */
+#define APIC_BASE_ENABLE   (1UL << 11)
+
+#define LAPIC_ID      0x020
+#define LAPIC_TPR     0x080
+#define LAPIC_EOI     0x0B0
+#define LAPIC_SVR     0x0F0
+#define LAPIC_ICR_LO  0x300
+#define LAPIC_ICR_HI  0x310
+#define LAPIC_LVT_TIMER    0x320
+#define LAPIC_TIMER_INIT   0x380
+#define LAPIC_TIMER_CUR    0x390
+#define LAPIC_TIMER_DIV    0x3E0
+
+#define SVR_ENABLE         (1u << 8)
+#define ICR_INIT           (5u << 8)
+#define ICR_STARTUP        (6u << 8)
+#define ICR_PENDING        (1u << 12)
+#define ICR_ASSERT         (1u << 14)
+#define ICR_LEVEL          (1u << 15)
+#define ICR_ALL_BUT_SELF   (3u << 18)
+#define LVT_MASKED         (1u << 16)
+#define LVT_TSC_DEADLINE   (2u << 17)
+#define TIMER_DIV_16       0x3
+#define CALIBRATE_US       10000
+
+static volatile uint32_t *lapic;
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t v)
+{
+    lapic[reg / 4] = v;
+}
+
+static void icr_wait(void)
+{
+    while (lapic_read(LAPIC_ICR_LO) & ICR_PENDING) cpu_relax();
+}
+
+void lapic_init(uint64_t phys)
+{
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+    if (!lapic) {
+        if (!phys) phys = base & PTE_ADDR_MASK;
+        lapic = (volatile uint32_t *)mmio_map(phys, PAGE_SIZE, CACHE_UC);
+        if (!lapic) return;
+    }
+    wrmsr(MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+bool lapic_present(void)
+{
+    return lapic != NULL;
+}
+
+uint32_t lapic_id(void)
+{
+    return lapic ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+void lapic_eoi(void)
+{
+    if (lapic) lapic_write(LAPIC_EOI, 0);
+}
+
+uint32_t lapic_timer_calibrate(void)
+{
+    if (!lapic) return 0;
+    lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    timer_udelay(CALIBRATE_US);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    return elapsed / (CALIBRATE_US / 1000);
+}
+
+bool lapic_timer_has_tsc_deadline(void)
+{
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    return lapic && (c & CPUID_TSC_DEADLINE);
+}
+
+void lapic_timer_oneshot(uint32_t count)
+{
+    lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+void lapic_timer_deadline(uint64_t tsc)
+{
+    lapic_write(LAPIC_LVT_TIMER, LVT_TSC_DEADLINE | LAPIC_TIMER_VECTOR);
+    __asm__ volatile ("mfence" : : : "memory");   /* LVT write before the MSR (SDM 10.5.4.1) */
+    wrmsr(MSR_TSC_DEADLINE, tsc);
+}
+
+/* ICR is two registers; keep an interrupt handler's IPI from splitting them. */
+static void send_icr(uint32_t apic_id, uint32_t lo)
+{
+    uint64_t flags = irq_save();
+    icr_wait();
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, lo);
+    icr_wait();
+    irq_restore(flags);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+    if (lapic) send_icr(apic_id, ICR_ASSERT | vector);
+}
+
+void lapic_send_ipi_others(uint8_t vector)
+{
+    if (lapic) send_icr(0, ICR_ALL_BUT_SELF | ICR_ASSERT | vector);
+}
+
+void lapic_send_init(uint32_t apic_id)
+{
+    send_icr(apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    send_icr(apic_id, ICR_INIT | ICR_LEVEL);
+}
+
+void lapic_send_sipi(uint32_t apic_id, uint8_t page)
+{
+    send_icr(apic_id, ICR_STARTUP | page);
+}
@@ -0,0 +1,172 @@
+/**
+ * Symmetric multiprocessing: per-CPU data and application processor start-up.
+ * CPUs come from the ACPI MADT. Each AP is started with INIT-SIPI-SIPI into
+ * ap_trampoline.asm (copied below 1 MiB), reaches long mode on the kernel page
+ * tables and runs smp_ap_main: own GDT/TSS, shared IDT, PAT, FPU, local APIC,
+ * and its boot context becomes that CPU's idle process.
+ */
+
+#include <kernel/smp.h>
+#include <kernel/acpi.h>
+#include <kernel/lapic.h>
+#include <kernel/idt.h>
+#include <kernel/gdt.h>
+#include <kernel/mm.h>
+#include <kernel/paging.h>
+#include <kernel/process.h>
+#include <kernel/timer.h>
+#include <kernel/fpu.h>
+#include <kernel/syscall.h>
+#include <kernel/cpu.h>
+#include <kernel/types.h>
+
+#define MSR_GS_BASE          0xC0000101
+#define AP_TRAMPOLINE_BASE   0x8000      /* must match ap_trampoline.asm */
+#define AP_BOOT_STACK_ORDER  2           /* 16 KiB; becomes the idle stack */
+#define AP_START_TIMEOUT_US  100000
+
+extern uint8_t ap_trampoline_start[], ap_trampoline_end[];
+extern uint8_t ap_tramp_cr3[], ap_tramp_stack[], ap_tramp_cpu[], ap_tramp_entry[];
+
+struct cpu cpus[MAX_CPUS];
+static int ncpus = 1;
+
+static uint64_t *tramp_var(uint8_t *sym)
+{
+    return (uint64_t *)phys_to_virt(AP_TRAMPOLINE_BASE + (uint64_t)(sym - ap_trampoline_start));
+}
+
+static void cpu_setup(struct cpu *c)
+{
+    c->self = c;
+    wrmsr(MSR_GS_BASE, (uint64_t)c);
+    gdt_init(&c->gdt);
+    syscall_init_cpu();
+}
+
+void smp_init_bsp(void)
+{
+    struct cpu *c = &cpus[0];
+    c->index = 0;
+    cpu_setup(c);
+    fpu_init();
+    c->online = true;
+}
+
+static void smp_ap_main(struct cpu *c)
+{
+    cpu_setup(c);
+    idt_load();
+    paging_init_cpu();
+    fpu_init_cpu();
+    lapic_init(0);
+    process_adopt_idle();
+    __atomic_store_n(&c->online, true, __ATOMIC_RELEASE);
+    __asm__ volatile ("sti");
+    for (;;) __asm__ volatile ("hlt");
+}
+
+static bool wait_online(struct cpu *c, uint32_t us)
+{
+    for (uint32_t t = 0; t < us; t += 100) {
+        if (__atomic_load_n(&c->online, __ATOMIC_ACQUIRE)) return true;
+        timer_udelay(100);
+    }
+    return c->online;
+}
+
+static bool start_ap(struct cpu *c)
+{
+    uint8_t *stack = (uint8_t *)page_alloc(AP_BOOT_STACK_ORDER);
+    if (!stack) return false;
+    *tramp_var(ap_tramp_stack) = (uint64_t)(stack + ((size_t)PAGE_SIZE << AP_BOOT_STACK_ORDER));
+    *tramp_var(ap_tramp_cpu) = (uint64_t)c;
+
+    lapic_send_init(c->apic_id);
+    timer_udelay(10000);
+    for (int i = 0; i < 2; i++) {
+        lapic_send_sipi(c->apic_id, AP_TRAMPOLINE_BASE >> 12);
+        if (wait_online(c, i == 0 ? 200 : AP_START_TIMEOUT_US)) return true;
+    }
+    /* It may still answer the last SIPI late, or be part way in. INIT parks
+     * it in wait-for-SIPI wherever it is, so neither the stack nor c (reused
+     * for the next AP) is touched again. */
+    lapic_send_init(c->apic_id);
+    timer_udelay(10000);
+    page_free(stack);
+    uint8_t *b = (uint8_t *)c;
+    for (size_t i = 0; i < sizeof(*c); i++) b[i] = 0;
+    return false;
+}
+
+void smp_init(void)
+{
+    if (acpi_init() != 0) return;
+    const struct acpi_madt_info *m = acpi_madt();
+    if (m->cpu_count == 0) return;
+    lapic_init(m->lapic_addr);
+    if (!lapic_present()) return;
+    cpus[0].apic_id = lapic_id();
+
+    const uint8_t *src = ap_trampoline_start;
+    uint8_t *dst = (uint8_t *)phys_to_virt(AP_TRAMPOLINE_BASE);
+    for (size_t i = 0; i < (size_t)(ap_trampoline_end - ap_trampoline_start); i++) dst[i] = src[i];
+    *tramp_var(ap_tramp_cr3) = read_cr3();
+    *tramp_var(ap_tramp_entry) = (uint64_t)smp_ap_main;
+
+    for (int i = 0; i < m->cpu_count && ncpus < MAX_CPUS; i++) {
+        if (m->cpu_apic_ids[i] == cpus[0].apic_id) continue;
+        struct cpu *c = &cpus[ncpus];
+        c->index = (uint32_t)ncpus;
+        c->apic_id = m->cpu_apic_ids[i];
+        if (start_ap(c))
+            __atomic_store_n(&ncpus, ncpus + 1, __ATOMIC_RELEASE);
+    }
+}
+
+int smp_cpu_count(void)
+{
+    return __atomic_load_n(&ncpus, __ATOMIC_ACQUIRE);
+}
+
+struct cpu *smp_cpu(int index)
+{
+    return index >= 0 && index < smp_cpu_count() ? &cpus[index] : NULL;
+}
+
+void smp_send_ipi_others(uint8_t vector)
+{
+    struct cpu *self = this_cpu();
+    for (int i = 0; i < smp_cpu_count(); i++)
+        if (&cpus[i] != self) lapic_send_ipi(cpus[i].apic_id, vector);
+}
+
+void smp_tlb_flush_ipi(void)
+{
+    struct cpu *c = this_cpu();
+    if (__atomic_load_n(&c->tlb_flush_pending, __ATOMIC_ACQUIRE)) {
+        write_cr3(read_cr3());
+        __atomic_store_n(&c->tlb_flush_pending, false, __ATOMIC_RELEASE);
+    }
+}
+
+void smp_tlb_shootdown(void)
+{
+    int n = smp_cpu_count();
+    if (n < 2) return;
+    struct cpu *self = this_cpu();
+    for (int i = 0; i < n; i++) {
+        if (&cpus[i] == self) continue;
+        __atomic_store_n(&cpus[i].tlb_flush_pending, true, __ATOMIC_RELEASE);
+        lapic_send_ipi(cpus[i].apic_id, IPI_TLB_SHOOTDOWN);
+    }
+    /* Keep serving our own flush requests so two CPUs shooting at each other
+     * with interrupts off cannot deadlock. */
+    for (int i = 0; i < n; i++) {
+        if (&cpus[i] == self) continue;
+        while (__atomic_load_n(&cpus[i].tlb_flush_pending, __ATOMIC_ACQUIRE)) {
+            smp_tlb_flush_ipi();
+            cpu_relax();
+        }
+    }
+}
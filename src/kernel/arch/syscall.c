@@ -0,0 +1,38 @@
+/**
+ * SYSCALL/SYSRET set-up. SYSCALL loads CS and SS from STAR[47:32] (kernel
+ * code, kernel data = code + 8) and SYSRET from STAR[63:48] (user data =
+ * base + 8, 64-bit user code = base + 16), which fixes the GDT layout in
+ * gdt.h. SFMASK clears IF on entry, so syscall_entry can swapgs and switch
+ * stacks before anything can interrupt it.
+ */
+
+#include <kernel/syscall.h>
+#include <kernel/smp.h>
+#include <kernel/gdt.h>
+#include <kernel/cpu.h>
+#include <kernel/types.h>
+
+#define MSR_EFER    0xC0000080
+#define MSR_STAR    0xC0000081
+#define MSR_LSTAR   0xC0000082
+#define MSR_SFMASK  0xC0000084
+#define EFER_SCE    (1UL << 0)
+
+#define RFLAGS_TF   (1UL << 8)
+#define RFLAGS_IF   (1UL << 9)
+#define RFLAGS_DF   (1UL << 10)
+#define RFLAGS_AC   (1UL << 18)
+
+extern void syscall_entry(void);
+
+/* syscall_entry.asm hard-codes these. */
+_Static_assert(__builtin_offsetof(struct cpu, syscall_rsp) == 8, "CPU_SYSCALL_RSP");
+_Static_assert(__builtin_offsetof(struct cpu, user_rsp) == 16, "CPU_USER_RSP");
+
+void syscall_init_cpu(void)
+{
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+    wrmsr(MSR_STAR, ((uint64_t)(GDT_USER_CODE32 | 3) << 48) | ((uint64_t)GDT_KERNEL_CODE << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)(uintptr_t)syscall_entry);
+    wrmsr(MSR_SFMASK, RFLAGS_TF | RFLAGS_IF | RFLAGS_DF | RFLAGS_AC);
+}
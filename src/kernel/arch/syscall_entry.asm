@@ -0,0 +1,51 @@
+; SYSCALL entry (LSTAR). The CPU has put the return rip in rcx and rflags
+; in r11, loaded the kernel CS/SS from STAR and cleared IF (SFMASK), but
+; rsp is still the user stack. Switch to the process's kernel stack (the
+; scheduler keeps its top at %gs:8), save what SYSRET needs and the
+; argument registers, and call syscall_table[rax] with interrupts on. No
+; interrupt frame is built: that is what makes this cheaper than int.
+
+%define CPU_SYSCALL_RSP  8      ; struct cpu (smp.h)
+%define CPU_USER_RSP     16
+%define SYS_COUNT        12     ; syscall.h
+%define ENOSYS           38
+
+extern syscall_table
+
+global syscall_entry
+syscall_entry:
+    swapgs
+    mov [gs:CPU_USER_RSP], rsp
+    mov rsp, [gs:CPU_SYSCALL_RSP]
+    push qword [gs:CPU_USER_RSP]
+    push r11                ; user rflags
+    push rcx                ; user rip
+    push rdi
+    push rsi
+    push rdx
+    push r10
+    push r8
+    push r9
+    sub rsp, 8              ; 16-byte alignment for the call
+    sti
+    cmp rax, SYS_COUNT
+    jae .enosys
+    mov rcx, r10            ; 4th argument: r10 in the syscall ABI, rcx in C
+    call [syscall_table + rax*8]
+    jmp .done
+.enosys:
+    mov rax, -ENOSYS
+.done:
+    cli
+    add rsp, 8
+    pop r9
+    pop r8
+    pop r10
+    pop rdx
+    pop rsi
+    pop rdi
+    pop rcx
+    pop r11
+    pop rsp
+    swapgs
+    o64 sysret
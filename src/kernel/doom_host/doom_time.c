@@ -1,14 +1,17 @@
 #include <kernel/timer.h>
+#include <kernel/vclock.h>
+#include <kernel/wait.h>
 #include <kernel/types.h>
 
+/* Called several times a frame: read the clock page directly (TSC and a
+ * multiply), no locks and no calls. */
 uint32_t doom_time_ms_impl(void)
 {
-    return timer_get_ms();
+    return (uint32_t)(vclock_read_ns(&vclock_page.data) / 1000000);
 }
 
+/* Blocks the calling process; the CPU is free for others meanwhile. */
 void doom_time_delay_ms_impl(uint32_t ms)
 {
-    uint32_t end = timer_get_ms() + ms;
-    while (timer_get_ms() < end)
-        __asm__ volatile ("hlt");
+    sleep_ms(ms);
 }
@@ -1,9 +1,17 @@
 /**
  * ATA PIO driver - primary master, LBA28.
  * Ports: 0x1F0-0x1F7 (data, error, count, LBA low/mid/hi, drive, command).
+ * ata_lock keeps one transfer on the wire at a time, since callers (FAT,
+ * the request worker) may run on any CPU. A transfer busy-waits for
+ * milliseconds and its caller may be preempted meanwhile, so the lock
+ * sleeps rather than spins. Queued requests form a FIFO drained by one
+ * work item on the "ata" workqueue.
  */
 
 #include <kernel/ata.h>
+#include <kernel/workqueue.h>
+#include <kernel/process.h>
+#include <kernel/spinlock.h>
 #include <kernel/port.h>
 #include <kernel/types.h>
 
@@ -24,6 +32,15 @@
 #define ATA_STATUS_DRQ 0x08
 #define ATA_STATUS_ERR 0x01
 
+struct wait_queue ata_wait = WAIT_QUEUE_INIT;
+static struct wait_queue ata_lock_wait = WAIT_QUEUE_INIT;
+static bool ata_busy;             /* ata_lock held */
+static spinlock_t req_lock = SPINLOCK_INIT;
+static struct ata_request *req_head, *req_tail;
+static struct workqueue *ata_wq;
+static void ata_worker(struct work *w);
+static struct work ata_work = WORK_INIT(ata_worker);
+
 static void wait_bsy(void)
 {
     while (inb(ATA_CMD) & ATA_STATUS_BSY)
@@ -36,7 +53,7 @@ static void wait_drq(void)
         ;
 }
 
-int ata_read_sectors(uint32_t lba, uint32_t count, void *buf)
+static int read_locked(uint32_t lba, uint32_t count, void *buf)
 {
     if (count == 0) return 0;
     wait_bsy();
@@ -58,7 +75,7 @@ int ata_read_sectors(uint32_t lba, uint32_t count, void *buf)
     return 0;
 }
 
-int ata_write_sectors(uint32_t lba, uint32_t count, const void *buf)
+static int write_locked(uint32_t lba, uint32_t count, const void *buf)
 {
     if (count == 0) return 0;
     wait_bsy();
@@ -80,3 +97,72 @@ int ata_write_sectors(uint32_t lba, uint32_t count, const void *buf)
     wait_bsy();
     return 0;
 }
+
+static void ata_lock(void)
+{
+    while (__atomic_exchange_n(&ata_busy, true, __ATOMIC_ACQUIRE))
+        wait_event(ata_lock_wait, !__atomic_load_n(&ata_busy, __ATOMIC_RELAXED));
+}
+
+static void ata_unlock(void)
+{
+    __atomic_store_n(&ata_busy, false, __ATOMIC_RELEASE);
+    wake_up_one(&ata_lock_wait);
+}
+
+int ata_read_sectors(uint32_t lba, uint32_t count, void *buf)
+{
+    ata_lock();
+    int r = read_locked(lba, count, buf);
+    ata_unlock();
+    return r;
+}
+
+int ata_write_sectors(uint32_t lba, uint32_t count, const void *buf)
+{
+    ata_lock();
+    int r = write_locked(lba, count, buf);
+    ata_unlock();
+    return r;
+}
+
+static struct ata_request *req_pop(void)
+{
+    uint64_t flags = spin_lock_irqsave(&req_lock);
+    struct ata_request *r = req_head;
+    if (r) {
+        req_head = r->next;
+        if (!req_head) req_tail = NULL;
+    }
+    spin_unlock_irqrestore(&req_lock, flags);
+    return r;
+}
+
+static void ata_worker(struct work *w)
+{
+    (void)w;
+    struct ata_request *r;
+    while ((r = req_pop()) != NULL) {
+        int status = r->write ? ata_write_sectors(r->lba, r->count, r->buf)
+                              : ata_read_sectors(r->lba, r->count, r->buf);
+        __atomic_store_n(&r->status, status, __ATOMIC_RELEASE);   /* last touch */
+        wake_up(&ata_wait);
+    }
+}
+
+void ata_init(void)
+{
+    ata_wq = workqueue_create("ata", SCHED_PRIO_HIGH);
+}
+
+void ata_submit(struct ata_request *r)
+{
+    r->status = ATA_REQ_PENDING;
+    r->next = NULL;
+    uint64_t flags = spin_lock_irqsave(&req_lock);
+    if (req_tail) req_tail->next = r;
+    else req_head = r;
+    req_tail = r;
+    spin_unlock_irqrestore(&req_lock, flags);
+    queue_work(ata_wq ? ata_wq : system_wq, &ata_work);
+}
@@ -1,24 +1,40 @@
 /**
  * PS/2 keyboard driver (scancode set 1).
- * Uses a ring buffer; keyboard_irq_handler is called from IDT IRQ1.
+ * IRQ1 only reads the scancode into a small raw ring and raises
+ * SOFTIRQ_INPUT; keyboard_softirq decodes it into the scancode event and
+ * character rings and wakes anyone blocked in keyboard_getchar_wait.
+ * All three are lock-free SPSC rings (spsc_ring.h): IRQ1 is the only
+ * producer of the raw ring and the softirq its only consumer, and the
+ * softirq produces the other two (see keyboard_softirq for IRQ1 moving
+ * between CPUs). Readers are many processes, so they
+ * take read_lock to act as the single consumer.
  */
 
 #include <kernel/keyboard.h>
 #include <kernel/port.h>
 #include <kernel/irq.h>
+#include <kernel/wait.h>
+#include <kernel/softirq.h>
+#include <kernel/spinlock.h>
+#include <kernel/spsc_ring.h>
 
 #define KEYB_DATA  0x60
 #define KEYB_STATUS 0x64
 
-static char keybuf[KEYBUF_SIZE];
-static size_t keybuf_head;
-static size_t keybuf_tail;
-static bool keybuf_full;
-
+#define RAW_BUF_SIZE 32
 #define SCEV_BUF_SIZE 64
+
 struct scancode_ev { uint8_t sc; int down; };
-static struct scancode_ev scev_buf[SCEV_BUF_SIZE];
-static size_t scev_head, scev_tail, scev_count;
+
+SPSC_RING(raw_ring, uint8_t, RAW_BUF_SIZE)
+SPSC_RING(char_ring, char, KEYBUF_SIZE)
+SPSC_RING(scev_ring, struct scancode_ev, SCEV_BUF_SIZE)
+
+static struct raw_ring raw;       /* IRQ1 -> softirq */
+static struct char_ring chars;    /* softirq -> readers */
+static struct scev_ring scev;     /* softirq -> readers (games) */
+static ticketlock_t read_lock;    /* readers take turns as the consumer */
+static struct wait_queue key_wait = WAIT_QUEUE_INIT;
 
 /* US QWERTY scancode set 1 -> ASCII (make codes only; ignore break for simplicity) */
 static const char scancode_to_ascii[128] = {
@@ -34,48 +50,79 @@ static const char scancode_to_ascii[128] = {
 
 void keyboard_irq_handler(void)
 {
-    uint8_t sc = inb(KEYB_DATA);
+    raw_ring_push(&raw, inb(KEYB_DATA));   /* dropped if the softirq is behind */
+    softirq_raise(SOFTIRQ_INPUT);
+}
+
+static void decode(uint8_t sc)
+{
     int down = !(sc & 0x80);
     if (!down) sc &= 0x7F;
-    if (scev_count < SCEV_BUF_SIZE) {
-        scev_buf[scev_head].sc = sc;
-        scev_buf[scev_head].down = down;
-        scev_head = (scev_head + 1) % SCEV_BUF_SIZE;
-        scev_count++;
-    }
+    scev_ring_push(&scev, (struct scancode_ev){ sc, down });
     if (!down) return;
-    if (sc >= 128) return;
     char c = scancode_to_ascii[sc];
-    if (!c) return;
-    if (keybuf_full) return;
-    keybuf[keybuf_head] = c;
-    keybuf_head = (keybuf_head + 1) % KEYBUF_SIZE;
-    if (keybuf_head == keybuf_tail)
-        keybuf_full = true;
+    if (c) char_ring_push(&chars, c);
+}
+
+/* IRQ1 may be moved to another CPU (irq_set_affinity) while this CPU's
+ * softirq still drains, so decoding takes a flag to stay single-consumer;
+ * whoever holds it rechecks the ring after letting go. */
+void keyboard_softirq(void)
+{
+    static bool decoding;
+    uint8_t sc;
+    bool any = false;
+    do {
+        if (__atomic_exchange_n(&decoding, true, __ATOMIC_ACQUIRE)) break;
+        while (raw_ring_pop(&raw, &sc)) {
+            decode(sc);
+            any = true;
+        }
+        __atomic_store_n(&decoding, false, __ATOMIC_RELEASE);
+    } while (raw_ring_count(&raw));
+    if (any) wake_up(&key_wait);
+}
+
+char keyboard_getchar_wait(void)
+{
+    char c;
+    wait_event(key_wait, (c = keyboard_getchar()) != 0);
+    return c;
+}
+
+char keyboard_getchar_timeout(uint32_t ms)
+{
+    char c = 0;
+    wait_event_timeout(key_wait, (c = keyboard_getchar()) != 0, ms);
+    return c;
 }
 
 char keyboard_getchar(void)
 {
-    if (!keybuf_full && keybuf_head == keybuf_tail)
-        return 0;
-    char c = keybuf[keybuf_tail];
-    keybuf_tail = (keybuf_tail + 1) % KEYBUF_SIZE;
-    keybuf_full = false;
+    char c = 0;
+    if (!char_ring_count(&chars)) return 0;   /* no lock for the common miss */
+    uint64_t flags = ticket_lock_irqsave(&read_lock);
+    char_ring_pop(&chars, &c);
+    ticket_unlock_irqrestore(&read_lock, flags);
     return c;
 }
 
 int keyboard_get_scancode(uint8_t *scancode, int *down)
 {
-    if (scev_count == 0) return 0;
-    *scancode = scev_buf[scev_tail].sc;
-    *down = scev_buf[scev_tail].down;
-    scev_tail = (scev_tail + 1) % SCEV_BUF_SIZE;
-    scev_count--;
+    struct scancode_ev ev;
+    if (!scev_ring_count(&scev)) return 0;
+    uint64_t flags = ticket_lock_irqsave(&read_lock);
+    bool got = scev_ring_pop(&scev, &ev);
+    ticket_unlock_irqrestore(&read_lock, flags);
+    if (!got) return 0;
+    *scancode = ev.sc;
+    *down = ev.down;
     return 1;
 }
 
 void keyboard_clear_scancodes(void)
 {
-    scev_tail = scev_head;
-    scev_count = 0;
+    uint64_t flags = ticket_lock_irqsave(&read_lock);
+    scev_ring_drain(&scev);
+    ticket_unlock_irqrestore(&read_lock, flags);
 }
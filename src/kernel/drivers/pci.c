@@ -0,0 +1,386 @@
+/**
+ * PCI configuration space, bus enumeration, BARs and MSI/MSI-X.
+ * ECAM maps each function's 4 KiB of config space at base + (bus << 20 |
+ * slot << 15 | fn << 12); it is mapped once, uncached, from the ACPI MCFG
+ * table. Without one, the legacy port pair 0xCF8 (address) / 0xCFC (data)
+ * is used under a lock, since the two accesses must not interleave, and
+ * only the first 256 bytes are reachable. BARs are sized at scan time with
+ * decoding turned off, so the all-ones probe never claims bus addresses.
+ */
+
+#include <kernel/pci.h>
+#include <kernel/acpi.h>
+#include <kernel/paging.h>
+#include <kernel/lapic.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+#include <kernel/port.h>
+#include <kernel/types.h>
+
+#define PCI_CONFIG_ADDR  0xCF8
+#define PCI_CONFIG_DATA  0xCFC
+#define PCI_CONFIG_ENABLE (1u << 31)
+
+#define PCI_CLASS_BRIDGE     0x06
+#define PCI_SUBCLASS_P2P     0x04
+#define PCI_SECONDARY_BUS    0x19
+#define PCI_HEADER_MULTIFN   0x80
+
+#define MSI_ADDR_BASE    0xFEE00000u   /* local APIC message window */
+#define MSI_CTRL_ENABLE  (1u << 0)
+#define MSI_CTRL_MME     (7u << 4)      /* multiple message enable */
+#define MSI_CTRL_64BIT   (1u << 7)
+#define MSIX_CTRL_SIZE   0x7FF
+#define MSIX_CTRL_MASKALL (1u << 14)
+#define MSIX_CTRL_ENABLE (1u << 15)
+#define MSIX_ENTRY_MASKED (1u << 0)
+
+struct mcfg_entry {
+    uint64_t base;
+    uint16_t segment;
+    uint8_t start_bus;
+    uint8_t end_bus;
+    uint32_t reserved;
+} __attribute__((packed));
+
+struct mcfg {
+    struct acpi_sdt_header hdr;
+    uint64_t reserved;
+    struct mcfg_entry entries[];
+} __attribute__((packed));
+
+static volatile uint8_t *ecam;    /* start_bus's config space */
+static uint8_t ecam_start, ecam_end;
+static bool have_ports;
+static spinlock_t port_lock = SPINLOCK_INIT;
+
+static struct pci_dev devs[PCI_MAX_DEVS];
+static int ndevs;
+static bool scanned;
+static struct pci_driver *drivers;
+static uint32_t buses_seen[256 / 32];
+
+static volatile void *ecam_ptr(uint8_t bus, uint8_t slot, uint8_t fn, uint16_t off)
+{
+    if (!ecam || bus < ecam_start || bus > ecam_end) return NULL;
+    return ecam + ((uint64_t)(bus - ecam_start) << 20 | (uint32_t)slot << 15 | (uint32_t)fn << 12 | off);
+}
+
+static uint32_t port_addr(uint8_t bus, uint8_t slot, uint8_t fn, uint16_t off)
+{
+    return PCI_CONFIG_ENABLE | (uint32_t)bus << 16 | (uint32_t)slot << 11 | (uint32_t)fn << 8 | (off & 0xFC);
+}
+
+/* width 1, 2 or 4; off aligned to it. All ones if nothing answers. */
+static uint32_t cfg_read(uint8_t bus, uint8_t slot, uint8_t fn, uint16_t off, int width)
+{
+    volatile void *p = ecam_ptr(bus, slot, fn, off);
+    if (p) {
+        if (width == 1) return *(volatile uint8_t *)p;
+        if (width == 2) return *(volatile uint16_t *)p;
+        return *(volatile uint32_t *)p;
+    }
+    if (!have_ports || off >= 256) return 0xFFFFFFFF;
+    uint64_t flags = spin_lock_irqsave(&port_lock);
+    outl(PCI_CONFIG_ADDR, port_addr(bus, slot, fn, off));
+    uint16_t data = PCI_CONFIG_DATA + (off & 3);
+    uint32_t v = width == 1 ? inb(data) : width == 2 ? inw(data) : inl(data);
+    spin_unlock_irqrestore(&port_lock, flags);
+    return v;
+}
+
+static void cfg_write(uint8_t bus, uint8_t slot, uint8_t fn, uint16_t off, int width, uint32_t v)
+{
+    volatile void *p = ecam_ptr(bus, slot, fn, off);
+    if (p) {
+        if (width == 2) *(volatile uint16_t *)p = (uint16_t)v;
+        else *(volatile uint32_t *)p = v;
+        return;
+    }
+    if (!have_ports || off >= 256) return;
+    uint64_t flags = spin_lock_irqsave(&port_lock);
+    outl(PCI_CONFIG_ADDR, port_addr(bus, slot, fn, off));
+    if (width == 2) outw(PCI_CONFIG_DATA + (off & 2), (uint16_t)v);
+    else outl(PCI_CONFIG_DATA, v);
+    spin_unlock_irqrestore(&port_lock, flags);
+}
+
+uint8_t pci_read8(const struct pci_dev *d, uint16_t off)
+{
+    return (uint8_t)cfg_read(d->bus, d->slot, d->fn, off, 1);
+}
+
+uint16_t pci_read16(const struct pci_dev *d, uint16_t off)
+{
+    return (uint16_t)cfg_read(d->bus, d->slot, d->fn, off, 2);
+}
+
+uint32_t pci_read32(const struct pci_dev *d, uint16_t off)
+{
+    return cfg_read(d->bus, d->slot, d->fn, off, 4);
+}
+
+void pci_write16(const struct pci_dev *d, uint16_t off, uint16_t v)
+{
+    cfg_write(d->bus, d->slot, d->fn, off, 2, v);
+}
+
+void pci_write32(const struct pci_dev *d, uint16_t off, uint32_t v)
+{
+    cfg_write(d->bus, d->slot, d->fn, off, 4, v);
+}
+
+static void ecam_init(void)
+{
+    const struct mcfg *m = (const struct mcfg *)acpi_find_table("MCFG");
+    if (!m) return;
+    size_t n = (m->hdr.length - sizeof(*m)) / sizeof(struct mcfg_entry);
+    for (size_t i = 0; i < n; i++) {
+        const struct mcfg_entry *e = &m->entries[i];
+        if (e->segment != 0 || e->end_bus < e->start_bus) continue;
+        uint64_t size = (uint64_t)(e->end_bus - e->start_bus + 1) << 20;
+        ecam = (volatile uint8_t *)mmio_map(e->base + ((uint64_t)e->start_bus << 20), size, CACHE_UC);
+        if (!ecam) return;
+        ecam_start = e->start_bus;
+        ecam_end = e->end_bus;
+        return;
+    }
+}
+
+/* Configuration mechanism #1 latches the enable bit we write. */
+static bool ports_init(void)
+{
+    outl(PCI_CONFIG_ADDR, PCI_CONFIG_ENABLE);
+    return inl(PCI_CONFIG_ADDR) == PCI_CONFIG_ENABLE;
+}
+
+static void size_bars(struct pci_dev *d, int nbars)
+{
+    uint16_t cmd = pci_read16(d, PCI_COMMAND);
+    pci_write16(d, PCI_COMMAND, cmd & (uint16_t)~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+    for (int i = 0; i < nbars; i++) {
+        uint16_t off = (uint16_t)(PCI_BAR0 + i * 4);
+        uint32_t lo = pci_read32(d, off);
+        pci_write32(d, off, 0xFFFFFFFF);
+        uint32_t szlo = pci_read32(d, off);
+        pci_write32(d, off, lo);
+        struct pci_bar *b = &d->bar[i];
+        if (lo & 1) {
+            uint32_t mask = szlo & ~3u;
+            if (!mask) continue;
+            if (!(mask >> 16)) mask |= 0xFFFF0000;   /* 16-bit I/O decoder */
+            b->io = true;
+            b->addr = lo & ~3u;
+            b->size = (uint32_t)(~mask + 1);
+            continue;
+        }
+        uint64_t addr = lo & ~0xFu, probe = szlo & ~0xFu;
+        bool is64 = ((lo >> 1) & 3) == 2;
+        if (is64 && i + 1 < nbars) {
+            uint32_t hi = pci_read32(d, off + 4);
+            pci_write32(d, off + 4, 0xFFFFFFFF);
+            uint32_t szhi = pci_read32(d, off + 4);
+            pci_write32(d, off + 4, hi);
+            addr |= (uint64_t)hi << 32;
+            probe |= (uint64_t)szhi << 32;
+            i++;
+        } else if (probe) {
+            probe |= 0xFFFFFFFF00000000UL;
+        }
+        if (!probe) continue;
+        uint64_t mask = probe;
+        b->addr = addr;
+        b->size = ~mask + 1;
+        b->prefetch = (lo & 8) != 0;
+    }
+    pci_write16(d, PCI_COMMAND, cmd);
+}
+
+static void scan_bus(uint8_t bus);
+
+static void scan_fn(uint8_t bus, uint8_t slot, uint8_t fn)
+{
+    if ((uint16_t)cfg_read(bus, slot, fn, PCI_VENDOR_ID, 2) == 0xFFFF) return;
+    if (ndevs == PCI_MAX_DEVS) return;
+    struct pci_dev *d = &devs[ndevs++];
+    d->bus = bus;
+    d->slot = slot;
+    d->fn = fn;
+    d->vendor = pci_read16(d, PCI_VENDOR_ID);
+    d->device = pci_read16(d, PCI_DEVICE_ID);
+    uint32_t class = pci_read32(d, PCI_REVISION);
+    d->revision = (uint8_t)class;
+    d->prog_if = (uint8_t)(class >> 8);
+    d->subclass = (uint8_t)(class >> 16);
+    d->class = (uint8_t)(class >> 24);
+    d->irq_line = pci_read8(d, PCI_INTERRUPT_LINE);
+    d->irq_pin = pci_read8(d, PCI_INTERRUPT_PIN);
+    uint8_t type = pci_read8(d, PCI_HEADER_TYPE) & 0x7F;
+    size_bars(d, type == 0 ? 6 : type == 1 ? 2 : 0);
+    if (d->class == PCI_CLASS_BRIDGE && d->subclass == PCI_SUBCLASS_P2P)
+        scan_bus(pci_read8(d, PCI_SECONDARY_BUS));
+}
+
+static void scan_bus(uint8_t bus)
+{
+    if (buses_seen[bus / 32] & (1u << (bus % 32))) return;
+    buses_seen[bus / 32] |= 1u << (bus % 32);
+    for (uint8_t slot = 0; slot < 32; slot++) {
+        if ((uint16_t)cfg_read(bus, slot, 0, PCI_VENDOR_ID, 2) == 0xFFFF) continue;
+        scan_fn(bus, slot, 0);
+        if (cfg_read(bus, slot, 0, PCI_HEADER_TYPE, 1) & PCI_HEADER_MULTIFN)
+            for (uint8_t fn = 1; fn < 8; fn++) scan_fn(bus, slot, fn);
+    }
+}
+
+static void probe(struct pci_dev *d, struct pci_driver *drv)
+{
+    if (d->driver) return;
+    for (const struct pci_id *id = drv->ids; id->vendor; id++) {
+        if ((id->vendor == PCI_ANY_ID || id->vendor == d->vendor) &&
+            (id->device == PCI_ANY_ID || id->device == d->device)) {
+            if (drv->probe(d, id) == 0) d->driver = drv;
+            return;
+        }
+    }
+}
+
+void pci_init(void)
+{
+    ecam_init();
+    have_ports = ports_init();
+    if (!ecam && !have_ports) return;
+    /* A multi-function host bridge is several host controllers: function n
+     * owns bus n. */
+    if (cfg_read(0, 0, 0, PCI_HEADER_TYPE, 1) & PCI_HEADER_MULTIFN) {
+        for (uint8_t fn = 0; fn < 8; fn++)
+            if ((uint16_t)cfg_read(0, 0, fn, PCI_VENDOR_ID, 2) != 0xFFFF) scan_bus(fn);
+    } else {
+        scan_bus(0);
+    }
+    scanned = true;
+    for (int i = 0; i < ndevs; i++)
+        for (struct pci_driver *drv = drivers; drv; drv = drv->next) probe(&devs[i], drv);
+}
+
+bool pci_ecam(void)
+{
+    return ecam != NULL;
+}
+
+int pci_dev_count(void)
+{
+    return ndevs;
+}
+
+struct pci_dev *pci_dev_get(int i)
+{
+    return i >= 0 && i < ndevs ? &devs[i] : NULL;
+}
+
+void pci_register_driver(struct pci_driver *drv)
+{
+    drv->next = drivers;
+    drivers = drv;
+    if (scanned)
+        for (int i = 0; i < ndevs; i++) probe(&devs[i], drv);
+}
+
+void pci_enable_device(struct pci_dev *d)
+{
+    uint16_t cmd = pci_read16(d, PCI_COMMAND);
+    for (int i = 0; i < 6; i++)
+        if (d->bar[i].size) cmd |= d->bar[i].io ? PCI_COMMAND_IO : PCI_COMMAND_MEMORY;
+    pci_write16(d, PCI_COMMAND, cmd);
+}
+
+void pci_set_master(struct pci_dev *d)
+{
+    pci_write16(d, PCI_COMMAND, pci_read16(d, PCI_COMMAND) | PCI_COMMAND_MASTER);
+}
+
+void *pci_map_bar(struct pci_dev *d, int n)
+{
+    if (n < 0 || n >= 6) return NULL;
+    struct pci_bar *b = &d->bar[n];
+    if (b->io || !b->size) return NULL;
+    if (!b->virt) b->virt = mmio_map(b->addr, b->size, b->prefetch ? CACHE_WC : CACHE_UC);
+    return b->virt;
+}
+
+uint8_t pci_find_cap(const struct pci_dev *d, uint8_t id)
+{
+    if (!(pci_read16(d, PCI_STATUS) & PCI_STATUS_CAP_LIST)) return 0;
+    uint8_t off = pci_read8(d, PCI_CAP_PTR) & 0xFC;
+    for (int n = 0; off && n < 48; n++) {    /* bound a malformed list */
+        if (pci_read8(d, off) == id) return off;
+        off = pci_read8(d, off + 1) & 0xFC;
+    }
+    return 0;
+}
+
+/* Fixed delivery, edge, physical destination. */
+static bool msi_target(int cpu, uint32_t *addr)
+{
+    struct cpu *c = smp_cpu(cpu);
+    if (!c || !lapic_present()) return false;
+    *addr = MSI_ADDR_BASE | c->apic_id << 12;
+    return true;
+}
+
+static void intx_off(struct pci_dev *d)
+{
+    pci_write16(d, PCI_COMMAND, pci_read16(d, PCI_COMMAND) | PCI_COMMAND_INTX_OFF);
+}
+
+int pci_enable_msi(struct pci_dev *d, irq_handler_fn fn, void *arg, int cpu)
+{
+    uint8_t cap = pci_find_cap(d, PCI_CAP_MSI);
+    uint32_t addr;
+    if (!cap || !msi_target(cpu, &addr)) return -1;
+    int vector = irq_alloc_vector(fn, arg);
+    if (vector < 0) return -1;
+    uint16_t ctrl = pci_read16(d, cap + 2);
+    pci_write32(d, cap + 4, addr);
+    if (ctrl & MSI_CTRL_64BIT) {
+        pci_write32(d, cap + 8, 0);
+        pci_write16(d, cap + 12, (uint16_t)vector);
+    } else {
+        pci_write16(d, cap + 8, (uint16_t)vector);
+    }
+    pci_write16(d, cap + 2, (uint16_t)((ctrl & ~MSI_CTRL_MME) | MSI_CTRL_ENABLE));   /* one message */
+    intx_off(d);
+    return vector;
+}
+
+int pci_enable_msix(struct pci_dev *d, unsigned entry, irq_handler_fn fn, void *arg, int cpu)
+{
+    uint8_t cap = pci_find_cap(d, PCI_CAP_MSIX);
+    uint32_t addr;
+    if (!cap || !msi_target(cpu, &addr)) return -1;
+    uint16_t ctrl = pci_read16(d, cap + 2);
+    uint16_t size = (uint16_t)((ctrl & MSIX_CTRL_SIZE) + 1);
+    if (entry >= size) return -1;
+    if (!d->msix_table) {
+        /* The table lives in a BAR; map it on its own, uncached, even if
+         * the BAR is prefetchable. */
+        uint32_t t = pci_read32(d, cap + 4);
+        if ((t & 7) > 5) return -1;       /* BIR 6 and 7 are reserved */
+        struct pci_bar *b = &d->bar[t & 7];
+        if (b->io || !b->size) return -1;
+        d->msix_table = (volatile uint32_t *)mmio_map(b->addr + (t & ~7u), (size_t)size * 16, CACHE_UC);
+        if (!d->msix_table) return -1;
+        pci_enable_device(d);
+    }
+    int vector = irq_alloc_vector(fn, arg);
+    if (vector < 0) return -1;
+    volatile uint32_t *e = d->msix_table + entry * 4;
+    e[3] |= MSIX_ENTRY_MASKED;
+    e[0] = addr;
+    e[1] = 0;
+    e[2] = (uint32_t)vector;
+    e[3] &= ~MSIX_ENTRY_MASKED;
+    pci_write16(d, cap + 2, (uint16_t)((ctrl & ~MSIX_CTRL_MASKALL) | MSIX_CTRL_ENABLE));
+    intx_off(d);
+    return vector;
+}
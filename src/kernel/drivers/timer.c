@@ -1,21 +1,85 @@
 /**
- * PIT (8253/8254) timer - channel 0, periodic interrupt.
+ * System timer.
+ * Time since boot comes from the TSC, calibrated against PIT channel 2 in
+ * timer_init and converted to nanoseconds with a 32.32 fixed-point
+ * multiply. Interrupts come from each CPU's local APIC timer in one-shot
+ * (or TSC-deadline) mode, armed by timer_arm for the earliest deadline the
+ * CPU has; an idle CPU with nothing pending gets no timer interrupts at all.
+ * Without a local APIC the PIT channel 0 periodic tick is used instead.
  * Frequency = 1193182 / divisor; e.g. 11932 -> ~100 Hz.
+ * Channel 2 (speaker gate, no IRQ) is used one-shot for timer_udelay.
+ * The clock itself is read through the vclock page (vclock.h), which the
+ * kernel and every user address space share, so the kernel and ring 3 read
+ * it the same way and neither needs a system call.
  */
 
 #include <kernel/timer.h>
 #include <kernel/port.h>
+#include <kernel/irq.h>
+#include <kernel/lapic.h>
+#include <kernel/smp.h>
+#include <kernel/cpu.h>
+#include <kernel/vclock.h>
 
 #define PIT_CH0    0x40
+#define PIT_CH2    0x42
 #define PIT_CMD    0x43
 #define PIT_SQUARE 0x36
+#define PIT_CH2_ONESHOT 0xB0   /* channel 2, lo/hi byte, mode 0 */
 #define PIT_HZ     1193182
+#define PORT_B     0x61        /* bit 0 = ch2 gate, bit 1 = speaker, bit 5 = ch2 out */
+#define TSC_CALIBRATE_US 50000  /* one full PIT channel 2 count */
+#define CPUID_INVARIANT_TSC (1u << 8)   /* leaf 0x80000007 EDX */
 
-static volatile uint32_t timer_ms;
+static uint32_t timer_ms;             /* PIT fallback ticks; BSP only, published via vclock */
+static uint32_t tick_ms;
+static uint64_t tsc_base;
+static uint64_t tsc_per_ms;
+static uint64_t tsc_ns_mult;          /* ns per TSC tick, 32.32 fixed point */
+static bool tsc_invariant;
+static uint32_t lapic_per_ms;
+static bool tsc_deadline;
+
+/* Single writer (the BSP: calibration, PIT ticks), so a bare seqcount. */
+union vclock_page vclock_page __attribute__((aligned(PAGE_SIZE)));
+
+static void calibrate_tsc(void)
+{
+    uint32_t a, b, c, d;
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    if (a >= 0x80000007) {
+        cpuid(0x80000007, 0, &a, &b, &c, &d);
+        tsc_invariant = (d & CPUID_INVARIANT_TSC) != 0;
+    }
+    uint64_t start = rdtsc();
+    timer_udelay(TSC_CALIBRATE_US);
+    uint64_t ticks = rdtsc() - start;
+    uint64_t per_ms = ticks / (TSC_CALIBRATE_US / 1000);
+    if (!per_ms) return;
+    tsc_ns_mult = ((uint64_t)TSC_CALIBRATE_US * 1000 << 32) / ticks;
+    tsc_base = start;
+    tsc_per_ms = per_ms;
+    struct vclock_data *v = &vclock_page.data;
+    write_seqcount_begin(&v->seq);
+    v->tsc_base = tsc_base;
+    v->tsc_ns_mult = tsc_ns_mult;
+    v->tsc_khz = (uint32_t)per_ms;
+    v->offset_ns = 0;             /* time 0 = start of calibration */
+    v->mode = VCLOCK_TSC;
+    write_seqcount_end(&v->seq);
+}
 
 void timer_init(unsigned hz)
 {
     timer_ms = 0;
+    tick_ms = 1000 / hz;
+    calibrate_tsc();
+    lapic_per_ms = tsc_per_ms ? lapic_timer_calibrate() : 0;
+    if (lapic_per_ms) {
+        tsc_deadline = lapic_timer_has_tsc_deadline();
+        irq_mask_set(0);
+        return;
+    }
     uint32_t divisor = PIT_HZ / hz;
     if (divisor > 65535) divisor = 65535;
     outb(PIT_CMD, PIT_SQUARE);
@@ -23,12 +87,82 @@ void timer_init(unsigned hz)
     outb(PIT_CH0, (uint8_t)((divisor >> 8) & 0xFF));
 }
 
+bool timer_oneshot(void)
+{
+    return lapic_per_ms != 0;
+}
+
 void timer_tick(void)
 {
-    timer_ms += 10; /* 100 Hz -> 10 ms per tick */
+    timer_ms += tick_ms;
+    struct vclock_data *v = &vclock_page.data;
+    write_seqcount_begin(&v->seq);
+    v->offset_ns = (uint64_t)timer_ms * 1000000;
+    v->mode = VCLOCK_TICK;
+    write_seqcount_end(&v->seq);
+}
+
+uint64_t timer_get_ns(void)
+{
+    return vclock_read_ns(&vclock_page.data);
+}
+
+uint64_t timer_get_us(void)
+{
+    return timer_get_ns() / 1000;
 }
 
 uint32_t timer_get_ms(void)
 {
-    return timer_ms;
+    return (uint32_t)(timer_get_ns() / 1000000);
+}
+
+uint32_t timer_tsc_khz(void)
+{
+    return (uint32_t)tsc_per_ms;
+}
+
+bool timer_tsc_invariant(void)
+{
+    return tsc_invariant;
+}
+
+void timer_arm(uint32_t when_ms)
+{
+    if (!lapic_per_ms) return;
+    uint64_t flags = irq_save();
+    struct cpu *c = this_cpu();
+    if (!c->timer_deadline || (int32_t)(when_ms - c->timer_deadline) < 0) {
+        c->timer_deadline = when_ms;
+        if (tsc_deadline) {
+            lapic_timer_deadline(tsc_base + (uint64_t)when_ms * tsc_per_ms);
+        } else {
+            int32_t delta = (int32_t)(when_ms - timer_get_ms());
+            /* Past ~69 s the count no longer fits: fire at the limit and
+             * let the next scheduler entry re-arm for the rest. */
+            uint64_t count = delta > 0 ? (uint64_t)delta * lapic_per_ms : 1;
+            lapic_timer_oneshot(count > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)count);
+        }
+    }
+    irq_restore(flags);
+}
+
+void timer_expired(void)
+{
+    this_cpu()->timer_deadline = 0;
+}
+
+void timer_udelay(uint32_t us)
+{
+    while (us) {
+        uint32_t chunk = us > 50000 ? 50000 : us;   /* 16-bit count: < 55 ms */
+        uint32_t count = (uint32_t)((uint64_t)PIT_HZ * chunk / 1000000);
+        if (!count) count = 1;
+        outb(PORT_B, (uint8_t)((inb(PORT_B) & ~0x02) | 0x01));
+        outb(PIT_CMD, PIT_CH2_ONESHOT);
+        outb(PIT_CH2, (uint8_t)(count & 0xFF));
+        outb(PIT_CH2, (uint8_t)((count >> 8) & 0xFF));
+        while (!(inb(PORT_B) & 0x20)) ;
+        us -= chunk;
+    }
 }
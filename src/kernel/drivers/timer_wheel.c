@@ -0,0 +1,203 @@
+/**
+ * Hierarchical timer wheel, one per CPU (struct cpu.timers).
+ * Level 0 has a slot per millisecond for the next 64 ms; each level above
+ * covers 64 times the span of the one below. A timer goes into the lowest
+ * level whose span reaches its deadline, into the slot its deadline falls
+ * in, so queueing is a shift and a list insert. When the clock enters a new
+ * level-n slot, the timers in it are requeued one level down (cascade), so
+ * every timer reaches level 0 before it expires. A bitmap per level tells
+ * timer_wheel_run and timer_wheel_next where the next non-empty slot is, so
+ * a CPU that slept for seconds catches up in a few steps instead of one per
+ * millisecond. The wheel runs in the SOFTIRQ_TIMER softirq, with interrupts
+ * on between callbacks, so the lock is always taken with interrupts off.
+ */
+
+#include <kernel/timer.h>
+#include <kernel/smp.h>
+#include <kernel/irq.h>
+#include <kernel/spinlock.h>
+#include <kernel/types.h>
+
+#define WHEEL_MASK  (TIMER_WHEEL_SIZE - 1)
+#define WHEEL_SPAN  (1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+static inline uint64_t ror64(uint64_t x, uint32_t n)
+{
+    return n ? (x >> n) | (x << (64 - n)) : x;
+}
+
+/* b->lock held. Link t into the slot for t->expires relative to b->clk. */
+static void enqueue(struct timer_base *b, struct timer *t)
+{
+    uint32_t delta = t->expires - b->clk;
+    uint32_t lvl = 0, idx;
+    if ((int32_t)delta < 0) {
+        idx = b->clk & WHEEL_MASK;    /* already due: next run */
+    } else {
+        uint32_t e = t->expires;
+        if (delta >= WHEEL_SPAN) e = b->clk + WHEEL_SPAN - 1;
+        while (lvl < TIMER_WHEEL_LEVELS - 1 && (e - b->clk) >> (TIMER_WHEEL_BITS * (lvl + 1)))
+            lvl++;
+        idx = (e >> (TIMER_WHEEL_BITS * lvl)) & WHEEL_MASK;
+    }
+    struct timer **head = &b->slots[lvl][idx];
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+    t->base = b;
+    t->slot = lvl * TIMER_WHEEL_SIZE + idx;
+    b->bitmap[lvl] |= 1ull << idx;
+}
+
+/* b->lock held, t pending on b. */
+static void detach(struct timer_base *b, struct timer *t)
+{
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+    uint32_t lvl = t->slot / TIMER_WHEEL_SIZE, idx = t->slot & WHEEL_MASK;
+    if (!b->slots[lvl][idx]) b->bitmap[lvl] &= ~(1ull << idx);
+    b->pending--;
+}
+
+/* b->clk is at a level-0 slot boundary: requeue the level-1 slot it enters,
+ * and the level-2 slot if that was slot 0 too, and so on. */
+static void cascade(struct timer_base *b)
+{
+    for (uint32_t lvl = 1; lvl < TIMER_WHEEL_LEVELS; lvl++) {
+        uint32_t idx = (b->clk >> (TIMER_WHEEL_BITS * lvl)) & WHEEL_MASK;
+        struct timer *t = b->slots[lvl][idx];
+        b->slots[lvl][idx] = NULL;
+        b->bitmap[lvl] &= ~(1ull << idx);
+        while (t) {
+            struct timer *n = t->next;
+            enqueue(b, t);
+            t = n;
+        }
+        if (idx) break;
+    }
+}
+
+/* b->lock held, b->pending non-zero. The earliest clk at which a level-0 slot
+ * fires or a higher slot cascades. */
+static uint32_t next_event(struct timer_base *b)
+{
+    uint32_t best = 0;
+    bool found = false;
+    for (uint32_t lvl = 0; lvl < TIMER_WHEEL_LEVELS; lvl++) {
+        uint64_t map = b->bitmap[lvl];
+        if (!map) continue;
+        uint32_t shift = TIMER_WHEEL_BITS * lvl;
+        uint32_t idx = (b->clk >> shift) & WHEEL_MASK;
+        uint32_t at;
+        if (lvl == 0) {
+            at = b->clk + (uint32_t)__builtin_ctzll(ror64(map, idx));
+        } else {
+            /* Once clk is past the start of the current slot, that slot has
+             * been cascaded and what is there now belongs to its next turn. */
+            uint32_t skip = (b->clk & ((1u << shift) - 1)) ? 1 : 0;
+            uint32_t d = (uint32_t)__builtin_ctzll(ror64(map, (idx + skip) & WHEEL_MASK)) + skip;
+            at = ((b->clk >> shift) + d) << shift;
+        }
+        if (!found || (int32_t)(at - best) < 0) best = at;
+        found = true;
+    }
+    return best;
+}
+
+void timer_add(struct timer *t, uint32_t deadline_ms, void (*fn)(void *arg), void *arg)
+{
+    uint64_t flags = irq_save();
+    timer_cancel(t);
+    struct timer_base *b = &this_cpu()->timers;
+    spin_lock(&b->lock);
+    if (!b->pending) b->clk = timer_get_ms();   /* an empty wheel is not advanced */
+    t->expires = deadline_ms;
+    t->fn = fn;
+    t->arg = arg;
+    enqueue(b, t);
+    b->pending++;
+    spin_unlock(&b->lock);
+    timer_arm(deadline_ms);
+    irq_restore(flags);
+}
+
+bool timer_cancel(struct timer *t)
+{
+    uint64_t flags = irq_save();
+    struct timer_base *b;
+    bool pending = false;
+    while ((b = __atomic_load_n(&t->base, __ATOMIC_ACQUIRE)) != NULL) {
+        spin_lock(&b->lock);
+        bool same = t->base == b;   /* else moved meanwhile: retry */
+        if (same && (pending = t->pprev != NULL)) detach(b, t);
+        spin_unlock(&b->lock);
+        if (same) break;
+    }
+    /* On its own CPU a running callback is our caller. */
+    if (b && b != &this_cpu()->timers)
+        while (__atomic_load_n(&b->running, __ATOMIC_ACQUIRE) == t) cpu_relax();
+    irq_restore(flags);
+    return pending;
+}
+
+bool timer_pending(const struct timer *t)
+{
+    return __atomic_load_n(&t->pprev, __ATOMIC_RELAXED) != NULL;
+}
+
+void timer_wheel_run(uint32_t now)
+{
+    struct timer_base *b = &this_cpu()->timers;
+    if (!__atomic_load_n(&b->pending, __ATOMIC_RELAXED)) return;
+    uint64_t flags = spin_lock_irqsave(&b->lock);
+    while (b->pending) {
+        uint32_t at = next_event(b);
+        if ((int32_t)(at - now) > 0) break;
+        b->clk = at;
+        uint32_t idx = at & WHEEL_MASK;
+        if (!idx) cascade(b);
+        /* Callbacks run unlocked, so take the slot onto a local list first;
+         * timer_cancel can still unlink from it meanwhile. */
+        struct timer *expired = b->slots[0][idx];
+        b->slots[0][idx] = NULL;
+        b->bitmap[0] &= ~(1ull << idx);
+        if (expired) expired->pprev = &expired;
+        b->clk = at + 1;
+        while (expired) {
+            struct timer *t = expired;
+            detach(b, t);
+            void (*fn)(void *) = t->fn;
+            void *arg = t->arg;
+            b->running = t;
+            spin_unlock_irqrestore(&b->lock, flags);
+            fn(arg);
+            flags = spin_lock_irqsave(&b->lock);
+            __atomic_store_n(&b->running, NULL, __ATOMIC_RELEASE);
+        }
+    }
+    spin_unlock_irqrestore(&b->lock, flags);
+}
+
+uint32_t timer_wheel_next(void)
+{
+    struct timer_base *b = &this_cpu()->timers;
+    if (!__atomic_load_n(&b->pending, __ATOMIC_RELAXED)) return 0;
+    uint64_t flags = spin_lock_irqsave(&b->lock);
+    uint32_t at = 0;
+    if (b->pending) {
+        at = next_event(b);
+        if (!at) at = 1;          /* 0 means none */
+    }
+    spin_unlock_irqrestore(&b->lock, flags);
+    return at;
+}
+
+void timer_wheel_softirq(void)
+{
+    timer_wheel_run(timer_get_ms());
+    uint32_t next = timer_wheel_next();
+    if (next) timer_arm(next);
+}
@@ -76,12 +76,12 @@ void vga_puts(const char *s)
         vga_putchar(*s++);
 }
 
-static void vga_puthex(uint32_t n)
+void vga_puthex(uint64_t n)
 {
     const char hex[] = "0123456789ABCDEF";
     vga_putchar('0');
     vga_putchar('x');
-    for (int i = 7; i >= 0; i--)
+    for (int i = n >> 32 ? 15 : 7; i >= 0; i--)
         vga_putchar(hex[(n >> (i * 4)) & 0xF]);
 }
 
@@ -5,9 +5,12 @@
  */
 
 #include <kernel/fs.h>
+#include <kernel/paging.h>
 #include <kernel/types.h>
 
 static struct fs_node files[FS_MAX_FILES];
+/* One FS_FILE_BUF per file slot, demand-zero: pages are committed on first write. */
+static char (*file_bufs)[FS_FILE_BUF];
 static struct fs_node dirs[FS_MAX_DIRS];
 static size_t nfiles;
 static size_t ndirs;
@@ -44,6 +47,8 @@ static void normalize_path(const char *path, char *out, size_t max_len)
 
 void fs_init(void)
 {
+    if (!file_bufs)
+        file_bufs = (char (*)[FS_FILE_BUF])paging_reserve_zero((size_t)FS_MAX_FILES * FS_FILE_BUF);
     nfiles = 0;
     ndirs = 0;
     cwd = root_dir();
@@ -176,9 +181,9 @@ int fs_write(const char *path, const char *content, size_t len)
     else if (path_to_dir(parent_path, &parent) != 0) return -1;
     size_t fi = file_by_name(parent, last);
     if (fi == (size_t)-1) return -1;
-    /* In-memory: we don't have malloc yet, so use a static buffer per file (simplified) */
+    /* One fixed buffer per file slot (simplified) */
+    if (!file_bufs) return -1;
     if (len > FS_FILE_BUF) len = FS_FILE_BUF;
-    static char file_bufs[FS_MAX_FILES][FS_FILE_BUF];
     for (size_t i = 0; i < len; i++) file_bufs[fi][i] = content[i];
     files[fi].data = file_bufs[fi];
     files[fi].size = len;
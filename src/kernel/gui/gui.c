@@ -28,6 +28,7 @@ typedef enum {
 #define NOTE_BUF 4096
 #define CALC_MAX 24
 #define SNAKE_MAX 64
+#define SNAKE_STEP_MS 220
 #define GRID_W 20
 #define GRID_H 12
 #define CELL 6
@@ -97,15 +98,20 @@ static struct {
     int clk_sw_running;
     uint32_t clk_timer_deadline;
     int clk_timer_active;
+    int clk_timer_done;
+    struct timer clk_timer;
     char clk_digits[8];
     int clk_digit_len;
     uint32_t clk_alarm_at;
     int clk_alarm_armed;
+    int clk_alarm_ringing;
+    struct timer clk_alarm;
     int snake_x[SNAKE_MAX], snake_y[SNAKE_MAX];
     int snake_len;
     int snake_dir;
     int snake_fx, snake_fy;
-    uint32_t snake_next_tick;
+    int snake_due;
+    struct timer snake_timer;
     int snake_alive;
     uint8_t paint_canvas[PAINT_CW * PAINT_CH];
     uint8_t paint_color;
@@ -122,6 +128,12 @@ static struct {
 
 static uint32_t ms_rng_state = 0xC0FFEEu;
 
+/* Timer wheel callback (SOFTIRQ_TIMER, interrupts on): set the int flag arg points at. */
+static void gui_timer_flag(void *arg)
+{
+    *(volatile int *)arg = 1;
+}
+
 static void stack_push(AppId a)
 {
     if (stack_n < MAX_STACK)
@@ -266,16 +278,16 @@ static void snake_reset(void)
     G.snake_dir = 1;
     G.snake_fx = 12;
     G.snake_fy = 6;
-    G.snake_next_tick = timer_get_ms() + 220;
+    G.snake_due = 0;
+    timer_add(&G.snake_timer, timer_get_ms() + SNAKE_STEP_MS, gui_timer_flag, &G.snake_due);
     G.snake_alive = 1;
 }
 
 static void snake_tick(uint8_t *fb, int gx, int gy)
 {
-    if (!G.snake_alive) return;
-    uint32_t now = timer_get_ms();
-    if ((int32_t)(now - G.snake_next_tick) < 0) return;
-    G.snake_next_tick = now + 220;
+    if (!G.snake_alive || !G.snake_due) return;
+    G.snake_due = 0;
+    timer_add(&G.snake_timer, timer_get_ms() + SNAKE_STEP_MS, gui_timer_flag, &G.snake_due);
     int dx = 0, dy = 0;
     if (G.snake_dir == 0) { dy = -1; }
     if (G.snake_dir == 1) { dx = 1; }
@@ -733,10 +745,10 @@ static void draw_desktop(uint8_t *fb)
                 gui_draw_text(fb, wx + 8, wy + 36, G.clk_digits, GUI_C_BLACK, GUI_C_LTGRAY);
                 if (G.clk_timer_active) {
                     int32_t left = (int32_t)(G.clk_timer_deadline - now);
-                    if (left < 0) left = 0;
+                    if (left < 0 || G.clk_timer_done) left = 0;
                     fmt_uint(line, (uint32_t)(left / 1000));
                     gui_draw_text(fb, wx + 8, wy + 52, line, GUI_C_BR_RED, GUI_C_LTGRAY);
-                    if (left == 0) gui_draw_text(fb, wx + 8, wy + 66, "DONE", GUI_C_BR_RED, GUI_C_LTGRAY);
+                    if (G.clk_timer_done) gui_draw_text(fb, wx + 8, wy + 66, "DONE", GUI_C_BR_RED, GUI_C_LTGRAY);
                 }
                 gui_draw_text(fb, wx + 8, wy + 88, "0-9 type  ENT=start", GUI_C_DKGRAY, GUI_C_LTGRAY);
             } else {
@@ -744,12 +756,13 @@ static void draw_desktop(uint8_t *fb)
                 gui_draw_text(fb, wx + 8, wy + 36, G.clk_digits, GUI_C_BLACK, GUI_C_LTGRAY);
                 if (G.clk_alarm_armed) {
                     int32_t left = (int32_t)(G.clk_alarm_at - now);
-                    if (left <= 0) {
+                    if (G.clk_alarm_ringing) {
                         int flash = (int)((now / 400) % 2);
                         if (flash)
                             gui_draw_fill_rect(fb, wx + 4, wy + 50, ww - 8, 20, GUI_C_BR_RED);
                         gui_draw_text(fb, wx + 8, wy + 54, "ALARM!", GUI_C_WHITE, flash ? GUI_C_BR_RED : GUI_C_LTGRAY);
                     } else {
+                        if (left < 0) left = 0;
                         fmt_uint(line, (uint32_t)(left / 1000));
                         gui_draw_text(fb, wx + 8, wy + 54, line, GUI_C_BLACK, GUI_C_LTGRAY);
                     }
@@ -999,6 +1012,7 @@ static int handle_key(char c)
         if (c == '3') {
             G.clk_mode = 2;
             G.clk_timer_active = 0;
+            timer_cancel(&G.clk_timer);
             G.clk_digit_len = 0;
             G.clk_digits[0] = 0;
             return 0;
@@ -1006,6 +1020,7 @@ static int handle_key(char c)
         if (c == '4') {
             G.clk_mode = 3;
             G.clk_alarm_armed = 0;
+            timer_cancel(&G.clk_alarm);
             G.clk_digit_len = 0;
             G.clk_digits[0] = 0;
             return 0;
@@ -1040,6 +1055,8 @@ static int handle_key(char c)
                     sec = sec * 10 + (uint32_t)(G.clk_digits[i] - '0');
                 G.clk_timer_deadline = timer_get_ms() + sec * 1000;
                 G.clk_timer_active = 1;
+                G.clk_timer_done = 0;
+                timer_add(&G.clk_timer, G.clk_timer_deadline, gui_timer_flag, &G.clk_timer_done);
             }
             return 0;
         }
@@ -1056,6 +1073,8 @@ static int handle_key(char c)
                     sec = sec * 10 + (uint32_t)(G.clk_digits[i] - '0');
                 G.clk_alarm_at = timer_get_ms() + sec * 1000;
                 G.clk_alarm_armed = 1;
+                G.clk_alarm_ringing = 0;
+                timer_add(&G.clk_alarm, G.clk_alarm_at, gui_timer_flag, &G.clk_alarm_ringing);
             }
             return 0;
         }
@@ -1218,6 +1237,9 @@ void gui_run(void)
         char key;
         while ((key = keyboard_getchar()) != 0) {
             if (handle_key(key)) {
+                timer_cancel(&G.snake_timer);
+                timer_cancel(&G.clk_timer);
+                timer_cancel(&G.clk_alarm);
                 video_mode13_leave();
                 return;
             }
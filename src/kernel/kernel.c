@@ -8,29 +8,30 @@
 #include <kernel/multiboot.h>
 #include <kernel/vga.h>
 #include <kernel/port.h>
+#include <kernel/smp.h>
 #include <kernel/idt.h>
 #include <kernel/irq.h>
 #include <kernel/keyboard.h>
 #include <kernel/shell.h>
 #include <kernel/process.h>
+#include <kernel/workqueue.h>
 #include <kernel/timer.h>
 #include <kernel/mm.h>
+#include <kernel/paging.h>
 #include <kernel/fat.h>
+#include <kernel/ata.h>
+#include <kernel/pci.h>
 #if ENABLE_NET
 #include <kernel/net.h>
 #endif
 
 #define MULTIBOOT_FLAG_MEM   (1 << 0)
-#define HEAP_SIZE            (256 * 1024)
-
-static uint8_t heap_region[HEAP_SIZE];
 
 extern void shell_run(void);
 
 void kernel_main(uint32_t magic, uint32_t multiboot_info_phys)
 {
-    (void)magic;
-    (void)multiboot_info_phys;
+    struct multiboot_info *mb = NULL;
 
     vga_clear();
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
@@ -42,7 +43,7 @@ void kernel_main(uint32_t magic, uint32_t multiboot_info_phys)
         vga_set_color(VGA_COLOR_RED, VGA_COLOR_BLACK);
         vga_puts("Invalid multiboot magic.\n");
     } else {
-        struct multiboot_info *mb = (struct multiboot_info *)(uint64_t)multiboot_info_phys;
+        mb = (struct multiboot_info *)(uint64_t)multiboot_info_phys;
         if (mb->flags & MULTIBOOT_FLAG_MEM) {
             vga_puts("Memory: lower=");
             vga_putdec(mb->mem_lower);
@@ -52,13 +53,45 @@ void kernel_main(uint32_t magic, uint32_t multiboot_info_phys)
         }
     }
 
-    heap_init(heap_region, HEAP_SIZE);
+    page_init(mb);
+    heap_init();
+    paging_init();
+    vga_puts("Direct map: ");
+    vga_putdec((uint32_t)(paging_direct_map_end() >> 20));
+    vga_puts(paging_has_1g_pages() ? " MB (1 GiB pages)\n" : " MB (2 MiB pages)\n");
+    vga_puts("Page allocator: ");
+    vga_putdec((uint32_t)(page_free_count() * PAGE_SIZE / 1024));
+    vga_puts(" KB free\n");
     shell_init();
     irq_init();
+    smp_init_bsp();
     idt_init();
     process_init();
-    process_create(shell_run);
+    workqueue_init();
+    ata_init();
+    smp_init();
+    irq_route_apic();
+    vga_puts("CPUs online: ");
+    vga_putdec((uint32_t)smp_cpu_count());
+    vga_puts(irq_apic_mode() ? ", I/O APIC\n" : ", 8259 PIC\n");
+    pci_init();
+    vga_puts("PCI: ");
+    vga_putdec((uint32_t)pci_dev_count());
+    vga_puts(pci_ecam() ? " functions (ECAM)\n" : " functions (port I/O)\n");
+    struct process *shell = process_create(shell_run);
+    if (shell) process_set_name(shell, "shell");
     timer_init(100);
+    if (timer_tsc_khz()) {
+        vga_puts("TSC: ");
+        vga_putdec(timer_tsc_khz() / 1000);
+        vga_putchar('.');
+        uint32_t frac = timer_tsc_khz() % 1000;
+        if (frac < 100) vga_putchar('0');
+        if (frac < 10) vga_putchar('0');
+        vga_putdec(frac);
+        vga_puts(timer_tsc_invariant() ? " MHz (invariant)" : " MHz");
+        vga_puts(timer_oneshot() ? ", local APIC timer\n" : ", PIT tick\n");
+    }
     if (fat_mount() == 0)
         vga_puts("FAT or exFAT filesystem mounted.\n");
 #if ENABLE_NET
@@ -1,36 +1,181 @@
 /**
- * Minimal kernel heap: bump allocator (no free).
- * For production, replace with a free-list or similar.
+ * Kernel heap: size-class slab allocator on top of the buddy page allocator.
+ * Slabs are single pages carved into equal objects kept on a per-cache free
+ * list (O(1) alloc and free); requests above KMALLOC_MAX_SLAB get a buddy
+ * block of whole pages. kfree finds the owner through the page's struct page.
  */
 
 #include <kernel/mm.h>
+#include <kernel/memstat.h>
+#include <kernel/spinlock.h>
 #include <kernel/types.h>
 
 #define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
 
-static uint8_t *heap_start;
-static uint8_t *heap_cur;
-static uint8_t *heap_end;
+#define KMALLOC_MIN_SHIFT 4   /* 16 bytes */
+#define KMALLOC_CLASSES   8   /* 16 .. 2048 */
 
-void heap_init(void *region, size_t size)
+struct kmem_cache {
+    const char *name;
+    size_t obj_size;
+    uint32_t objs_per_slab;
+    uint32_t free_slabs;           /* empty slabs kept around (at most one) */
+    struct page *partial;          /* slabs with at least one free object */
+    spinlock_t lock;
+};
+
+static struct kmem_cache kmalloc_caches[KMALLOC_CLASSES];
+static struct kmem_cache cache_cache;   /* backs kmem_cache_create */
+static struct mem_stats heap_stats;     /* all caches plus large allocations */
+
+static void list_push(struct page **head, struct page *d)
 {
-    heap_start = (uint8_t *)region;
-    heap_cur   = heap_start;
-    heap_end   = heap_start + size;
+    d->prev = NULL;
+    d->next = *head;
+    if (*head) (*head)->prev = d;
+    *head = d;
 }
 
-void *kmalloc(size_t size)
+static void list_del(struct page **head, struct page *d)
+{
+    if (d->prev) d->prev->next = d->next;
+    else *head = d->next;
+    if (d->next) d->next->prev = d->prev;
+    d->prev = d->next = NULL;
+}
+
+static void cache_init(struct kmem_cache *c, const char *name, size_t obj_size, size_t align)
+{
+    size_t size = obj_size < sizeof(void *) ? sizeof(void *) : obj_size;
+    if (!align) {
+        /* Cache-line align; smaller objects get a power of two so none straddles a line. */
+        align = CACHE_LINE_SIZE;
+        if (size < CACHE_LINE_SIZE) {
+            align = sizeof(void *);
+            while (align < size) align <<= 1;
+        }
+    }
+    c->name = name;
+    c->obj_size = ALIGN_UP(size, align);
+    c->objs_per_slab = (uint32_t)(PAGE_SIZE / c->obj_size);
+    c->free_slabs = 0;
+    c->partial = NULL;
+    c->lock = (spinlock_t)SPINLOCK_INIT;
+}
+
+static struct page *slab_new(struct kmem_cache *c)
+{
+    uint8_t *base = (uint8_t *)page_alloc(0);
+    if (!base) return NULL;
+    struct page *d = virt_to_page(base);
+    d->flags = PG_SLAB;
+    d->cache = c;
+    d->inuse = 0;
+    d->freelist = NULL;
+    for (size_t i = c->objs_per_slab; i > 0; i--) {
+        void **obj = (void **)(base + (i - 1) * c->obj_size);
+        *obj = d->freelist;
+        d->freelist = obj;
+    }
+    list_push(&c->partial, d);
+    c->free_slabs++;
+    return d;
+}
+
+void heap_init(void)
+{
+    for (int i = 0; i < KMALLOC_CLASSES; i++)
+        cache_init(&kmalloc_caches[i], "kmalloc", (size_t)1 << (KMALLOC_MIN_SHIFT + i), 0);
+    cache_init(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0);
+    memstat_register(&heap_stats, "kmalloc", NULL, NULL);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t obj_size, size_t align)
 {
-    size = ALIGN_UP(size, 8);
-    if (heap_cur + size > heap_end)
+    if (obj_size == 0 || obj_size > PAGE_SIZE) return NULL;
+    if (align & (align - 1)) return NULL;
+    struct kmem_cache *c = (struct kmem_cache *)kmem_cache_alloc(&cache_cache);
+    if (!c) return NULL;
+    cache_init(c, name, obj_size, align);
+    if (c->objs_per_slab == 0) {
+        kmem_cache_free(&cache_cache, c);
         return NULL;
-    void *p = heap_cur;
-    heap_cur += size;
+    }
+    return c;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *c)
+{
+    uint64_t flags = spin_lock_irqsave(&c->lock);
+    struct page *d = c->partial;
+    if (!d) d = slab_new(c);
+    if (!d) {
+        memstat_fail(&heap_stats, c->obj_size);
+        spin_unlock_irqrestore(&c->lock, flags);
+        return NULL;
+    }
+    if (d->inuse == 0) c->free_slabs--;
+    void **obj = (void **)d->freelist;
+    d->freelist = *obj;
+    d->inuse++;
+    if (!d->freelist) list_del(&c->partial, d);
+    memstat_alloc(&heap_stats, obj, c->obj_size);
+    spin_unlock_irqrestore(&c->lock, flags);
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+    struct page *d = virt_to_page(obj);
+    if (!d || !(d->flags & PG_SLAB) || d->cache != c) return;
+    uint64_t flags = spin_lock_irqsave(&c->lock);
+    memstat_free(&heap_stats, obj, c->obj_size);
+    if (!d->freelist) list_push(&c->partial, d);
+    *(void **)obj = d->freelist;
+    d->freelist = obj;
+    if (--d->inuse == 0) {
+        if (c->free_slabs) {
+            list_del(&c->partial, d);
+            d->flags = 0;
+            d->cache = NULL;
+            d->freelist = NULL;
+            page_free(page_to_virt(d));
+        } else {
+            c->free_slabs++;
+        }
+    }
+    spin_unlock_irqrestore(&c->lock, flags);
+}
+
+void *kmalloc(size_t size)
+{
+    if (size == 0) return NULL;
+    if (size <= KMALLOC_MAX_SLAB) {
+        int i = 0;
+        while (((size_t)1 << (KMALLOC_MIN_SHIFT + i)) < size) i++;
+        return kmem_cache_alloc(&kmalloc_caches[i]);
+    }
+    unsigned order = 0;
+    while (order <= PAGE_MAX_ORDER && ((size_t)PAGE_SIZE << order) < size) order++;
+    void *p = page_alloc(order);
+    if (p) {
+        virt_to_page(p)->flags = PG_LARGE;
+        memstat_alloc(&heap_stats, p, (size_t)PAGE_SIZE << order);
+    } else {
+        memstat_fail(&heap_stats, size);
+    }
     return p;
 }
 
 void kfree(void *ptr)
 {
-    (void)ptr;
-    /* Bump allocator: no free */
+    struct page *d = virt_to_page(ptr);
+    if (!d) return;
+    if (d->flags & PG_SLAB) {
+        kmem_cache_free(d->cache, ptr);
+    } else if ((d->flags & PG_LARGE) && page_to_virt(d) == ptr) {
+        memstat_free(&heap_stats, ptr, (size_t)PAGE_SIZE << d->order);
+        d->flags = 0;
+        page_free(ptr);
+    }
 }
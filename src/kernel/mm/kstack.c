@@ -0,0 +1,103 @@
+/**
+ * Kernel stacks in their own virtual window (paging.h KSTACK_VIRT_BASE).
+ * Each slot is an unmapped guard page followed by KSTACK_SIZE bytes that are
+ * committed page by page on first touch, so an idle thread costs one or two
+ * frames and running off the bottom faults instead of corrupting a neighbour.
+ * Freed stacks go to a small pool with their pages still committed, so a
+ * process created after one exits gets a warm stack without faults; only
+ * stacks beyond the pool are unmapped (one TLB shootdown per stack).
+ */
+
+#include <kernel/mm.h>
+#include <kernel/paging.h>
+#include <kernel/spinlock.h>
+#include <kernel/types.h>
+
+#define KSTACK_GUARD   PAGE_SIZE
+#define KSTACK_STRIDE  (KSTACK_GUARD + KSTACK_SIZE)
+#define KSTACK_POOL    16      /* freed stacks kept mapped for reuse */
+
+static uint64_t slot_used[KSTACK_MAX / 64];
+static void *pool[KSTACK_POOL];
+static unsigned pool_count;
+static spinlock_t kstack_lock;      /* slot_used and the pool */
+
+static uint64_t slot_base(unsigned slot)
+{
+    return KSTACK_VIRT_BASE + (uint64_t)slot * KSTACK_STRIDE + KSTACK_GUARD;
+}
+
+/* Slot index for addr, or -1 if it is outside every allocated slot. */
+static int slot_of(uint64_t addr, uint64_t *offset)
+{
+    if (addr < KSTACK_VIRT_BASE || addr >= KSTACK_VIRT_BASE + (uint64_t)KSTACK_MAX * KSTACK_STRIDE)
+        return -1;
+    uint64_t rel = addr - KSTACK_VIRT_BASE;
+    unsigned slot = (unsigned)(rel / KSTACK_STRIDE);
+    if (!(slot_used[slot / 64] & (1UL << (slot % 64)))) return -1;
+    *offset = rel % KSTACK_STRIDE;
+    return (int)slot;
+}
+
+void *kstack_alloc(void)
+{
+    uint64_t flags = spin_lock_irqsave(&kstack_lock);
+    if (pool_count) {
+        void *base = pool[--pool_count];
+        spin_unlock_irqrestore(&kstack_lock, flags);
+        return base;
+    }
+    for (unsigned w = 0; w < KSTACK_MAX / 64; w++) {
+        if (slot_used[w] == ~0UL) continue;
+        unsigned bit = (unsigned)__builtin_ctzl(~slot_used[w]);
+        slot_used[w] |= 1UL << bit;
+        spin_unlock_irqrestore(&kstack_lock, flags);
+        return (void *)(uintptr_t)slot_base(w * 64 + bit);
+    }
+    spin_unlock_irqrestore(&kstack_lock, flags);
+    return NULL;
+}
+
+void kstack_free(void *base)
+{
+    uint64_t off;
+    int slot = slot_of((uint64_t)(uintptr_t)base, &off);
+    if (slot < 0 || off != KSTACK_GUARD) return;
+    uint64_t flags = spin_lock_irqsave(&kstack_lock);
+    if (pool_count < KSTACK_POOL) {
+        pool[pool_count++] = base;
+        spin_unlock_irqrestore(&kstack_lock, flags);
+        return;
+    }
+    spin_unlock_irqrestore(&kstack_lock, flags);
+    /* Unmap the whole stack at once and free its frames after the shootdown. */
+    uint64_t frames[KSTACK_SIZE / PAGE_SIZE];
+    unsigned n = 0;
+    for (uint64_t v = slot_base(slot); v < slot_base(slot) + KSTACK_SIZE; v += PAGE_SIZE) {
+        uint64_t phys = paging_virt_to_phys(v);
+        if (phys != (uint64_t)-1) frames[n++] = phys;
+    }
+    paging_unmap(slot_base(slot), KSTACK_SIZE);
+    for (unsigned i = 0; i < n; i++) page_free(phys_to_virt(frames[i]));
+    flags = spin_lock_irqsave(&kstack_lock);
+    slot_used[slot / 64] &= ~(1UL << (slot % 64));
+    spin_unlock_irqrestore(&kstack_lock, flags);
+}
+
+unsigned kstack_pooled(void)
+{
+    return __atomic_load_n(&pool_count, __ATOMIC_RELAXED);
+}
+
+bool kstack_handle_fault(uint64_t addr)
+{
+    uint64_t off;
+    if (slot_of(addr, &off) < 0 || off < KSTACK_GUARD) return false;
+    return paging_map_zero(addr) == 0;
+}
+
+bool kstack_is_guard(uint64_t addr)
+{
+    uint64_t off;
+    return slot_of(addr, &off) >= 0 && off < KSTACK_GUARD;
+}
@@ -0,0 +1,132 @@
+/**
+ * Allocator statistics and allocation trace.
+ * Counters are updated with relaxed atomics (an allocator's stats may be hit
+ * under different locks, e.g. one per kmem_cache); the peak is best effort.
+ * The trace ring is off by default and costs one branch.
+ */
+
+#include <kernel/memstat.h>
+#include <kernel/spinlock.h>
+#include <kernel/timer.h>
+#include <kernel/types.h>
+
+static struct mem_stats *registry[MEMSTAT_MAX];
+static int nr_registered;
+static spinlock_t registry_lock;
+
+static struct memtrace_entry trace[MEMTRACE_SIZE];
+static size_t trace_head;      /* next slot to write */
+static size_t trace_count;
+static bool trace_on;
+static spinlock_t trace_lock;
+
+static int size_bucket(size_t size)
+{
+    int b = 0;
+    size_t limit = 16;
+    while (b < MEMSTAT_BUCKETS - 1 && size > limit) {
+        limit <<= 1;
+        b++;
+    }
+    return b;
+}
+
+static void trace_add(uint8_t op, const struct mem_stats *s, const void *ptr, size_t size)
+{
+    uint64_t flags = spin_lock_irqsave(&trace_lock);
+    struct memtrace_entry *e = &trace[trace_head];
+    e->ms = timer_get_ms();
+    e->op = op;
+    e->name = s->name;
+    e->ptr = ptr;
+    e->size = size;
+    trace_head = (trace_head + 1) % MEMTRACE_SIZE;
+    if (trace_count < MEMTRACE_SIZE) trace_count++;
+    spin_unlock_irqrestore(&trace_lock, flags);
+}
+
+void memstat_register(struct mem_stats *s, const char *name, void (*refresh)(struct mem_stats *), void *owner)
+{
+    s->name = name;
+    s->refresh = refresh;
+    s->owner = owner;
+    uint64_t flags = spin_lock_irqsave(&registry_lock);
+    for (int i = 0; i < nr_registered; i++)
+        if (registry[i] == s) {
+            spin_unlock_irqrestore(&registry_lock, flags);
+            return;
+        }
+    if (nr_registered < MEMSTAT_MAX)
+        registry[nr_registered++] = s;
+    spin_unlock_irqrestore(&registry_lock, flags);
+}
+
+#define STAT_ADD(field, v) __atomic_add_fetch(&(field), (v), __ATOMIC_RELAXED)
+
+static void update_peak(struct mem_stats *s, size_t in_use)
+{
+    if (in_use > s->peak) s->peak = in_use;
+}
+
+void memstat_alloc(struct mem_stats *s, const void *ptr, size_t size)
+{
+    STAT_ADD(s->allocs, 1);
+    update_peak(s, STAT_ADD(s->in_use, size));
+    STAT_ADD(s->hist[size_bucket(size)], 1);
+    if (trace_on) trace_add(MEMTRACE_ALLOC, s, ptr, size);
+}
+
+void memstat_free(struct mem_stats *s, const void *ptr, size_t size)
+{
+    STAT_ADD(s->frees, 1);
+    STAT_ADD(s->in_use, -size);
+    if (trace_on) trace_add(MEMTRACE_FREE, s, ptr, size);
+}
+
+void memstat_realloc(struct mem_stats *s, const void *ptr, size_t old_size, size_t new_size)
+{
+    STAT_ADD(s->reallocs, 1);
+    update_peak(s, STAT_ADD(s->in_use, new_size - old_size));
+    if (trace_on) trace_add(MEMTRACE_REALLOC, s, ptr, new_size);
+}
+
+void memstat_fail(struct mem_stats *s, size_t size)
+{
+    STAT_ADD(s->failures, 1);
+    if (trace_on) trace_add(MEMTRACE_FAIL, s, NULL, size);
+}
+
+struct mem_stats *memstat_get(int i)
+{
+    if (i < 0 || i >= nr_registered) return NULL;
+    struct mem_stats *s = registry[i];
+    if (s->refresh) s->refresh(s);   /* takes the allocator's own lock */
+    return s;
+}
+
+unsigned memstat_frag_percent(const struct mem_stats *s)
+{
+    if (!s->free_bytes) return 0;
+    return (unsigned)(100 - (s->largest_free * 100) / s->free_bytes);
+}
+
+void memtrace_enable(bool on)
+{
+    trace_on = on;
+}
+
+bool memtrace_enabled(void)
+{
+    return trace_on;
+}
+
+int memtrace_read(struct memtrace_entry *out, int max)
+{
+    uint64_t flags = spin_lock_irqsave(&trace_lock);
+    int n = (int)trace_count < max ? (int)trace_count : max;
+    size_t start = (trace_head + MEMTRACE_SIZE - n) % MEMTRACE_SIZE;
+    for (int i = 0; i < n; i++)
+        out[i] = trace[(start + i) % MEMTRACE_SIZE];
+    spin_unlock_irqrestore(&trace_lock, flags);
+    return n;
+}
@@ -0,0 +1,273 @@
+/**
+ * Physical page-frame allocator (buddy system, orders 0..PAGE_MAX_ORDER).
+ * page_init copies the multiboot memory map, places the mem_map descriptor
+ * array (one struct page per frame) after the kernel image, then frees every
+ * usable frame inside the direct map into per-order free lists (frames the
+ * boot map does not reach are added by page_add_mapped from paging_init). page_alloc splits larger blocks;
+ * page_free merges a block with its buddy as long as the buddy is free.
+ */
+
+#include <kernel/mm.h>
+#include <kernel/memstat.h>
+#include <kernel/paging.h>
+#include <kernel/multiboot.h>
+#include <kernel/spinlock.h>
+#include <kernel/types.h>
+
+#define MULTIBOOT_FLAG_MEM   (1 << 0)
+#define MULTIBOOT_FLAG_MMAP  (1 << 6)
+#define LOW_MEMORY_END       0x100000UL   /* frames below 1 MiB are left alone */
+#define MAX_RANGES           32
+
+#define ALIGN_UP(x, a)   (((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+#define ALIGN_DOWN(x, a) ((x) & ~((uint64_t)(a) - 1))
+
+extern uint8_t __kernel_end[];
+
+struct mem_range {
+    uint64_t start, end;
+};
+
+static struct mem_range ranges[MAX_RANGES];
+static int nr_ranges;
+
+static struct page *mem_map;
+static size_t max_pfn;
+static struct page *free_area[PAGE_MAX_ORDER + 1];
+static size_t total_pages;
+static size_t free_pages;
+static uint64_t mapped_end;   /* frames below this are in the direct map */
+static uint64_t kernel_end;
+static uint64_t map_lo, map_hi;   /* mem_map itself */
+static struct mem_stats page_stats;
+static spinlock_t page_lock;   /* free lists and counters */
+
+static void add_range(uint64_t start, uint64_t end)
+{
+    if (start < LOW_MEMORY_END) start = LOW_MEMORY_END;
+    if (end > DIRECT_MAP_MAX) end = DIRECT_MAP_MAX;
+    start = ALIGN_UP(start, PAGE_SIZE);
+    end = ALIGN_DOWN(end, PAGE_SIZE);
+    if (start >= end || nr_ranges >= MAX_RANGES) return;
+    ranges[nr_ranges].start = start;
+    ranges[nr_ranges].end = end;
+    nr_ranges++;
+}
+
+/* Copy usable RAM out of the multiboot info before anything can overwrite it. */
+static void read_memory_map(const struct multiboot_info *mb)
+{
+    nr_ranges = 0;
+    if (!mb) return;
+    if (mb->flags & MULTIBOOT_FLAG_MMAP) {
+        const uint8_t *p = (const uint8_t *)phys_to_virt(mb->mmap_addr);
+        const uint8_t *end = p + mb->mmap_length;
+        while (p < end) {
+            const struct multiboot_mmap_entry *e = (const struct multiboot_mmap_entry *)p;
+            if (e->type == MULTIBOOT_MEMORY_AVAILABLE)
+                add_range(e->addr, e->addr + e->len);
+            p += e->size + sizeof(e->size);
+        }
+    } else if (mb->flags & MULTIBOOT_FLAG_MEM) {
+        add_range(LOW_MEMORY_END, LOW_MEMORY_END + (uint64_t)mb->mem_upper * 1024);
+    }
+}
+
+static void list_push(struct page **head, struct page *p)
+{
+    p->prev = NULL;
+    p->next = *head;
+    if (*head) (*head)->prev = p;
+    *head = p;
+}
+
+static void list_del(struct page **head, struct page *p)
+{
+    if (p->prev) p->prev->next = p->next;
+    else *head = p->next;
+    if (p->next) p->next->prev = p->prev;
+    p->prev = p->next = NULL;
+}
+
+/* Insert a free block, merging with its buddy while possible. */
+static void free_block(size_t pfn, unsigned order)
+{
+    free_pages += (size_t)1 << order;
+    while (order < PAGE_MAX_ORDER) {
+        size_t buddy = pfn ^ ((size_t)1 << order);
+        if (buddy >= max_pfn) break;
+        struct page *b = &mem_map[buddy];
+        if (!(b->flags & PG_BUDDY) || b->order != order) break;
+        list_del(&free_area[order], b);
+        b->flags = 0;
+        pfn &= ~((size_t)1 << order);
+        order++;
+    }
+    struct page *p = &mem_map[pfn];
+    p->flags = PG_BUDDY;
+    p->order = (uint8_t)order;
+    list_push(&free_area[order], p);
+}
+
+static void free_frames(uint64_t start, uint64_t end)
+{
+    size_t pfn = start >> PAGE_SHIFT;
+    size_t last = end >> PAGE_SHIFT;
+    for (size_t i = pfn; i < last; i++)
+        mem_map[i].flags = 0;
+    total_pages += last - pfn;
+    while (pfn < last) {
+        unsigned order = 0;
+        while (order < PAGE_MAX_ORDER && !(pfn & ((2UL << order) - 1)) && pfn + (2UL << order) <= last)
+            order++;
+        free_block(pfn, order);
+        pfn += (size_t)1 << order;
+    }
+}
+
+/* Free the usable frames in [lo, hi), skipping the kernel image and mem_map. */
+static void free_ranges(uint64_t lo, uint64_t hi)
+{
+    for (int i = 0; i < nr_ranges; i++) {
+        uint64_t s = ranges[i].start < lo ? lo : ranges[i].start;
+        uint64_t e = ranges[i].end > hi ? hi : ranges[i].end;
+        if (s < kernel_end) s = kernel_end;
+        if (s >= e) continue;
+        if (map_lo < e && map_hi > s) {
+            if (s < map_lo) free_frames(s, map_lo);
+            s = map_hi;
+        }
+        if (s < e) free_frames(s, e);
+    }
+}
+
+static void page_refresh_stats(struct mem_stats *s)
+{
+    uint64_t flags = spin_lock_irqsave(&page_lock);
+    s->free_bytes = free_pages * PAGE_SIZE;
+    s->largest_free = page_largest_free();
+    spin_unlock_irqrestore(&page_lock, flags);
+}
+
+void page_init(const struct multiboot_info *mb)
+{
+    memstat_register(&page_stats, "pages", page_refresh_stats, NULL);
+    read_memory_map(mb);
+    kernel_end = ALIGN_UP(virt_to_phys(__kernel_end), PAGE_SIZE);
+    mapped_end = paging_direct_map_end();
+
+    max_pfn = 0;
+    for (int i = 0; i < nr_ranges; i++)
+        if (ranges[i].end >> PAGE_SHIFT > max_pfn)
+            max_pfn = ranges[i].end >> PAGE_SHIFT;
+
+    /* mem_map goes in the first mapped range above the kernel that can hold it. */
+    uint64_t map_bytes = ALIGN_UP(max_pfn * sizeof(struct page), PAGE_SIZE);
+    map_lo = map_hi = 0;
+    for (int i = 0; i < nr_ranges; i++) {
+        uint64_t s = ranges[i].start < kernel_end ? kernel_end : ranges[i].start;
+        uint64_t e = ranges[i].end < mapped_end ? ranges[i].end : mapped_end;
+        if (s < e && e - s >= map_bytes) {
+            map_lo = s;
+            map_hi = s + map_bytes;
+            break;
+        }
+    }
+    if (!map_hi) {
+        max_pfn = 0;
+        return;
+    }
+    mem_map = (struct page *)phys_to_virt(map_lo);
+    for (size_t i = 0; i < max_pfn; i++) {
+        mem_map[i].flags = PG_RESERVED;
+        mem_map[i].order = 0;
+        mem_map[i].inuse = 0;
+        mem_map[i].cache = NULL;
+        mem_map[i].freelist = NULL;
+        mem_map[i].prev = mem_map[i].next = NULL;
+    }
+    free_ranges(0, mapped_end);
+}
+
+void page_add_mapped(uint64_t end)
+{
+    if (!mem_map || end <= mapped_end) return;
+    uint64_t flags = spin_lock_irqsave(&page_lock);
+    free_ranges(mapped_end, end);
+    mapped_end = end;
+    spin_unlock_irqrestore(&page_lock, flags);
+}
+
+uint64_t page_ram_top(void)
+{
+    return (uint64_t)max_pfn << PAGE_SHIFT;
+}
+
+void *page_alloc(unsigned order)
+{
+    if (order > PAGE_MAX_ORDER) return NULL;
+    uint64_t flags = spin_lock_irqsave(&page_lock);
+    unsigned o = order;
+    while (o <= PAGE_MAX_ORDER && !free_area[o]) o++;
+    if (o > PAGE_MAX_ORDER) {
+        memstat_fail(&page_stats, (size_t)PAGE_SIZE << order);
+        spin_unlock_irqrestore(&page_lock, flags);
+        return NULL;
+    }
+    struct page *p = free_area[o];
+    list_del(&free_area[o], p);
+    while (o > order) {
+        o--;
+        struct page *b = p + ((size_t)1 << o);
+        b->flags = PG_BUDDY;
+        b->order = (uint8_t)o;
+        list_push(&free_area[o], b);
+    }
+    p->flags = 0;
+    p->order = (uint8_t)order;
+    free_pages -= (size_t)1 << order;
+    memstat_alloc(&page_stats, page_to_virt(p), (size_t)PAGE_SIZE << order);
+    spin_unlock_irqrestore(&page_lock, flags);
+    return page_to_virt(p);
+}
+
+void page_free(void *addr)
+{
+    struct page *p = virt_to_page(addr);
+    if (!p || (p->flags & (PG_RESERVED | PG_BUDDY))) return;
+    size_t pfn = (size_t)(p - mem_map);
+    if (pfn & (((size_t)1 << p->order) - 1)) return;
+    uint64_t flags = spin_lock_irqsave(&page_lock);
+    memstat_free(&page_stats, addr, (size_t)PAGE_SIZE << p->order);
+    free_block(pfn, p->order);
+    spin_unlock_irqrestore(&page_lock, flags);
+}
+
+struct page *virt_to_page(const void *addr)
+{
+    size_t pfn = (size_t)(virt_to_phys(addr) >> PAGE_SHIFT);
+    if (!mem_map || pfn >= max_pfn) return NULL;
+    return &mem_map[pfn];
+}
+
+void *page_to_virt(const struct page *page)
+{
+    return phys_to_virt((uint64_t)(page - mem_map) << PAGE_SHIFT);
+}
+
+size_t page_total_count(void)
+{
+    return total_pages;
+}
+
+size_t page_free_count(void)
+{
+    return free_pages;
+}
+
+size_t page_largest_free(void)
+{
+    for (int o = PAGE_MAX_ORDER; o >= 0; o--)
+        if (free_area[o]) return (size_t)PAGE_SIZE << o;
+    return 0;
+}
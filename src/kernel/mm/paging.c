@@ -0,0 +1,344 @@
+/**
+ * Kernel page tables: direct map of all RAM, PAT setup and MMIO mappings.
+ * boot.asm identity-maps RAM with 1 GiB pages when CPUID reports them and
+ * with 2 MiB pages (first BOOT_PD_COUNT GiB) otherwise; paging_init maps the
+ * rest and hands the new frames to the page allocator. Device ranges get
+ * their own virtual window so they can carry UC/WC attributes, and large
+ * reservations (game heaps, fs buffers) live in a demand-zero window whose
+ * frames are only allocated when first touched.
+ * Ring-3 processes get a PML4 of their own whose first KERNEL_PML4_SLOTS
+ * entries are copies of the kernel's, so the kernel windows (and every later
+ * change below them) are shared; only the user window differs.
+ */
+
+#include <kernel/paging.h>
+#include <kernel/mm.h>
+#include <kernel/cpu.h>
+#include <kernel/spinlock.h>
+#include <kernel/smp.h>
+#include <kernel/types.h>
+
+#define MSR_PAT        0x277
+/* PAT entries: 0 WB, 1 WT, 2 UC-, 3 UC, 4 WC, 5 WP, 6 UC-, 7 UC */
+#define PAT_VALUE      0x0007050100070406UL
+#define CPUID_PDPE1GB  (1u << 26)
+
+#define PML4_IDX(v) (((v) >> 39) & 0x1FF)
+#define PDPT_IDX(v) (((v) >> 30) & 0x1FF)
+#define PD_IDX(v)   (((v) >> 21) & 0x1FF)
+#define PT_IDX(v)   (((v) >> 12) & 0x1FF)
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+
+extern uint32_t boot_direct_map_gib;   /* set by boot.asm */
+
+static uint64_t *kernel_pml4;
+static uint64_t direct_map_end;
+static bool has_1g;
+static uint64_t mmio_next = MMIO_VIRT_BASE;
+static uint64_t lazy_next = LAZY_VIRT_BASE;
+static spinlock_t pt_lock;      /* all page tables and the window cursors */
+
+/* Descend one level, allocating a zeroed table if create is set. NULL at a huge leaf. */
+static uint64_t *table_next(uint64_t *entry, bool create, uint64_t flags)
+{
+    if (!(*entry & PTE_PRESENT)) {
+        if (!create) return NULL;
+        uint64_t *t = (uint64_t *)page_alloc(0);
+        if (!t) return NULL;
+        for (int i = 0; i < 512; i++) t[i] = 0;
+        *entry = virt_to_phys(t) | PTE_PRESENT | PTE_WRITE | (flags & PTE_USER);
+    } else if (*entry & PTE_HUGE) {
+        return NULL;
+    } else if (flags & PTE_USER) {
+        *entry |= PTE_USER;
+    }
+    return (uint64_t *)phys_to_virt(*entry & PTE_ADDR_MASK);
+}
+
+/* 4 KiB-form flags -> 2 MiB / 1 GiB leaf (PAT bit moves from 7 to 12). */
+static uint64_t huge_flags(uint64_t flags)
+{
+    uint64_t f = flags & ~PTE_PAT;
+    if (flags & PTE_PAT) f |= PTE_PAT_HUGE;
+    return f | PTE_HUGE;
+}
+
+uint64_t paging_direct_map_end(void)
+{
+    if (!direct_map_end)
+        direct_map_end = (uint64_t)boot_direct_map_gib * PAGE_SIZE_1G;
+    return direct_map_end;
+}
+
+bool paging_has_1g_pages(void)
+{
+    return has_1g;
+}
+
+uint64_t paging_cache_flags(enum page_cache cache)
+{
+    switch (cache) {
+    case CACHE_WT:       return PTE_PWT;
+    case CACHE_UC_MINUS: return PTE_PCD;
+    case CACHE_UC:       return PTE_PCD | PTE_PWT;
+    case CACHE_WC:       return PTE_PAT;
+    case CACHE_WP:       return PTE_PAT | PTE_PWT;
+    default:             return 0;
+    }
+}
+
+static int map_locked(uint64_t *pml4, uint64_t virt, uint64_t phys, size_t size, uint64_t flags)
+{
+    flags |= PTE_PRESENT;
+    uint64_t end = virt + size;
+    int ret = 0;
+    while (virt < end) {
+        uint64_t rem = end - virt;
+        uint64_t step = PAGE_SIZE;
+        uint64_t *pdpt = table_next(&pml4[PML4_IDX(virt)], true, flags);
+        if (!pdpt) { ret = -1; break; }
+        uint64_t *e = &pdpt[PDPT_IDX(virt)];
+        if (has_1g && !((virt | phys) & (PAGE_SIZE_1G - 1)) && rem >= PAGE_SIZE_1G && !(*e & PTE_PRESENT)) {
+            *e = phys | huge_flags(flags);
+            step = PAGE_SIZE_1G;
+        } else {
+            uint64_t *pd = table_next(e, true, flags);
+            if (!pd) { ret = -1; break; }
+            e = &pd[PD_IDX(virt)];
+            if (!((virt | phys) & (PAGE_SIZE_2M - 1)) && rem >= PAGE_SIZE_2M && !(*e & PTE_PRESENT)) {
+                *e = phys | huge_flags(flags);
+                step = PAGE_SIZE_2M;
+            } else {
+                uint64_t *pt = table_next(e, true, flags);
+                if (!pt) { ret = -1; break; }
+                pt[PT_IDX(virt)] = (phys & PTE_ADDR_MASK) | flags;
+            }
+        }
+        invlpg(virt);
+        virt += step;
+        phys += step;
+    }
+    return ret;
+}
+
+int paging_map(uint64_t virt, uint64_t phys, size_t size, uint64_t flags)
+{
+    uint64_t irq = spin_lock_irqsave(&pt_lock);
+    int ret = map_locked(kernel_pml4, virt, phys, size, flags);
+    spin_unlock_irqrestore(&pt_lock, irq);
+    return ret;
+}
+
+/* Find the leaf entry mapping virt and the size it covers. */
+static uint64_t *find_leaf(uint64_t *pml4, uint64_t virt, uint64_t *size)
+{
+    uint64_t *e = &pml4[PML4_IDX(virt)];
+    if (!(*e & PTE_PRESENT)) return NULL;
+    e = (uint64_t *)phys_to_virt(*e & PTE_ADDR_MASK) + PDPT_IDX(virt);
+    if (!(*e & PTE_PRESENT)) return NULL;
+    if (*e & PTE_HUGE) { *size = PAGE_SIZE_1G; return e; }
+    e = (uint64_t *)phys_to_virt(*e & PTE_ADDR_MASK) + PD_IDX(virt);
+    if (!(*e & PTE_PRESENT)) return NULL;
+    if (*e & PTE_HUGE) { *size = PAGE_SIZE_2M; return e; }
+    e = (uint64_t *)phys_to_virt(*e & PTE_ADDR_MASK) + PT_IDX(virt);
+    if (!(*e & PTE_PRESENT)) return NULL;
+    *size = PAGE_SIZE;
+    return e;
+}
+
+void paging_unmap(uint64_t virt, size_t size)
+{
+    uint64_t end = virt + size;
+    uint64_t irq = spin_lock_irqsave(&pt_lock);
+    while (virt < end) {
+        uint64_t leaf = PAGE_SIZE;
+        uint64_t *e = find_leaf(kernel_pml4, virt, &leaf);
+        if (e) {
+            *e = 0;
+            invlpg(virt);
+        }
+        virt = (virt & ~(leaf - 1)) + leaf;
+    }
+    spin_unlock_irqrestore(&pt_lock, irq);
+    smp_tlb_shootdown();
+}
+
+uint64_t paging_virt_to_phys(uint64_t virt)
+{
+    uint64_t leaf = PAGE_SIZE;
+    uint64_t *e = find_leaf(kernel_pml4, virt, &leaf);
+    if (!e) return (uint64_t)-1;
+    uint64_t base = *e & PTE_ADDR_MASK & ~(leaf - 1);
+    return base | (virt & (leaf - 1));
+}
+
+void *mmio_map(uint64_t phys, size_t size, enum page_cache cache)
+{
+    if (size == 0) return NULL;
+    uint64_t off = phys & (PAGE_SIZE - 1);
+    uint64_t base = phys - off;
+    uint64_t len = ALIGN_UP(size + off, PAGE_SIZE);
+    /* Keep virt and phys congruent mod 2 MiB so large BARs get 2 MiB pages. */
+    uint64_t align = len >= PAGE_SIZE_2M ? PAGE_SIZE_2M : PAGE_SIZE;
+    uint64_t irq = spin_lock_irqsave(&pt_lock);
+    uint64_t virt = ALIGN_UP(mmio_next, align) + (base & (align - 1));
+    if (virt + len > MMIO_VIRT_BASE + MMIO_VIRT_SIZE) {
+        spin_unlock_irqrestore(&pt_lock, irq);
+        return NULL;
+    }
+    mmio_next = virt + len;
+    spin_unlock_irqrestore(&pt_lock, irq);
+    if (paging_map(virt, base, len, PTE_WRITE | paging_cache_flags(cache)) != 0)
+        return NULL;
+    return (void *)(uintptr_t)(virt + off);
+}
+
+void mmio_unmap(void *virt, size_t size)
+{
+    uint64_t v = (uint64_t)(uintptr_t)virt;
+    uint64_t off = v & (PAGE_SIZE - 1);
+    paging_unmap(v - off, ALIGN_UP(size + off, PAGE_SIZE));
+}
+
+void *paging_reserve_zero(size_t size)
+{
+    if (size == 0) return NULL;
+    uint64_t len = ALIGN_UP(size, PAGE_SIZE);
+    uint64_t irq = spin_lock_irqsave(&pt_lock);
+    uint64_t virt = lazy_next;
+    if (len > LAZY_VIRT_BASE + LAZY_VIRT_SIZE - virt) {
+        spin_unlock_irqrestore(&pt_lock, irq);
+        return NULL;
+    }
+    lazy_next = virt + len;
+    spin_unlock_irqrestore(&pt_lock, irq);
+    return (void *)(uintptr_t)virt;
+}
+
+int paging_map_zero(uint64_t virt)
+{
+    uint64_t page = virt & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t leaf;
+    uint64_t *frame = (uint64_t *)page_alloc(0);
+    if (!frame) return -1;
+    for (int i = 0; i < PAGE_SIZE / 8; i++) frame[i] = 0;
+    /* Another CPU may have faulted on the same page; first mapping wins. */
+    uint64_t irq = spin_lock_irqsave(&pt_lock);
+    bool mapped = find_leaf(kernel_pml4, page, &leaf) != NULL;
+    int ret = mapped ? 0 : map_locked(kernel_pml4, page, virt_to_phys(frame), PAGE_SIZE, PTE_WRITE);
+    spin_unlock_irqrestore(&pt_lock, irq);
+    if (mapped || ret != 0) page_free(frame);
+    return ret;
+}
+
+bool paging_handle_fault(uint64_t addr, uint64_t error)
+{
+    if (error & PF_PRESENT) return false;
+    if (addr >= LAZY_VIRT_BASE && addr < lazy_next)
+        return paging_map_zero(addr) == 0;
+    return kstack_handle_fault(addr);
+}
+
+void paging_init_cpu(void)
+{
+    wrmsr(MSR_PAT, PAT_VALUE);
+    write_cr3(read_cr3());
+}
+
+void paging_init(void)
+{
+    uint32_t a, b, c, d;
+    kernel_pml4 = (uint64_t *)phys_to_virt(read_cr3() & PTE_ADDR_MASK);
+    /* Address spaces copy these entries, so they must not change later. */
+    for (int i = 0; i < KERNEL_PML4_SLOTS; i++) table_next(&kernel_pml4[i], true, 0);
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    if (a >= 0x80000001) {
+        cpuid(0x80000001, 0, &a, &b, &c, &d);
+        has_1g = (d & CPUID_PDPE1GB) != 0;
+    }
+    paging_init_cpu();
+
+    /* Boot mapped what it could; cover the rest of RAM (2 MiB granularity). */
+    uint64_t mapped = paging_direct_map_end();
+    uint64_t top = ALIGN_UP(page_ram_top(), PAGE_SIZE_2M);
+    if (top > DIRECT_MAP_MAX) top = DIRECT_MAP_MAX;
+    if (top > mapped && paging_map(mapped, mapped, top - mapped, PTE_WRITE) == 0) {
+        direct_map_end = top;
+        page_add_mapped(top);
+    }
+}
+
+uint64_t *paging_space_create(void)
+{
+    uint64_t *pml4 = (uint64_t *)page_alloc(0);
+    if (!pml4) return NULL;
+    for (int i = 0; i < 512; i++) pml4[i] = i < KERNEL_PML4_SLOTS ? kernel_pml4[i] : 0;
+    return pml4;
+}
+
+/* Free table t (level 3 = PDPT .. 1 = PT), the tables below it and the
+ * owned frames its leaves map. */
+static void free_tables(uint64_t *t, int level)
+{
+    for (int i = 0; i < 512; i++) {
+        uint64_t e = t[i];
+        if (!(e & PTE_PRESENT)) continue;
+        if (level > 1 && !(e & PTE_HUGE))
+            free_tables((uint64_t *)phys_to_virt(e & PTE_ADDR_MASK), level - 1);
+        else if (level == 1 && (e & PTE_OWNED))
+            page_free(phys_to_virt(e & PTE_ADDR_MASK));
+    }
+    page_free(t);
+}
+
+void paging_space_destroy(uint64_t *pml4)
+{
+    for (int i = KERNEL_PML4_SLOTS; i < 512; i++)
+        if (pml4[i] & PTE_PRESENT)
+            free_tables((uint64_t *)phys_to_virt(pml4[i] & PTE_ADDR_MASK), 3);
+    page_free(pml4);
+}
+
+int paging_space_map(uint64_t *pml4, uint64_t virt, uint64_t phys, size_t size, uint64_t flags)
+{
+    uint64_t irq = spin_lock_irqsave(&pt_lock);
+    int ret = map_locked(pml4, virt, phys, size, flags);
+    spin_unlock_irqrestore(&pt_lock, irq);
+    return ret;
+}
+
+int paging_space_alloc(uint64_t *pml4, uint64_t virt, size_t size, uint64_t flags)
+{
+    for (uint64_t off = 0; off < size; off += PAGE_SIZE) {
+        uint64_t *frame = (uint64_t *)page_alloc(0);
+        if (!frame) return -1;
+        for (int i = 0; i < PAGE_SIZE / 8; i++) frame[i] = 0;
+        if (paging_space_map(pml4, virt + off, virt_to_phys(frame), PAGE_SIZE, flags | PTE_OWNED) != 0) {
+            page_free(frame);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void paging_space_switch(uint64_t *pml4)
+{
+    uint64_t want = virt_to_phys(pml4 ? pml4 : kernel_pml4);
+    if ((read_cr3() & PTE_ADDR_MASK) != want) write_cr3(want);
+}
+
+bool paging_user_ok(uint64_t *pml4, uint64_t virt, size_t size, bool write)
+{
+    uint64_t end = USER_VIRT_BASE + USER_VIRT_SIZE;
+    if (!pml4 || virt < USER_VIRT_BASE || virt >= end) return false;
+    if (size == 0) size = 1;
+    if (size > end - virt) return false;
+    uint64_t need = PTE_PRESENT | PTE_USER | (write ? PTE_WRITE : 0);
+    for (uint64_t page = virt & ~(uint64_t)(PAGE_SIZE - 1); page < virt + size; page += PAGE_SIZE) {
+        uint64_t leaf;
+        uint64_t *e = find_leaf(pml4, page, &leaf);
+        if (!e || (*e & need) != need) return false;
+    }
+    return true;
+}
@@ -0,0 +1,347 @@
+/**
+ * TLSF (Two-Level Segregated Fit) allocator.
+ * Free blocks live on segregated lists indexed by (first level = log2 of the
+ * size, second level = next TLSF_SL_LOG2 bits); two bitmaps find a suitable
+ * non-empty list in O(1). Every block header carries its size and a pointer
+ * to the physically previous block, so free and realloc can reach both
+ * neighbours without searching.
+ */
+
+#include <kernel/tlsf.h>
+#include <kernel/mm.h>
+#include <kernel/paging.h>
+#include <kernel/spinlock.h>
+#include <kernel/cpu.h>
+#include <kernel/types.h>
+
+#define BLOCK_FREE   ((size_t)1)
+#define BLOCK_HDR    sizeof(struct tlsf_block_hdr)
+#define BLOCK_MIN    (2 * sizeof(void *))    /* room for the free-list links */
+#define SMALL_BLOCK  ((size_t)1 << TLSF_FL_SHIFT)
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+#define TLSF_GROW_ORDER  PAGE_MAX_ORDER      /* arenas grow 4 MiB at a time */
+
+struct tlsf_block_hdr {
+    size_t size;                     /* payload bytes | BLOCK_FREE */
+    struct tlsf_block *prev_phys;    /* boundary tag: physically previous block */
+};
+
+struct tlsf_block {
+    size_t size;
+    struct tlsf_block *prev_phys;
+    /* Payload starts here; free blocks keep their list links in it. */
+    struct tlsf_block *next_free;
+    struct tlsf_block *prev_free;
+};
+
+static inline size_t block_size(const struct tlsf_block *b) { return b->size & ~BLOCK_FREE; }
+static inline bool block_is_free(const struct tlsf_block *b) { return (b->size & BLOCK_FREE) != 0; }
+static inline void *block_to_ptr(struct tlsf_block *b) { return (uint8_t *)b + BLOCK_HDR; }
+static inline struct tlsf_block *ptr_to_block(const void *p) { return (struct tlsf_block *)((uint8_t *)p - BLOCK_HDR); }
+static inline struct tlsf_block *block_next(struct tlsf_block *b)
+{
+    return (struct tlsf_block *)((uint8_t *)block_to_ptr(b) + block_size(b));
+}
+
+static inline int fls_size(size_t x) { return 63 - __builtin_clzl(x); }
+static inline int ffs_u32(uint32_t x) { return __builtin_ctz(x); }
+
+static void mapping_insert(size_t size, int *fl, int *sl)
+{
+    if (size < SMALL_BLOCK) {
+        *fl = 0;
+        *sl = (int)(size / (SMALL_BLOCK / TLSF_SL_COUNT));
+    } else {
+        int f = fls_size(size);
+        *sl = (int)((size >> (f - TLSF_SL_LOG2)) ^ (1u << TLSF_SL_LOG2));
+        *fl = f - (TLSF_FL_SHIFT - 1);
+    }
+}
+
+/* Round up to the next list boundary so any block on the found list fits. */
+static void mapping_search(size_t size, int *fl, int *sl)
+{
+    if (size >= SMALL_BLOCK)
+        size += ((size_t)1 << (fls_size(size) - TLSF_SL_LOG2)) - 1;
+    mapping_insert(size, fl, sl);
+}
+
+static struct tlsf_block *find_suitable(struct tlsf *t, int *fl, int *sl)
+{
+    if (*fl >= TLSF_FL_COUNT) return NULL;
+    uint32_t sl_map = t->sl_bitmap[*fl] & (~0u << *sl);
+    if (!sl_map) {
+        uint32_t fl_map = *fl + 1 < TLSF_FL_COUNT ? t->fl_bitmap & (~0u << (*fl + 1)) : 0;
+        if (!fl_map) return NULL;
+        *fl = ffs_u32(fl_map);
+        sl_map = t->sl_bitmap[*fl];
+    }
+    *sl = ffs_u32(sl_map);
+    return t->free[*fl][*sl];
+}
+
+static void remove_free(struct tlsf *t, struct tlsf_block *b)
+{
+    int fl, sl;
+    mapping_insert(block_size(b), &fl, &sl);
+    if (b->prev_free) b->prev_free->next_free = b->next_free;
+    else t->free[fl][sl] = b->next_free;
+    if (b->next_free) b->next_free->prev_free = b->prev_free;
+    if (!t->free[fl][sl]) {
+        t->sl_bitmap[fl] &= ~(1u << sl);
+        if (!t->sl_bitmap[fl]) t->fl_bitmap &= ~(1u << fl);
+    }
+    b->size &= ~BLOCK_FREE;
+    t->free_bytes -= block_size(b);
+}
+
+static void insert_free(struct tlsf *t, struct tlsf_block *b)
+{
+    int fl, sl;
+    mapping_insert(block_size(b), &fl, &sl);
+    b->size |= BLOCK_FREE;
+    b->prev_free = NULL;
+    b->next_free = t->free[fl][sl];
+    if (b->next_free) b->next_free->prev_free = b;
+    t->free[fl][sl] = b;
+    t->sl_bitmap[fl] |= 1u << sl;
+    t->fl_bitmap |= 1u << fl;
+    t->free_bytes += block_size(b);
+}
+
+/* Merge b with its free physical neighbours; b must not be on a free list. */
+static struct tlsf_block *coalesce(struct tlsf *t, struct tlsf_block *b)
+{
+    struct tlsf_block *next = block_next(b);
+    if (block_is_free(next)) {
+        remove_free(t, next);
+        b->size += BLOCK_HDR + block_size(next);
+        block_next(b)->prev_phys = b;
+    }
+    struct tlsf_block *prev = b->prev_phys;
+    if (prev && block_is_free(prev)) {
+        remove_free(t, prev);
+        prev->size += BLOCK_HDR + block_size(b);
+        block_next(prev)->prev_phys = prev;
+        b = prev;
+    }
+    return b;
+}
+
+/* Trim a used block to size, returning the tail to the free lists. */
+static void trim(struct tlsf *t, struct tlsf_block *b, size_t size)
+{
+    size_t cur = block_size(b);
+    if (cur < size + BLOCK_HDR + BLOCK_MIN) return;
+    struct tlsf_block *rest = (struct tlsf_block *)((uint8_t *)block_to_ptr(b) + size);
+    rest->size = cur - size - BLOCK_HDR;
+    rest->prev_phys = b;
+    b->size = size;
+    block_next(rest)->prev_phys = rest;
+    insert_free(t, coalesce(t, rest));
+}
+
+static size_t adjust_size(size_t size)
+{
+    if (size == 0 || size > ((size_t)1 << (TLSF_FL_COUNT + TLSF_FL_SHIFT - 2))) return 0;
+    size = ALIGN_UP(size, TLSF_ALIGN);
+    return size < BLOCK_MIN ? BLOCK_MIN : size;
+}
+
+static void tlsf_refresh_stats(struct mem_stats *s)
+{
+    struct tlsf *t = (struct tlsf *)s->owner;
+    s->largest_free = tlsf_largest_free(t);
+    s->free_bytes = t->free_bytes;
+}
+
+void tlsf_init(struct tlsf *t, const char *name, size_t limit)
+{
+    t->name = name;
+    t->fl_bitmap = 0;
+    for (int i = 0; i < TLSF_FL_COUNT; i++) {
+        t->sl_bitmap[i] = 0;
+        for (int j = 0; j < TLSF_SL_COUNT; j++)
+            t->free[i][j] = NULL;
+    }
+    t->pool_bytes = 0;
+    t->limit = limit;
+    t->growing = 0;
+    t->free_bytes = 0;
+    t->lock = (spinlock_t)SPINLOCK_INIT;
+    memstat_register(&t->stats, name, tlsf_refresh_stats, t);
+}
+
+int tlsf_add_pool(struct tlsf *t, void *mem, size_t bytes)
+{
+    uintptr_t start = ALIGN_UP((uintptr_t)mem, TLSF_ALIGN);
+    uintptr_t end = ((uintptr_t)mem + bytes) & ~(uintptr_t)(TLSF_ALIGN - 1);
+    if (end <= start || end - start < 2 * BLOCK_HDR + BLOCK_MIN) return -1;
+    /* One free block spanning the pool, then a zero-size used sentinel. */
+    struct tlsf_block *b = (struct tlsf_block *)start;
+    b->size = end - start - 2 * BLOCK_HDR;
+    b->prev_phys = NULL;
+    struct tlsf_block *sentinel = block_next(b);
+    sentinel->size = 0;
+    sentinel->prev_phys = b;
+    uint64_t flags = spin_lock_irqsave(&t->lock);
+    insert_free(t, b);
+    t->pool_bytes += bytes;
+    spin_unlock_irqrestore(&t->lock, flags);
+    return 0;
+}
+
+/* Check the limit and claim bytes of it in one go, so two growers racing
+ * cannot both pass. first: only if nothing was ever added or claimed. */
+static bool claim(struct tlsf *t, size_t bytes, bool first)
+{
+    uint64_t flags = spin_lock_irqsave(&t->lock);
+    bool ok = first ? !t->pool_bytes && !t->growing
+                    : t->pool_bytes + t->growing + bytes <= t->limit;
+    if (ok) __atomic_store_n(&t->growing, t->growing + bytes, __ATOMIC_RELAXED);
+    spin_unlock_irqrestore(&t->lock, flags);
+    return ok;
+}
+
+static void unclaim(struct tlsf *t, size_t bytes)
+{
+    uint64_t flags = spin_lock_irqsave(&t->lock);
+    __atomic_store_n(&t->growing, t->growing - bytes, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&t->lock, flags);
+}
+
+/* Another grow holds claims that may be all the limit has left: wait for
+ * it to add its pool. False if none was in flight. Arenas are only used
+ * from process context, so the grower is never one we interrupted. */
+static bool wait_growers(struct tlsf *t)
+{
+    if (!__atomic_load_n(&t->growing, __ATOMIC_ACQUIRE)) return false;
+    while (__atomic_load_n(&t->growing, __ATOMIC_ACQUIRE)) cpu_relax();
+    return true;
+}
+
+/* True if the arena may now have a fitting block: it grew, or another grow
+ * finished meanwhile. False once the limit (or memory) is exhausted. */
+static bool tlsf_grow(struct tlsf *t, size_t size)
+{
+    /* First growth reserves the whole limit as demand-zero memory: one pool,
+     * no physical frames until the owner touches them. */
+    if (claim(t, t->limit, true)) {
+        void *mem = paging_reserve_zero(t->limit);
+        bool ok = mem && tlsf_add_pool(t, mem, t->limit) == 0;
+        unclaim(t, t->limit);
+        if (ok) return true;
+    }
+    /* Otherwise take committed buddy blocks a chunk at a time. */
+    size_t bytes = (size_t)PAGE_SIZE << TLSF_GROW_ORDER;
+    if (size + 2 * BLOCK_HDR > bytes || !claim(t, bytes, false)) return wait_growers(t);
+    void *mem = page_alloc(TLSF_GROW_ORDER);
+    bool ok = mem && tlsf_add_pool(t, mem, bytes) == 0;
+    unclaim(t, bytes);
+    return ok;
+}
+
+static struct tlsf_block *take_block(struct tlsf *t, size_t size)
+{
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+    struct tlsf_block *b = find_suitable(t, &fl, &sl);
+    if (b) remove_free(t, b);
+    return b;
+}
+
+void *tlsf_malloc(struct tlsf *t, size_t size)
+{
+    size_t want = adjust_size(size);
+    uint64_t flags = spin_lock_irqsave(&t->lock);
+    struct tlsf_block *b = want ? take_block(t, want) : NULL;
+    while (!b && want) {
+        spin_unlock_irqrestore(&t->lock, flags);
+        bool grown = tlsf_grow(t, want);
+        flags = spin_lock_irqsave(&t->lock);
+        if (!grown) break;
+        b = take_block(t, want);
+    }
+    if (!b) {
+        memstat_fail(&t->stats, size);
+        spin_unlock_irqrestore(&t->lock, flags);
+        return NULL;
+    }
+    trim(t, b, want);
+    memstat_alloc(&t->stats, block_to_ptr(b), block_size(b));
+    spin_unlock_irqrestore(&t->lock, flags);
+    return block_to_ptr(b);
+}
+
+void tlsf_free(struct tlsf *t, void *ptr)
+{
+    if (!ptr) return;
+    struct tlsf_block *b = ptr_to_block(ptr);
+    uint64_t flags = spin_lock_irqsave(&t->lock);
+    if (block_is_free(b)) {           /* double free */
+        spin_unlock_irqrestore(&t->lock, flags);
+        return;
+    }
+    memstat_free(&t->stats, ptr, block_size(b));
+    insert_free(t, coalesce(t, b));
+    spin_unlock_irqrestore(&t->lock, flags);
+}
+
+void *tlsf_realloc(struct tlsf *t, void *ptr, size_t size)
+{
+    if (!ptr) return tlsf_malloc(t, size);
+    if (size == 0) {
+        tlsf_free(t, ptr);
+        return NULL;
+    }
+    size_t want = adjust_size(size);
+    if (!want) return NULL;
+    struct tlsf_block *b = ptr_to_block(ptr);
+    size_t old = block_size(b);
+    size_t cur = old;
+    uint64_t flags = spin_lock_irqsave(&t->lock);
+    if (want > cur) {
+        struct tlsf_block *next = block_next(b);
+        if (block_is_free(next) && cur + BLOCK_HDR + block_size(next) >= want) {
+            remove_free(t, next);
+            b->size = cur + BLOCK_HDR + block_size(next);
+            block_next(b)->prev_phys = b;
+            cur = b->size;
+        }
+    }
+    if (want <= cur) {
+        trim(t, b, want);
+        memstat_realloc(&t->stats, ptr, old, block_size(b));
+        spin_unlock_irqrestore(&t->lock, flags);
+        return ptr;
+    }
+    spin_unlock_irqrestore(&t->lock, flags);
+
+    void *n = tlsf_malloc(t, size);
+    if (!n) return NULL;
+    uint64_t *dst = (uint64_t *)n;
+    const uint64_t *src = (const uint64_t *)ptr;
+    for (size_t i = 0; i < cur / sizeof(uint64_t); i++) dst[i] = src[i];
+    tlsf_free(t, ptr);
+    return n;
+}
+
+size_t tlsf_usable_size(const void *ptr)
+{
+    return ptr ? block_size(ptr_to_block(ptr)) : 0;
+}
+
+size_t tlsf_largest_free(struct tlsf *t)
+{
+    size_t best = 0;
+    uint64_t flags = spin_lock_irqsave(&t->lock);
+    if (t->fl_bitmap) {
+        int fl = fls_size(t->fl_bitmap);
+        int sl = fls_size(t->sl_bitmap[fl]);
+        for (struct tlsf_block *b = t->free[fl][sl]; b; b = b->next_free)
+            if (block_size(b) > best) best = block_size(b);
+    }
+    spin_unlock_irqrestore(&t->lock, flags);
+    return best;
+}
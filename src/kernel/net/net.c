@@ -1,17 +1,37 @@
 /**
- * Network stack glue: loopback, poll, ping, HTTP over loopback TCP.
+ * Network stack glue: loopback, receive processing, ping, HTTP over loopback TCP.
+ * Packets are processed by net_rx_work on system_wq, not by the sender:
+ * the NIC queues it when a packet arrives (net_rx_kick), and so does the
+ * TCP retransmission timer. It runs net_poll and wakes net_rx_wait.
+ * Ping and HTTP GET are async tasks (async.h) that await net_rx_wait until
+ * their reply has been handled or NET_TIMEOUT_MS passes, so requests in
+ * flight hold no process; the blocking calls start one and join it.
+ * net_lock serialises the stack between the two sides; it is taken with
+ * interrupts off so a holder is never preempted by a waiter.
  */
 
 #include <kernel/types.h>
 #include <kernel/net.h>
+#include <kernel/wait.h>
+#include <kernel/workqueue.h>
+#include <kernel/async.h>
+
+#define NET_TIMEOUT_MS 1000
+
+static struct wait_queue net_rx_wait = WAIT_QUEUE_INIT;
+static spinlock_t net_lock;
+static void net_rx(struct work *w);
+static struct work net_rx_work = WORK_INIT(net_rx);
 
 extern void ipv4_input(const uint8_t *pkt, int len);
 extern int loopback_fetch(uint8_t *out, int max);
+extern bool loopback_pending(void);
 extern void loopback_clear(void);
 extern void icmp_send_echo_request(uint32_t dst);
 extern void net_icmp_clear_reply(void);
 extern int net_icmp_reply_count(void);
 extern void tcp_init(void);
+extern void tcp_timers(void);
 extern void tcp_reset(void);
 extern int tcp_connect_send_get(uint32_t ip);
 extern int tcp_send_data(const uint8_t *data, int len);
@@ -22,8 +42,41 @@ void net_poll(void)
 {
     uint8_t buf[2048];
     int n;
+    uint64_t flags = spin_lock_irqsave(&net_lock);
     while ((n = loopback_fetch(buf, (int)sizeof(buf))) > 0)
         ipv4_input(buf, n);
+    tcp_timers();
+    spin_unlock_irqrestore(&net_lock, flags);
+}
+
+static void net_rx(struct work *w)
+{
+    (void)w;
+    net_poll();
+    wake_up(&net_rx_wait);
+}
+
+void net_rx_kick(void)
+{
+    schedule_work(&net_rx_work);
+}
+
+static bool ping_replied(void)
+{
+    return net_icmp_reply_count() > 0;
+}
+
+/* Everything sent so far has been processed (the handshake has settled).
+ * The loopback queue is lock-free to peek at; a net_poll still busy with
+ * the last packet finishes before the caller gets net_lock. */
+static bool rx_idle(void)
+{
+    return !loopback_pending();
+}
+
+static bool http_received(void)
+{
+    return tcp_client_rx_len() > 0;
 }
 
 void net_init(void)
@@ -33,33 +86,44 @@ void net_init(void)
     tcp_init();
 }
 
-int net_ping(uint32_t dst)
+struct ping_task {
+    struct async_task task;       /* first: the executor's pointer casts back */
+    uint32_t dst;
+};
+
+static int ping_fn(struct async_task *t)
 {
+    struct ping_task *pt = (struct ping_task *)t;
+    ASYNC_BEGIN(t);
+    uint64_t flags = spin_lock_irqsave(&net_lock);
     net_icmp_clear_reply();
-    icmp_send_echo_request(dst);
-    for (int i = 0; i < 8000; i++)
-        net_poll();
-    return net_icmp_reply_count() > 0 ? 0 : -1;
+    icmp_send_echo_request(pt->dst);
+    spin_unlock_irqrestore(&net_lock, flags);
+    async_wait_event_timeout(t, net_rx_wait, ping_replied(), NET_TIMEOUT_MS);
+    ASYNC_END(t, ping_replied() ? 0 : -1);
 }
 
-int net_http_get_loopback(char *out, size_t max_out)
+int net_ping(uint32_t dst)
 {
-    if (!out || max_out < 2)
-        return -1;
-    tcp_reset();
-    tcp_connect_send_get(NET_IPV4_LOOPBACK);
-    for (int i = 0; i < 8000; i++)
-        net_poll();
-    static const char req[] = "GET / HTTP/1.0\r\nHost: 127.0.0.1\r\n\r\n";
-    if (tcp_send_data((const uint8_t *)req, (int)sizeof(req) - 1) != 0) {
-        out[0] = '\0';
-        return -1;
-    }
-    for (int i = 0; i < 8000; i++)
-        net_poll();
+    struct ping_task pt = { .dst = dst };
+    async_start(&pt.task, ping_fn, NULL);
+    return async_join(&pt.task);
+}
+
+struct http_task {
+    struct async_task task;
+    char *out;
+    size_t max_out;
+};
+
+/* Copy the body of the reply (after the blank line) to h->out. */
+static int http_copy_body(struct http_task *h)
+{
+    uint64_t flags = spin_lock_irqsave(&net_lock);
     int n = tcp_client_rx_len();
     if (n <= 0) {
-        out[0] = '\0';
+        spin_unlock_irqrestore(&net_lock, flags);
+        h->out[0] = '\0';
         return -1;
     }
     const uint8_t *rx = tcp_client_rx_buf();
@@ -71,8 +135,40 @@ int net_http_get_loopback(char *out, size_t max_out)
         }
     }
     int j = 0;
-    for (int i = body; i < n && j < (int)max_out - 1; i++)
-        out[j++] = (char)rx[i];
-    out[j] = '\0';
+    for (int i = body; i < n && j < (int)h->max_out - 1; i++)
+        h->out[j++] = (char)rx[i];
+    spin_unlock_irqrestore(&net_lock, flags);
+    h->out[j] = '\0';
     return j;
 }
+
+static int http_get_fn(struct async_task *t)
+{
+    struct http_task *h = (struct http_task *)t;
+    static const char req[] = "GET / HTTP/1.0\r\nHost: 127.0.0.1\r\n\r\n";
+    uint64_t flags;
+    ASYNC_BEGIN(t);
+    flags = spin_lock_irqsave(&net_lock);
+    tcp_reset();
+    tcp_connect_send_get(NET_IPV4_LOOPBACK);
+    spin_unlock_irqrestore(&net_lock, flags);
+    async_wait_event_timeout(t, net_rx_wait, rx_idle(), NET_TIMEOUT_MS);
+    flags = spin_lock_irqsave(&net_lock);
+    int sent = tcp_send_data((const uint8_t *)req, (int)sizeof(req) - 1);
+    spin_unlock_irqrestore(&net_lock, flags);
+    if (sent != 0) {
+        h->out[0] = '\0';
+        ASYNC_END(t, -1);
+    }
+    async_wait_event_timeout(t, net_rx_wait, http_received(), NET_TIMEOUT_MS);
+    ASYNC_END(t, http_copy_body(h));
+}
+
+int net_http_get_loopback(char *out, size_t max_out)
+{
+    if (!out || max_out < 2)
+        return -1;
+    struct http_task h = { .out = out, .max_out = max_out };
+    async_start(&h.task, http_get_fn, NULL);
+    return async_join(&h.task);
+}
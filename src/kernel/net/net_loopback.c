@@ -1,40 +1,58 @@
 /**
- * Loopback NIC: queues IPv4 datagrams for net_poll().
+ * Loopback NIC: queues IPv4 datagrams for net_poll() and kicks the net RX work.
+ * The queue is an SPSC ring (spsc_ring.h) filled and drained in place.
+ * Everything that transmits holds net_lock, and so does net_poll, the
+ * only consumer; loopback_pending needs no lock at all.
  */
 
 #include <kernel/types.h>
+#include <kernel/spsc_ring.h>
+
+extern void net_rx_kick(void);
 
 #define LB_Q 16
 #define LB_MTU 2048
 
-static uint8_t lb_buf[LB_Q][LB_MTU];
-static int lb_len[LB_Q];
-static int lb_head, lb_tail;
+struct lb_pkt {
+    int len;
+    uint8_t data[LB_MTU];
+};
+
+SPSC_RING(lb_ring, struct lb_pkt, LB_Q)
+
+static struct lb_ring lb;
 
 void loopback_xmit(const uint8_t *ip, int len)
 {
     if (len <= 0 || len > LB_MTU) return;
-    int next = (lb_tail + 1) % LB_Q;
-    if (next == lb_head)
+    struct lb_pkt *pkt = lb_ring_slot(&lb);
+    if (!pkt)
         return;
     for (int i = 0; i < len; i++)
-        lb_buf[lb_tail][i] = ip[i];
-    lb_len[lb_tail] = len;
-    lb_tail = next;
+        pkt->data[i] = ip[i];
+    pkt->len = len;
+    lb_ring_publish(&lb);
+    net_rx_kick();
+}
+
+bool loopback_pending(void)
+{
+    return lb_ring_count(&lb) != 0;
 }
 
 int loopback_fetch(uint8_t *out, int max)
 {
-    if (lb_head == lb_tail) return 0;
-    int n = lb_len[lb_head];
+    struct lb_pkt *pkt = lb_ring_peek(&lb);
+    if (!pkt) return 0;
+    int n = pkt->len;
     if (n > max) n = max;
     for (int i = 0; i < n; i++)
-        out[i] = lb_buf[lb_head][i];
-    lb_head = (lb_head + 1) % LB_Q;
+        out[i] = pkt->data[i];
+    lb_ring_consume(&lb);
     return n;
 }
 
 void loopback_clear(void)
 {
-    lb_head = lb_tail = 0;
+    lb_ring_drain(&lb);
 }
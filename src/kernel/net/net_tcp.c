@@ -1,9 +1,13 @@
 /**
  * Minimal TCP: one passive (port 80) and one active (ephemeral) for loopback HTTP.
+ * The client keeps its last unacknowledged segment (SYN or request) and a
+ * retransmission timer on the timer wheel; when it fires, net_poll resends
+ * with the timeout doubled, giving up after TCP_MAX_RETRIES.
  */
 
 #include <kernel/types.h>
 #include <kernel/net.h>
+#include <kernel/timer.h>
 
 uint16_t net_checksum16(const void *data, int len);
 void ipv4_output(uint8_t proto, uint32_t src, uint32_t dst, const uint8_t *payload, int payload_len);
@@ -25,6 +29,12 @@ void ipv4_output(uint8_t proto, uint32_t src, uint32_t dst, const uint8_t *paylo
 #define ST_SYN_RCVD 3
 #define ST_ESTABLISHED 4
 
+#define TCP_RTO_MS      200   /* first retransmission timeout */
+#define TCP_MAX_RETRIES 5
+#define TCP_MSS         1260  /* largest payload: tcp_send_flags' buffer less the header */
+
+extern void net_rx_kick(void);
+
 typedef struct {
     int state;
     uint16_t local_port;
@@ -34,6 +44,14 @@ typedef struct {
     uint32_t rcv_nxt;
     uint8_t rx[4096];
     int rx_len;
+    uint8_t rtx_flags;            /* 0: nothing to retransmit */
+    uint32_t rtx_seq;
+    uint8_t rtx_data[TCP_MSS];    /* the whole segment, so a resend is identical */
+    int rtx_len;
+    int retries;
+    uint32_t rto_ms;
+    struct timer rtx_timer;
+    volatile bool rtx_due;        /* set by the timer, handled by tcp_timers */
 } Tcb;
 
 static Tcb srv, cli;
@@ -71,7 +89,7 @@ static uint16_t tcp_cksum(uint32_t saddr, uint32_t daddr, const uint8_t *tcp, in
 static void tcp_send_flags(uint32_t src_ip, uint32_t dst_ip, uint16_t sport, uint16_t dport,
                            uint32_t seq, uint32_t ack, uint8_t flags, const uint8_t *data, int dlen)
 {
-    uint8_t seg[1280];
+    uint8_t seg[20 + TCP_MSS];
     int hl = 20;
     int total = hl + dlen;
     wr16(seg + 0, sport);
@@ -101,8 +119,56 @@ static void tcp_send_rst(uint32_t src_ip, uint32_t dst_ip, uint16_t sport, uint1
     tcp_send_flags(src_ip, dst_ip, sport, dport, seq, ack, TCP_RST, NULL, 0);
 }
 
+static void rtx_fire(void *arg)
+{
+    Tcb *t = arg;
+    t->rtx_due = true;
+    net_rx_kick();
+}
+
+/* Remember a client segment until it is acknowledged. */
+static void rtx_start(Tcb *t, uint8_t flags, uint32_t seq, const uint8_t *data, int len)
+{
+    t->rtx_flags = flags;
+    t->rtx_seq = seq;
+    for (int i = 0; i < len; i++)
+        t->rtx_data[i] = data[i];
+    t->rtx_len = len;
+    t->retries = 0;
+    t->rto_ms = TCP_RTO_MS;
+    t->rtx_due = false;
+    timer_add(&t->rtx_timer, timer_get_ms() + t->rto_ms, rtx_fire, t);
+}
+
+static void rtx_stop(Tcb *t)
+{
+    timer_cancel(&t->rtx_timer);
+    t->rtx_flags = 0;
+    t->rtx_due = false;
+}
+
+/* Called from net_poll: resend what timed out. */
+void tcp_timers(void)
+{
+    if (!cli.rtx_due) return;
+    cli.rtx_due = false;
+    if (!cli.rtx_flags) return;
+    if (++cli.retries > TCP_MAX_RETRIES) {
+        rtx_stop(&cli);
+        cli.state = ST_CLOSED;
+        return;
+    }
+    uint32_t loop = NET_IPV4_LOOPBACK;
+    uint32_t ack = (cli.rtx_flags & TCP_SYN) ? 0 : cli.rcv_nxt;
+    tcp_send_flags(loop, loop, CLI_PORT, SRV_PORT, cli.rtx_seq, ack, cli.rtx_flags,
+                   cli.rtx_data, cli.rtx_len);
+    cli.rto_ms *= 2;
+    timer_add(&cli.rtx_timer, timer_get_ms() + cli.rto_ms, rtx_fire, &cli);
+}
+
 void tcp_init(void)
 {
+    rtx_stop(&cli);
     srv.state = ST_LISTEN;
     srv.local_port = SRV_PORT;
     cli.state = ST_CLOSED;
@@ -162,12 +228,19 @@ void tcp_ipv4_input(const uint8_t *pkt, int len, uint32_t src, uint32_t dst)
 
     /* Client: dst ephemeral */
     if (dport == CLI_PORT && cli.state == ST_SYN_SENT && (fl & TCP_SYN) && (fl & TCP_ACK)) {
+        rtx_stop(&cli);
+        cli.snd_una = ack;
         cli.rcv_nxt = seq + 1;
         cli.snd_nxt = ack;
         tcp_send_flags(dst, src, CLI_PORT, sport, cli.snd_nxt, cli.rcv_nxt, TCP_ACK, NULL, 0);
         cli.state = ST_ESTABLISHED;
         return;
     }
+    if (dport == CLI_PORT && cli.state == ST_ESTABLISHED && (fl & TCP_ACK) &&
+        (int32_t)(ack - cli.snd_una) > 0) {
+        cli.snd_una = ack;
+        if (cli.rtx_flags && (int32_t)(ack - cli.snd_nxt) >= 0) rtx_stop(&cli);
+    }
     if (dport == CLI_PORT && cli.state == ST_ESTABLISHED && (fl & TCP_PSH)) {
         /* Response data */
         if (plen + cli.rx_len < (int)sizeof(cli.rx)) {
@@ -204,6 +277,7 @@ int tcp_connect_send_get(uint32_t ip)
     srv.state = ST_LISTEN;
     srv.rx_len = 0;
     tcp_send_flags(loop, loop, CLI_PORT, SRV_PORT, cli.iss, 0, TCP_SYN, NULL, 0);
+    rtx_start(&cli, TCP_SYN, cli.iss, NULL, 0);
     return 0;
 }
 
@@ -211,7 +285,9 @@ int tcp_send_data(const uint8_t *data, int len)
 {
     uint32_t loop = NET_IPV4_LOOPBACK;
     if (cli.state != ST_ESTABLISHED) return -1;
+    if (len < 0 || len > TCP_MSS) return -1;     /* one segment, kept whole for resending */
     tcp_send_flags(loop, loop, CLI_PORT, SRV_PORT, cli.snd_nxt, cli.rcv_nxt, TCP_ACK | TCP_PSH, data, len);
+    rtx_start(&cli, TCP_ACK | TCP_PSH, cli.snd_nxt, data, len);
     cli.snd_nxt += (uint32_t)len;
     return 0;
 }
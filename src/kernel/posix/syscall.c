@@ -0,0 +1,134 @@
+/**
+ * System call table: the posix.c API for ring-3 processes, plus process
+ * control. User pointers are checked against the caller's address space
+ * (paging_user_ok) before the kernel touches them and paths are copied in,
+ * so a bad pointer fails the call with -EFAULT instead of faulting in the
+ * kernel. posix.c reports errors as -1 plus a negative errno; here they
+ * become the return value.
+ */
+
+#include <kernel/syscall.h>
+#include <kernel/posix.h>
+#include <kernel/process.h>
+#include <kernel/paging.h>
+#include <kernel/mm.h>
+#include <kernel/fs.h>
+#include <kernel/types.h>
+
+#define EFAULT        14
+#define ENAMETOOLONG  36
+
+#define SYSCALL(name) static int64_t name(uint64_t a0 __attribute__((unused)), \
+                                          uint64_t a1 __attribute__((unused)), \
+                                          uint64_t a2 __attribute__((unused)))
+
+static int64_t result(int64_t r)
+{
+    return r < 0 ? (errno ? errno : -1) : r;
+}
+
+static bool user_ok(uint64_t addr, size_t size, bool write)
+{
+    return paging_user_ok(process_current()->pml4, addr, size, write);
+}
+
+/* Copy the NUL-terminated user string at addr into buf[FS_PATH_MAX]. */
+static int64_t copy_path(uint64_t addr, char *buf)
+{
+    const char *s = (const char *)(uintptr_t)addr;
+    for (size_t i = 0; i < FS_PATH_MAX; i++) {
+        if ((i == 0 || ((addr + i) & (PAGE_SIZE - 1)) == 0) && !user_ok(addr + i, 1, false))
+            return -EFAULT;
+        if (!(buf[i] = s[i])) return 0;
+    }
+    return -ENAMETOOLONG;
+}
+
+SYSCALL(sys_read)
+{
+    if (!user_ok(a1, a2, true)) return -EFAULT;
+    return result(read((int)a0, (void *)(uintptr_t)a1, a2));
+}
+
+SYSCALL(sys_write)
+{
+    if (!user_ok(a1, a2, false)) return -EFAULT;
+    return result(write((int)a0, (const void *)(uintptr_t)a1, a2));
+}
+
+SYSCALL(sys_open)
+{
+    char path[FS_PATH_MAX];
+    int64_t r = copy_path(a0, path);
+    return r < 0 ? r : result(open(path, (int)a1));
+}
+
+SYSCALL(sys_close)
+{
+    return result(close((int)a0));
+}
+
+SYSCALL(sys_lseek)
+{
+    return result(lseek((int)a0, (off_t)a1, (int)a2));
+}
+
+SYSCALL(sys_getcwd)
+{
+    if (!user_ok(a0, a1, true)) return -EFAULT;
+    return result(getcwd((char *)(uintptr_t)a0, a1));
+}
+
+SYSCALL(sys_chdir)
+{
+    char path[FS_PATH_MAX];
+    int64_t r = copy_path(a0, path);
+    return r < 0 ? r : result(chdir(path));
+}
+
+SYSCALL(sys_mkdir)
+{
+    char path[FS_PATH_MAX];
+    int64_t r = copy_path(a0, path);
+    return r < 0 ? r : result(mkdir(path));
+}
+
+SYSCALL(sys_stat)
+{
+    char path[FS_PATH_MAX];
+    int64_t r = copy_path(a0, path);
+    if (r < 0) return r;
+    if (!user_ok(a1, sizeof(struct stat), true)) return -EFAULT;
+    return result(stat(path, (struct stat *)(uintptr_t)a1));
+}
+
+SYSCALL(sys_exit)
+{
+    process_exit((int)a0);
+}
+
+SYSCALL(sys_yield)
+{
+    process_yield();
+    return 0;
+}
+
+SYSCALL(sys_getpid)
+{
+    return (int64_t)process_current()->pid;
+}
+
+const syscall_fn syscall_table[SYS_COUNT] = {
+    [SYS_READ]   = sys_read,
+    [SYS_WRITE]  = sys_write,
+    [SYS_OPEN]   = sys_open,
+    [SYS_CLOSE]  = sys_close,
+    [SYS_LSEEK]  = sys_lseek,
+    [SYS_GETCWD] = sys_getcwd,
+    [SYS_CHDIR]  = sys_chdir,
+    [SYS_MKDIR]  = sys_mkdir,
+    [SYS_STAT]   = sys_stat,
+    [SYS_EXIT]   = sys_exit,
+    [SYS_YIELD]  = sys_yield,
+    [SYS_GETPID] = sys_getpid,
+};
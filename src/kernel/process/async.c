@@ -0,0 +1,144 @@
+/**
+ * Async task executor: one ready queue per CPU, drained by SOFTIRQ_ASYNC.
+ * async_wake queues a task on the calling CPU and raises the softirq; from
+ * process context it also sends itself IPI_RESCHEDULE, since the next
+ * interrupt (and with it the softirq) could otherwise be a whole slice or,
+ * on an idle tickless CPU, forever away. The task state is a small CAS
+ * machine so that a wake-up racing with a poll is never lost: a task woken
+ * while it runs is marked ASYNC_WOKEN and polled again instead of going
+ * idle. Each softirq run polls at most ASYNC_BUDGET tasks and leaves the
+ * rest for the next one, so a burst of tasks cannot hold off processes.
+ */
+
+#include <kernel/async.h>
+#include <kernel/smp.h>
+#include <kernel/softirq.h>
+#include <kernel/lapic.h>
+#include <kernel/irq.h>
+#include <kernel/cpu.h>
+#include <kernel/types.h>
+
+#define ASYNC_BUDGET 64
+
+/* Interrupts off. */
+static void enqueue(struct cpu *c, struct async_task *t)
+{
+    spin_lock(&c->async_lock);
+    t->next = NULL;
+    if (c->async_tail) c->async_tail->next = t;
+    else c->async_head = t;
+    c->async_tail = t;
+    spin_unlock(&c->async_lock);
+    softirq_raise(SOFTIRQ_ASYNC);
+}
+
+static struct async_task *dequeue(struct cpu *c)
+{
+    uint64_t flags = spin_lock_irqsave(&c->async_lock);
+    struct async_task *t = c->async_head;
+    if (t) {
+        c->async_head = t->next;
+        if (!c->async_head) c->async_tail = NULL;
+        t->next = NULL;
+    }
+    spin_unlock_irqrestore(&c->async_lock, flags);
+    return t;
+}
+
+static void queue_here(struct async_task *t)
+{
+    uint64_t flags = irq_save();
+    struct cpu *c = this_cpu();
+    enqueue(c, t);
+    if (!in_interrupt() && lapic_present()) lapic_send_ipi(c->apic_id, IPI_RESCHEDULE);
+    irq_restore(flags);
+}
+
+void async_start(struct async_task *t, async_fn fn, void (*on_done)(struct async_task *t))
+{
+    t->fn = fn;
+    t->resume = NULL;
+    t->result = 0;
+    t->waiting = NULL;
+    t->wait_next = NULL;
+    t->deadline = 0;
+    t->timer = (struct timer){ 0 };
+    wait_queue_init(&t->join_wait);
+    t->on_done = on_done;
+    __atomic_store_n(&t->state, ASYNC_QUEUED, __ATOMIC_RELEASE);
+    queue_here(t);
+}
+
+void async_wake(struct async_task *t)
+{
+    uint32_t s = __atomic_load_n(&t->state, __ATOMIC_ACQUIRE);
+    for (;;) {
+        if (s == ASYNC_IDLE) {
+            if (__atomic_compare_exchange_n(&t->state, &s, ASYNC_QUEUED, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                queue_here(t);
+                return;
+            }
+        } else if (s == ASYNC_RUNNING) {
+            if (__atomic_compare_exchange_n(&t->state, &s, ASYNC_WOKEN, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return;
+        } else {
+            return;                /* queued, already woken or finished */
+        }
+    }
+}
+
+static void finish(struct async_task *t)
+{
+    void (*on_done)(struct async_task *) = t->on_done;
+    __atomic_store_n(&t->state, ASYNC_FINISHED, __ATOMIC_RELEASE);
+    wake_up(&t->join_wait);
+    __atomic_store_n(&t->state, ASYNC_RELEASED, __ATOMIC_RELEASE);
+    if (on_done) on_done(t);
+}
+
+static void poll(struct cpu *c, struct async_task *t)
+{
+    __atomic_store_n(&t->state, ASYNC_RUNNING, __ATOMIC_RELEASE);
+    c->async_polls++;
+    if (t->fn(t) == ASYNC_DONE) {
+        finish(t);
+        return;
+    }
+    uint32_t s = ASYNC_RUNNING;
+    if (__atomic_compare_exchange_n(&t->state, &s, ASYNC_IDLE, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+    /* Woken while it ran: whatever it waited for may already be there. */
+    __atomic_store_n(&t->state, ASYNC_QUEUED, __ATOMIC_RELEASE);
+    uint64_t flags = irq_save();
+    enqueue(c, t);
+    irq_restore(flags);
+}
+
+void async_softirq(void)
+{
+    struct cpu *c = this_cpu();
+    struct async_task *t;
+    for (int n = 0; n < ASYNC_BUDGET; n++) {
+        if ((t = dequeue(c)) == NULL) return;
+        poll(c, t);
+    }
+    uint64_t flags = irq_save();
+    if (c->async_head) softirq_raise(SOFTIRQ_ASYNC);
+    irq_restore(flags);
+}
+
+bool async_done(const struct async_task *t)
+{
+    return __atomic_load_n(&t->state, __ATOMIC_ACQUIRE) >= ASYNC_FINISHED;
+}
+
+int async_join(struct async_task *t)
+{
+    wait_event(t->join_wait, async_done(t));
+    /* The executor may still be inside wake_up(&t->join_wait). */
+    while (__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) != ASYNC_RELEASED) cpu_relax();
+    return t->result;
+}
@@ -1,130 +1,723 @@
 /**
- * Process table and round-robin scheduler.
- * Each process has a kernel stack; context is saved on stack during interrupt.
+ * Process table and per-CPU multilevel feedback queue scheduler.
+ * Each CPU (smp.h struct cpu) has one Chase-Lev deque (wsdeque.c) per
+ * priority level and a bitmap of the non-empty ones, so pick-next is a bit
+ * scan plus one CAS. Levels are round-robin; lower levels get longer slices.
+ * A process that uses up its slice drops a level, and once a second every
+ * queued process goes back to its base level so nothing starves. The idle
+ * process is never queued and runs only when all levels are empty. Blocked
+ * processes (wait.c) are on no run queue at all; process_wake requeues them
+ * one level up, so threads that sleep before their slice ends rise again.
+ * A CPU whose queues are empty
+ * steals from the busiest other CPU, unless the process it would take is
+ * still cache-hot there and balancing has not already failed a few times.
+ * A CPU running a process arms its local APIC timer for the end of the time
+ * slice; an idle CPU arms nothing and sleeps until a CPU with surplus work
+ * kicks it with IPI_RESCHEDULE (tickless idle). Without a local APIC the
+ * PIT tick drives the scheduler instead. Each
+ * process has a guard-paged kernel stack (mm/kstack.c); context is saved on
+ * that stack during interrupt.
+ * PCBs come from a slab cache and are linked into the process table. A
+ * process that exits is switched away from for good; scheduler_switch_done
+ * hands it to the reaper (a work item on system_wq), which returns its stack
+ * to the kstack pool (no unmapping, so the next process_create reuses it
+ * warm) and frees the PCB once it is also joined or detached.
+ * The scheduler never switches away from softirq handlers: entered during
+ * them, it only notes need_resched, and irq_exit calls it back afterwards.
+ * Ring-3 processes have their own page tables (p->pml4), loaded by the
+ * switch; their kernel stack top goes into the TSS (interrupts) and the
+ * per-CPU syscall_rsp (SYSCALL), and they run in kernel mode on it.
  */
 
 #include <kernel/process.h>
 #include <kernel/mm.h>
 #include <kernel/irq.h>
+#include <kernel/fpu.h>
+#include <kernel/lapic.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
 #include <kernel/timer.h>
+#include <kernel/softirq.h>
+#include <kernel/workqueue.h>
+#include <kernel/paging.h>
+#include <kernel/syscall.h>
+#include <kernel/gdt.h>
+#include <kernel/vclock.h>
 #include <kernel/types.h>
 
 #define STACK_ALIGN 16
 
-static struct process processes[MAX_PROCESSES];
-static size_t process_count;
-static struct process *current_process;
-static struct process *run_list;   /* circular list of runnable processes */
+#define SCHED_MIGRATE_HOT_MS    30   /* switched out this recently: cache still warm */
+#define SCHED_CACHE_NICE_TRIES  2    /* hot skips before stealing anyway */
+#define SCHED_STEAL_IMBALANCE   2    /* victim load - own load needed to steal */
+#define SCHED_SLICE_MS          10   /* levels 0-1; doubles every two levels */
+#define SCHED_BOOST_MS          1000 /* reset everyone to their base level */
+#define SCHED_LOAD_PERIOD_MS    10   /* load_avg decay step */
+
+static struct kmem_cache *process_cache;
+static struct process *all_processes;
+static uint32_t nr_processes;     /* idle processes excluded */
 static uint64_t next_pid;
+static spinlock_t table_lock;
+
+/* Exited processes still on their kernel stacks, for the reaper. */
+static struct process *reap_list;
+static spinlock_t reap_lock;
+static void reap(struct work *w);
+static struct work reap_work = WORK_INIT(reap);
 
 static void idle_loop(void)
 {
     for (;;) __asm__ volatile ("hlt");
 }
 
-static struct process *alloc_process(void)
+static struct process *alloc_process(bool idle)
+{
+    struct process *p = kmem_cache_alloc(process_cache);
+    if (!p) return NULL;
+    uint64_t *w = (uint64_t *)p;
+    for (size_t i = 0; i < sizeof(*p) / sizeof(uint64_t); i++) w[i] = 0;
+    p->refs = 2;
+    wait_queue_init(&p->exit_wait);
+    uint64_t flags = spin_lock_irqsave(&table_lock);
+    p->pid = next_pid++;
+    p->all_next = all_processes;
+    if (all_processes) all_processes->all_prev = p;
+    all_processes = p;
+    if (!idle) nr_processes++;
+    spin_unlock_irqrestore(&table_lock, flags);
+    return p;
+}
+
+static void free_process(struct process *p)
+{
+    uint64_t flags = spin_lock_irqsave(&table_lock);
+    if (p->all_prev) p->all_prev->all_next = p->all_next;
+    else all_processes = p->all_next;
+    if (p->all_next) p->all_next->all_prev = p->all_prev;
+    nr_processes--;
+    spin_unlock_irqrestore(&table_lock, flags);
+    kmem_cache_free(process_cache, p);
+}
+
+static void put_process(struct process *p)
+{
+    if (__atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL) == 0) free_process(p);
+}
+
+uint32_t process_count(void)
+{
+    return __atomic_load_n(&nr_processes, __ATOMIC_RELAXED);
+}
+
+struct process *process_current(void)
+{
+    return this_cpu()->current;
+}
+
+uint32_t scheduler_queued(const struct cpu *c)
+{
+    uint32_t n = 0;
+    for (int l = 0; l < SCHED_LEVELS; l++) n += (uint32_t)ws_size(&c->rq[l]);
+    return n + __atomic_load_n(&c->rq_overflow_n, __ATOMIC_RELAXED);
+}
+
+uint32_t scheduler_load(const struct cpu *c)
+{
+    return scheduler_queued(c) + (c->current && c->current != c->idle);
+}
+
+static uint32_t slice_ms(int level)
+{
+    return SCHED_SLICE_MS << (level >> 1);
+}
+
+/* Highest-priority level that may have work (bits are cleared lazily). */
+static int top_level(const struct cpu *c)
+{
+    uint32_t bits = __atomic_load_n(&c->rq_bitmap, __ATOMIC_RELAXED);
+    return bits ? __builtin_ctz(bits) : -1;
+}
+
+/* Reached by entry's ret, so the stack is 8 bytes off the ABI alignment. */
+__attribute__((force_align_arg_pointer)) static void process_return(void)
+{
+    process_exit(0);
+}
+
+static uint64_t kstack_top(const struct process *p)
+{
+    return (uint64_t)(uintptr_t)(p->kernel_stack + PROCESS_STACK_SIZE) & ~(uint64_t)(STACK_ALIGN - 1);
+}
+
+/* entry is started by iretq, with arg in rdi; in ring 3 on user_rsp if
+ * that is set. */
+static void process_setup_stack(struct process *p, uintptr_t entry, void *arg, uint64_t user_rsp)
+{
+    uint64_t *sp = (uint64_t *)(uintptr_t)kstack_top(p);
+    /* Layout (low to high): r15..rbp and process_start, popped by
+     * context_switch; then r15..rax, vector, rip, cs, rflags, rsp, ss, which
+     * process_start pops before its iretq. Both variants keep the same number
+     * of qwords above the frame, so process_start calls C with rsp 16-byte
+     * aligned. */
+    if (user_rsp) {
+        *--sp = 0;                              /* pad: same parity as process_return */
+        *--sp = USER_SS;
+        *--sp = user_rsp;
+    } else {
+        *--sp = (uint64_t)process_return;       /* entry returns into process_exit(0) */
+        uint64_t entry_rsp = (uint64_t)sp;
+        *--sp = GDT_KERNEL_DATA;                /* ss */
+        *--sp = entry_rsp;                      /* rsp */
+    }
+    *--sp = 0x202;                              /* rflags */
+    *--sp = user_rsp ? USER_CS : GDT_KERNEL_CODE;   /* cs */
+    *--sp = (uint64_t)entry;                    /* rip */
+    *--sp = 32;                                 /* vector */
+    for (int i = 0; i < 15; i++)                /* rax..r15; rdi is the 6th */
+        *--sp = i == 5 ? (uint64_t)arg : 0;
+    *--sp = (uint64_t)process_start;
+    for (int i = 0; i < 6; i++) *--sp = 0;      /* rbp, rbx, r12..r15 */
+    p->saved_rsp = (uint64_t)sp;
+}
+
+static int rq_enqueue(struct cpu *c, struct process *p)
+{
+    if (ws_push(&c->rq[p->level], p) != 0) return -1;
+    __atomic_or_fetch(&c->rq_bitmap, 1u << p->level, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Queue p on c, or behind c's overflow list if its deque is full (or others
+ * already wait there, to keep FIFO order). Owner only, interrupts off. */
+static void rq_add(struct cpu *c, struct process *p)
+{
+    if (!c->rq_overflow && rq_enqueue(c, p) == 0) return;
+    p->rq_next = NULL;
+    if (c->rq_overflow_tail) c->rq_overflow_tail->rq_next = p;
+    else c->rq_overflow = p;
+    c->rq_overflow_tail = p;
+    __atomic_add_fetch(&c->rq_overflow_n, 1, __ATOMIC_RELAXED);
+}
+
+/* Move overflowed processes into the deques while there is room. */
+static void rq_refill(struct cpu *c)
+{
+    struct process *p;
+    while ((p = c->rq_overflow) != NULL && rq_enqueue(c, p) == 0) {
+        c->rq_overflow = p->rq_next;
+        if (!c->rq_overflow) c->rq_overflow_tail = NULL;
+        p->rq_next = NULL;
+        __atomic_sub_fetch(&c->rq_overflow_n, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Run the scheduler on c as soon as interrupts are back on. */
+static void resched_self(struct cpu *c)
+{
+    if (c->current) lapic_send_ipi(c->apic_id, IPI_RESCHEDULE);
+}
+
+/* Queue p on c (the calling CPU) and wake one idle CPU to steal it. Until c
+ * runs its scheduler (BSP during boot) the work stays put. */
+static void rq_push(struct cpu *c, struct process *p)
+{
+    rq_add(c, p);
+    if (!c->current) return;
+    struct cpu *v;
+    for (int i = 0; (v = smp_cpu(i)) != NULL; i++) {
+        if (v != c && v->current == v->idle) {
+            lapic_send_ipi(v->apic_id, IPI_RESCHEDULE);
+            return;
+        }
+    }
+}
+
+static struct process *new_process(uintptr_t entry, void *arg, uint64_t user_rsp, bool idle)
+{
+    struct process *p = alloc_process(idle);
+    if (!p) return NULL;
+    p->kernel_stack = (uint8_t *)kstack_alloc();
+    if (!p->kernel_stack) {
+        p->refs = 1;
+        put_process(p);
+        return NULL;
+    }
+    p->state = PROC_RUNNABLE;
+    p->base_level = p->level = SCHED_PRIO_NORMAL;
+    process_setup_stack(p, entry, arg, user_rsp);
+    return p;
+}
+
+static void reap(struct work *w)
 {
-    if (process_count >= MAX_PROCESSES) return NULL;
-    return &processes[process_count++];
+    (void)w;
+    uint64_t flags = spin_lock_irqsave(&reap_lock);
+    struct process *p = reap_list;
+    reap_list = NULL;
+    spin_unlock_irqrestore(&reap_lock, flags);
+    while (p) {
+        struct process *next = p->reap_next;
+        kstack_free(p->kernel_stack);
+        p->kernel_stack = NULL;
+        fpu_free(p);
+        if (p->pml4) paging_space_destroy(p->pml4);
+        p->pml4 = NULL;
+        __atomic_store_n(&p->state, PROC_DEAD, __ATOMIC_RELEASE);
+        wake_up(&p->exit_wait);
+        put_process(p);
+        p = next;
+    }
 }
 
 void process_init(void)
 {
-    process_count = 0;
-    current_process = NULL;
-    run_list = NULL;
     next_pid = 1;
-    process_create(idle_loop);
+    process_cache = kmem_cache_create("process", sizeof(struct process), 0);
+    struct cpu *c = this_cpu();
+    c->idle = new_process((uintptr_t)idle_loop, NULL, 0, true);
+    if (c->idle) {
+        c->idle->cpu = c;
+        c->idle->name = "idle";
+    }
 }
 
-struct process *process_current(void)
+/* New processes start on the creating CPU; idle CPUs steal them from there. */
+static struct process *spawn(struct process *p, int level)
+{
+    if (!p) return NULL;
+    process_set_priority(p, level);
+    uint64_t flags = irq_save();
+    struct cpu *c = this_cpu();
+    p->cpu = c;
+    rq_push(c, p);
+    irq_restore(flags);
+    return p;
+}
+
+struct process *process_create_arg(void (*entry)(void *), void *arg, int level)
+{
+    return spawn(new_process((uintptr_t)entry, arg, 0, false), level);
+}
+
+struct process *process_create_prio(void (*entry)(void), int level)
+{
+    return spawn(new_process((uintptr_t)entry, NULL, 0, false), level);
+}
+
+/* The .user image and the clock page read-only, and a zeroed stack. */
+static uint64_t *user_space(void)
+{
+    uint64_t *pml4 = paging_space_create();
+    if (!pml4) return NULL;
+    size_t text = (size_t)(__user_end - __user_start);
+    if (paging_space_map(pml4, USER_TEXT_BASE, virt_to_phys(__user_start), text, PTE_USER) != 0
+        || paging_space_map(pml4, USER_VCLOCK_BASE, virt_to_phys(&vclock_page), PAGE_SIZE, PTE_USER) != 0
+        || paging_space_alloc(pml4, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_SIZE,
+                              PTE_USER | PTE_WRITE) != 0) {
+        paging_space_destroy(pml4);
+        return NULL;
+    }
+    return pml4;
+}
+
+struct process *process_create_user(const void *entry, uint64_t arg, int level)
 {
-    return current_process;
+    uint64_t *pml4 = user_space();
+    if (!pml4) return NULL;
+    uintptr_t rip = USER_TEXT_BASE + (uintptr_t)((const uint8_t *)entry - __user_start);
+    /* As if called: rsp + 8 is 16-byte aligned at entry. */
+    struct process *p = new_process(rip, (void *)(uintptr_t)arg, USER_STACK_TOP - 8, false);
+    if (!p) {
+        paging_space_destroy(pml4);
+        return NULL;
+    }
+    p->pml4 = pml4;
+    return spawn(p, level);
+}
+
+struct process *process_create(void (*entry)(void))
+{
+    return process_create_prio(entry, SCHED_PRIO_NORMAL);
+}
+
+void process_set_name(struct process *p, const char *name)
+{
+    p->name = name;
+}
+
+/* Takes effect the next time p is queued. */
+void process_set_priority(struct process *p, int level)
+{
+    if (level < 0) level = 0;
+    if (level >= SCHED_LEVELS) level = SCHED_LEVELS - 1;
+    p->base_level = p->level = level;
 }
 
-static void process_setup_stack(struct process *p, void (*entry)(void))
+void process_exit(int code)
 {
-    uint8_t *stack_top = p->kernel_stack + PROCESS_STACK_SIZE;
-    stack_top = (uint8_t *)((uintptr_t)stack_top & ~(STACK_ALIGN - 1));
-    /* Layout (low to high): rax..r15, vector, rip, cs, rflags, rsp, ss. iretq pops rip,cs,rflags,rsp,ss. */
-    stack_top -= 8 * 15;  /* space for rax..r15 */
-    uint8_t *saved = stack_top;
-    stack_top -= 8;
-    *(uint64_t *)stack_top = 32;                /* vector */
-    stack_top -= 8;
-    *(uint64_t *)stack_top = (uint64_t)entry;   /* rip */
-    stack_top -= 8;
-    *(uint64_t *)stack_top = 0x08;              /* cs */
-    stack_top -= 8;
-    *(uint64_t *)stack_top = 0x202;             /* rflags */
-    stack_top -= 8;
-    *(uint64_t *)stack_top = 0;                 /* rsp (dummy) */
-    stack_top -= 8;
-    *(uint64_t *)stack_top = 0x10;              /* ss */
-    for (int i = 0; i < 15; i++) *(uint64_t *)(saved + i * 8) = 0;
-    p->saved_rsp = (uint64_t)saved;
+    struct process *p = process_current();
+    __asm__ volatile ("cli");
+    p->exit_code = code;
+    __atomic_store_n(&p->state, PROC_ZOMBIE, __ATOMIC_SEQ_CST);
+    process_block();              /* scheduler_switch_done queues us for the reaper */
+    for (;;) __asm__ volatile ("hlt");
+}
+
+int process_join(struct process *p)
+{
+    wait_event(p->exit_wait, __atomic_load_n(&p->state, __ATOMIC_ACQUIRE) == PROC_DEAD);
+    int code = p->exit_code;
+    put_process(p);
+    return code;
+}
+
+void process_detach(struct process *p)
+{
+    put_process(p);
 }
 
-void process_create(void (*entry)(void))
+void process_adopt_idle(void)
 {
-    struct process *p = alloc_process();
+    struct cpu *c = this_cpu();
+    struct process *p = alloc_process(true);
     if (!p) return;
-    p->kernel_stack = (uint8_t *)kmalloc(PROCESS_STACK_SIZE);
-    if (!p->kernel_stack) return;
-    p->pid = next_pid++;
-    p->state = PROC_RUNNABLE;
-    p->next = NULL;
-    process_setup_stack(p, entry);
-    if (!run_list) {
-        run_list = p;
-        p->next = p;
-    } else {
-        p->next = run_list->next;
-        run_list->next = p;
-        run_list = p;
+    p->kernel_stack = NULL;        /* the AP boot stack, owned by smp.c */
+    p->state = PROC_RUNNING;
+    p->cpu = c;
+    p->name = "idle";
+    c->idle = p;
+    c->current = p;
+    c->acct_ms = timer_get_ms();
+    c->run_tsc = rdtsc();
+    c->run_irq_tsc = c->irq_tsc;
+}
+
+/* Oldest process of the highest non-empty level. Only a lost race with a
+ * thief makes us retry. Bits are set and cleared only here and in rq_enqueue,
+ * both on the owning CPU with interrupts off, so clearing cannot lose a push. */
+static struct process *take_own(struct cpu *c)
+{
+    int l;
+    rq_refill(c);
+    while ((l = top_level(c)) >= 0) {
+        struct process *p = ws_steal(&c->rq[l]);
+        if (p) return p;
+        if (ws_size(&c->rq[l]) == 0)
+            __atomic_and_fetch(&c->rq_bitmap, ~(1u << l), __ATOMIC_RELAXED);
     }
+    return NULL;
 }
 
-uint64_t scheduler_tick(uint64_t current_rsp)
+/* Periodic priority boost: requeue everything below its base level. */
+static void boost(struct cpu *c, uint32_t now)
 {
-    irq_eoi(0);  /* timer IRQ0 */
-    timer_tick();
-    if (!current_process) return current_rsp;
-    current_process->saved_rsp = current_rsp;
-    current_process->state = PROC_RUNNABLE;
-    struct process *next = current_process->next;
-    if (!next) return current_rsp;
-    current_process = next;
-    current_process->state = PROC_RUNNING;
-    return current_process->saved_rsp;
+    if ((int32_t)(now - c->next_boost_ms) < 0) return;
+    c->next_boost_ms = now + SCHED_BOOST_MS;
+    if (c->current) c->current->level = c->current->base_level;
+    for (int l = 1; l < SCHED_LEVELS; l++) {
+        for (int n = ws_size(&c->rq[l]); n > 0; n--) {
+            struct process *p = ws_steal(&c->rq[l]);
+            if (!p) break;
+            p->level = p->base_level;
+            rq_add(c, p);
+        }
+    }
+    for (struct process *p = c->rq_overflow; p; p = p->rq_next) p->level = p->base_level;
+    c->stats.boosts++;
 }
 
-void process_set_current(struct process *p)
+static bool can_migrate(struct cpu *self, const struct process *p)
 {
-    current_process = p;
-    if (p) p->state = PROC_RUNNING;
+    if (!p || p->cpu == self) return true;
+    if (timer_get_ms() - p->last_ran_ms >= SCHED_MIGRATE_HOT_MS) return true;
+    return self->balance_failed >= SCHED_CACHE_NICE_TRIES;
 }
 
-struct process *process_get_run_list(void)
+/* Take the oldest process of the busiest CPU's highest queued level, if
+ * that helps balance. */
+static struct process *steal_work(struct cpu *self)
 {
-    return run_list;
+    int n = smp_cpu_count();
+    uint32_t own = scheduler_load(self);
+    struct cpu *victim = NULL;
+    uint32_t best = own + SCHED_STEAL_IMBALANCE - 1;
+    for (int i = 1; i < n; i++) {
+        struct cpu *v = smp_cpu(((int)self->index + i) % n);
+        uint32_t load = scheduler_load(v);
+        if (load > best && scheduler_queued(v) > 0) {
+            victim = v;
+            best = load;
+        }
+    }
+    int l = -1;
+    if (victim)
+        for (l = 0; l < SCHED_LEVELS && ws_size(&victim->rq[l]) == 0; l++) ;
+    if (!victim || l == SCHED_LEVELS) {
+        self->balance_failed = 0;
+        return NULL;
+    }
+    if (!can_migrate(self, ws_peek(&victim->rq[l]))) {
+        self->balance_failed++;
+        self->stats.steal_skips++;
+        return NULL;
+    }
+    struct process *p = ws_steal(&victim->rq[l]);
+    if (!p) return NULL;
+    self->balance_failed = 0;
+    self->stats.steals++;
+    __atomic_add_fetch(&victim->stats.stolen, 1, __ATOMIC_RELAXED);
+    return p;
 }
 
-void process_add_runnable(struct process *p)
+/* Charge the time since the last call to the running process's kind. */
+static void account(struct cpu *c, uint32_t now)
 {
-    if (!run_list) {
-        run_list = p;
-        p->next = p;
-    } else {
-        p->next = run_list->next;
-        run_list->next = p;
+    struct sched_stats *s = &c->stats;
+    uint32_t delta = now - c->acct_ms;
+    if (delta < SCHED_LOAD_PERIOD_MS) return;
+    if (c->current == c->idle) s->idle_ms += delta;
+    else s->busy_ms += delta;
+    uint32_t load = scheduler_load(c) * 256;
+    for (uint32_t i = 0; i < delta / SCHED_LOAD_PERIOD_MS && i < 32; i++)
+        s->load_avg = s->load_avg - s->load_avg / 8 + load / 8;
+    c->acct_ms = now - delta % SCHED_LOAD_PERIOD_MS;
+}
+
+/* Charge the TSC time since the last charge to cur, less the interrupt
+ * time this CPU had meanwhile. */
+static void account_runtime(struct cpu *c, struct process *cur)
+{
+    uint64_t now = rdtsc();
+    uint64_t ran = now - c->run_tsc, irq = c->irq_tsc - c->run_irq_tsc;
+    if (ran > irq) cur->runtime_tsc += ran - irq;
+    c->run_tsc = now;
+    c->run_irq_tsc = c->irq_tsc;
+}
+
+uint64_t process_runtime(const struct process *p)
+{
+    uint64_t t = __atomic_load_n(&p->runtime_tsc, __ATOMIC_RELAXED);
+    struct cpu *c = p->cpu;
+    if (c && __atomic_load_n(&c->current, __ATOMIC_RELAXED) == p) {
+        int64_t since = (int64_t)(rdtsc() - c->run_tsc);
+        if (since > 0) t += (uint64_t)since;
+    }
+    return t;
+}
+
+int process_list(struct process_info *out, int max)
+{
+    int n = 0;
+    uint64_t flags = spin_lock_irqsave(&table_lock);
+    for (struct process *p = all_processes; p && n < max; p = p->all_next) {
+        if (p->cpu && p->cpu->idle == p) continue;
+        out[n].pid = p->pid;
+        out[n].name = p->name;
+        out[n].state = p->state;
+        out[n].level = p->level;
+        out[n].cpu = p->cpu ? p->cpu->index : 0;
+        out[n].runtime_tsc = process_runtime(p);
+        out[n].nvcsw = p->nvcsw;
+        out[n].nivcsw = p->nivcsw;
+        n++;
     }
+    spin_unlock_irqrestore(&table_lock, flags);
+    return n;
+}
+
+/* Next interrupt: end of slice while busy, the next timer wheel event; idle
+ * sleeps otherwise unless a steal is pending. */
+static void arm_timer(struct cpu *c, uint32_t now)
+{
+    uint32_t timeout = timer_wheel_next();
+    if (timeout && !(c->softirq_pending & (1u << SOFTIRQ_TIMER)))
+        timer_arm(timeout);       /* else timer_wheel_softirq re-arms */
+    if (c->current != c->idle) timer_arm(c->current->slice_end_ms);
+    else if (c->balance_failed) timer_arm(now + SCHED_MIGRATE_HOT_MS);
+}
+
+/* Pick the next process and switch to it; interrupts off. yield: the
+ * caller gives up the rest of its slice. Returns once cur runs again,
+ * possibly on another CPU. The old process is only requeued by
+ * scheduler_switch_done, once we are off its stack, so no other CPU can
+ * resume it while we still use it. */
+static void schedule(bool yield)
+{
+    struct cpu *c = this_cpu();
+    struct process *cur = c->current;
+    if (!cur) return;
+    if (c->in_softirq) {
+        c->need_resched = true;
+        return;
+    }
+    uint32_t now = timer_get_ms();
+    account(c, now);
+    account_runtime(c, cur);
+    uint32_t wheel = timer_wheel_next();
+    if (wheel && (int32_t)(wheel - now) <= 0) softirq_raise(SOFTIRQ_TIMER);
+    boost(c, now);
+    bool running = cur != c->idle && cur->state == PROC_RUNNING;
+    bool expired = running && (int32_t)(now - cur->slice_end_ms) >= 0;
+    if (expired && cur->level < SCHED_LEVELS - 1) {
+        cur->level++;             /* used its whole slice: CPU-bound */
+        c->stats.demotions++;
+    }
+    /* Preempt for a higher level at once, for the same level at slice end
+     * or when cur yields. */
+    bool rotate = expired || (yield && running);
+    struct process *next = NULL;
+    int top = top_level(c);
+    if (!running || (top >= 0 && (top < cur->level || (rotate && top == cur->level))))
+        next = take_own(c);
+    if (!next && top < 0 && (!running || rotate)) next = steal_work(c);
+    if (!next && (cur == c->idle || running)) {
+        if (expired) cur->slice_end_ms = now + slice_ms(cur->level);
+        arm_timer(c, now);    /* keep running cur */
+        return;
+    }
+    if (!next) next = c->idle;
+    if (cur->state == PROC_RUNNING) {
+        cur->state = PROC_RUNNABLE;
+        __atomic_store_n(&cur->on_cpu, ON_CPU_REQUEUE, __ATOMIC_RELEASE);
+    }
+    if (cur != c->idle) {
+        if (running && !yield) cur->nivcsw++;
+        else cur->nvcsw++;
+    }
+    cur->last_ran_ms = now;
+    c->prev = cur;
+    if (next->cpu != c) c->stats.migrations++;
+    next->cpu = c;
+    next->state = PROC_RUNNING;
+    next->on_cpu = ON_CPU_RUNNING;
+    next->slice_end_ms = now + slice_ms(next->level);
+    c->current = next;
+    c->stats.switches++;
+    fpu_switch(c, cur, next);
+    if (next->pml4) {
+        c->gdt.tss.rsp[0] = c->syscall_rsp = kstack_top(next);
+        paging_space_switch(next->pml4);
+    } else if (cur->pml4) {
+        paging_space_switch(NULL);    /* never leave a dead space loaded */
+    }
+    arm_timer(c, now);
+    context_switch(&cur->saved_rsp, next->saved_rsp);
+    scheduler_switch_done();      /* back in cur: c may be another CPU now */
+}
+
+/* Runs first thing in whatever context a switch resumes (the end of
+ * schedule, or process_start for a new process). Ends with irq_exit, so
+ * softirqs raised by the scheduler run before anything else. */
+void scheduler_switch_done(void)
+{
+    struct cpu *c = this_cpu();
+    struct process *p = c->prev;
+    c->prev = NULL;
+    if (p && p != c->idle) {
+        if (__atomic_exchange_n(&p->on_cpu, ON_CPU_NONE, __ATOMIC_ACQ_REL) == ON_CPU_REQUEUE) {
+            rq_push(c, p);
+            /* woken while switching to idle: come straight back for it */
+            if (c->current == c->idle) resched_self(c);
+        } else if (p->state == PROC_ZOMBIE) {
+            spin_lock(&reap_lock);
+            p->reap_next = reap_list;
+            reap_list = p;
+            spin_unlock(&reap_lock);
+            schedule_work(&reap_work);
+        }
+    }
+    irq_exit();
+}
+
+void process_block(void)
+{
+    schedule(false);
+}
+
+void process_yield(void)
+{
+    uint64_t flags = irq_save();
+    schedule(true);
+    irq_restore(flags);
+}
+
+bool process_wake(struct process *p)
+{
+    enum process_state blocked = PROC_BLOCKED;
+    if (!__atomic_compare_exchange_n(&p->state, &blocked, PROC_RUNNABLE, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return false;
+    if (p->level > p->base_level) p->level--;
+    /* Still on a CPU (not switched out yet): its scheduler_switch_done queues it. */
+    uint32_t on = ON_CPU_RUNNING;
+    if (__atomic_compare_exchange_n(&p->on_cpu, &on, ON_CPU_REQUEUE, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return true;
+    uint64_t flags = irq_save();
+    struct cpu *c = this_cpu();
+    rq_push(c, p);
+    if (c->current && (c->current == c->idle || p->level < c->current->level))
+        resched_self(c);
+    irq_restore(flags);
+    return true;
+}
+
+void process_resume_self(struct process *p)
+{
+    enum process_state blocked = PROC_BLOCKED;
+    if (__atomic_compare_exchange_n(&p->state, &blocked, PROC_RUNNING, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return;                    /* never blocked, nobody woke us */
+    if (__atomic_load_n(&p->state, __ATOMIC_SEQ_CST) == PROC_RUNNING)
+        return;                    /* blocked and was switched back in */
+    /* Woken before we switched away: wait for the waker's on_cpu hand-off. */
+    while (__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE) != ON_CPU_REQUEUE) cpu_relax();
+    p->on_cpu = ON_CPU_RUNNING;
+    p->state = PROC_RUNNING;
+}
+
+void scheduler_tick(void)
+{
+    irq_enter();
+    irq_eoi(0);  /* timer IRQ0 */
+    timer_tick();
+    smp_send_ipi_others(IPI_RESCHEDULE);
+    schedule(false);
+    irq_exit();
+}
+
+void scheduler_timer(void)
+{
+    irq_enter();
+    lapic_eoi();
+    timer_expired();
+    schedule(false);
+    irq_exit();
+}
+
+void scheduler_ipi(void)
+{
+    irq_enter();
+    lapic_eoi();
+    schedule(false);
+    irq_exit();
 }
 
 void scheduler_first_run(void)
 {
-    if (!run_list) return;
-    current_process = run_list;
-    current_process->state = PROC_RUNNING;
-    context_switch_to(current_process->saved_rsp);
+    struct cpu *c = this_cpu();
+    struct process *p = take_own(c);
+    if (!p) p = c->idle;
+    if (!p) return;
+    c->current = p;
+    p->state = PROC_RUNNING;
+    p->on_cpu = ON_CPU_RUNNING;
+    c->acct_ms = timer_get_ms();
+    c->next_boost_ms = c->acct_ms + SCHED_BOOST_MS;
+    c->run_tsc = rdtsc();
+    c->run_irq_tsc = c->irq_tsc;
+    p->slice_end_ms = c->acct_ms + slice_ms(p->level);
+    arm_timer(c, c->acct_ms);
+    context_switch_to(p->saved_rsp);
 }
@@ -0,0 +1,136 @@
+/**
+ * Softirqs and interrupt latency accounting.
+ * Hard interrupt handlers do only what cannot wait (read the device, send
+ * the EOI) and raise a softirq; irq_exit then runs the pending vectors with
+ * interrupts back on, so other interrupts are held off only for the hard
+ * part. Vectors raised meanwhile by nested interrupts are picked up by the
+ * same drain, for up to SOFTIRQ_RESTARTS passes; whatever is still pending
+ * after that waits for the next interrupt exit (armed 1 ms out) instead of
+ * starving the interrupted process.
+ * While tracing is on, irq_save/irq_restore time every section that turns
+ * interrupts off; a hard interrupt ends any section still open, since
+ * interrupts were evidently on.
+ */
+
+#include <kernel/softirq.h>
+#include <kernel/smp.h>
+#include <kernel/irq.h>
+#include <kernel/cpu.h>
+#include <kernel/lapic.h>
+#include <kernel/keyboard.h>
+#include <kernel/timer.h>
+#include <kernel/async.h>
+#include <kernel/types.h>
+
+#define SOFTIRQ_RESTARTS 4
+
+static void (*const softirq_vec[SOFTIRQ_COUNT])(void) = {
+    [SOFTIRQ_TIMER] = timer_wheel_softirq,
+    [SOFTIRQ_INPUT] = keyboard_softirq,
+    [SOFTIRQ_ASYNC] = async_softirq,
+};
+
+volatile bool irqoff_tracing;
+
+void softirq_raise(enum softirq_nr nr)
+{
+    this_cpu()->softirq_pending |= 1u << nr;
+}
+
+bool in_softirq(void)
+{
+    return this_cpu()->in_softirq;
+}
+
+bool in_interrupt(void)
+{
+    struct cpu *c = this_cpu();
+    return c->hardirq_tsc || c->in_softirq;
+}
+
+/* Interrupts off on entry and exit, on while the handlers run. */
+static void run_softirqs(struct cpu *c)
+{
+    uint64_t start = rdtsc(), nested = c->irq_tsc;
+    c->in_softirq = true;
+    for (int pass = 0; pass < SOFTIRQ_RESTARTS && c->softirq_pending; pass++) {
+        uint32_t pending = c->softirq_pending;
+        c->softirq_pending = 0;
+        __asm__ volatile ("sti" : : : "memory");
+        while (pending) {
+            int nr = __builtin_ctz(pending);
+            pending &= pending - 1;
+            c->irq.softirqs[nr]++;
+            softirq_vec[nr]();
+        }
+        __asm__ volatile ("cli" : : : "memory");
+    }
+    c->in_softirq = false;
+    uint64_t t = rdtsc() - start - (c->irq_tsc - nested);  /* minus nested hard IRQs */
+    c->irq_tsc += t;
+    c->irq.softirq_cycles += t;
+    if (t > c->irq.softirq_max) c->irq.softirq_max = t;
+    if (c->softirq_pending) timer_arm(timer_get_ms() + 1);
+    /* The scheduler was entered meanwhile and had to leave the handlers be. */
+    if (c->need_resched) {
+        c->need_resched = false;
+        if (c->current) lapic_send_ipi(c->apic_id, IPI_RESCHEDULE);
+    }
+}
+
+void irq_enter(void)
+{
+    struct cpu *c = this_cpu();
+    c->irqoff_tsc = 0;
+    c->hardirq_tsc = rdtsc();
+    c->irq.hardirqs++;
+}
+
+void irq_exit(void)
+{
+    struct cpu *c = this_cpu();
+    if (c->hardirq_tsc) {
+        uint64_t t = rdtsc() - c->hardirq_tsc;
+        c->hardirq_tsc = 0;
+        c->irq_tsc += t;
+        c->irq.hardirq_cycles += t;
+        if (t > c->irq.hardirq_max) c->irq.hardirq_max = t;
+    }
+    if (c->softirq_pending && !c->in_softirq) run_softirqs(c);
+}
+
+void irqoff_trace_start(void)
+{
+    this_cpu()->irqoff_tsc = rdtsc();
+}
+
+void irqoff_trace_stop(void)
+{
+    struct cpu *c = this_cpu();
+    if (!c->irqoff_tsc) return;
+    uint64_t t = rdtsc() - c->irqoff_tsc;
+    c->irqoff_tsc = 0;
+    c->irq.irqoff_sections++;
+    if (t > c->irq.irqoff_max) c->irq.irqoff_max = t;
+}
+
+void irq_stats_reset(void)
+{
+    struct cpu *c;
+    for (int i = 0; (c = smp_cpu(i)) != NULL; i++) {
+        uint64_t *w = (uint64_t *)&c->irq;
+        for (size_t j = 0; j < sizeof(c->irq) / sizeof(uint64_t); j++) w[j] = 0;
+    }
+}
+
+void irqoff_trace_enable(bool on)
+{
+    irqoff_tracing = false;
+    irq_stats_reset();
+    irqoff_tracing = on;
+}
+
+bool irqoff_trace_enabled(void)
+{
+    return irqoff_tracing;
+}
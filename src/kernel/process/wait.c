@@ -0,0 +1,188 @@
+/**
+ * Wait queues and timeouts.
+ * A waiter is linked on the queue (FIFO) and, with a timeout, has its
+ * process.timeout queued on the timer wheel of the CPU it blocked on. Wakers
+ * unlink it under the queue lock and hand it to process_wake, whose state CAS
+ * makes sure only one of wake_up, the timeout and the waiter itself gets to
+ * resume it. Async tasks are linked on a list of their own and handed to
+ * async_wake, which queues them on the waking CPU's executor.
+ */
+
+#include <kernel/wait.h>
+#include <kernel/process.h>
+#include <kernel/async.h>
+#include <kernel/smp.h>
+#include <kernel/irq.h>
+#include <kernel/types.h>
+
+void wait_queue_init(struct wait_queue *wq)
+{
+    wq->lock = (spinlock_t)SPINLOCK_INIT;
+    wq->head = wq->tail = NULL;
+    wq->tasks = NULL;
+}
+
+/* wq->lock held */
+static void wq_unlink(struct wait_queue *wq, struct process *p)
+{
+    struct process **pp = &wq->head, *prev = NULL;
+    while (*pp && *pp != p) {
+        prev = *pp;
+        pp = &prev->wait_next;
+    }
+    if (!*pp) return;
+    *pp = p->wait_next;
+    if (wq->tail == p) wq->tail = prev;
+    p->wait_next = NULL;
+    p->wait_queue = NULL;
+}
+
+static struct process *wq_pop(struct wait_queue *wq)
+{
+    struct process *p = wq->head;
+    if (!p) return NULL;
+    wq->head = p->wait_next;
+    if (!wq->head) wq->tail = NULL;
+    p->wait_next = NULL;
+    p->wait_queue = NULL;
+    return p;
+}
+
+static struct async_task *wq_pop_task(struct wait_queue *wq)
+{
+    struct async_task *t = wq->tasks;
+    if (!t) return NULL;
+    wq->tasks = t->wait_next;
+    t->wait_next = NULL;
+    t->waiting = NULL;
+    return t;
+}
+
+void wake_up(struct wait_queue *wq)
+{
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    struct process *p;
+    struct async_task *t;
+    while ((p = wq_pop(wq)) != NULL) process_wake(p);
+    while ((t = wq_pop_task(wq)) != NULL) async_wake(t);
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wake_up_one(struct wait_queue *wq)
+{
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    struct process *p;
+    struct async_task *t;
+    while ((p = wq_pop(wq)) != NULL && !process_wake(p)) ;
+    if (!p && (t = wq_pop_task(wq)) != NULL) async_wake(t);
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+static void async_timeout(void *arg)
+{
+    async_wake(arg);
+}
+
+void async_wait_prepare(struct async_task *t, struct wait_queue *wq)
+{
+    if (wq) {
+        uint64_t flags = spin_lock_irqsave(&wq->lock);
+        if (!t->waiting) {
+            t->wait_next = wq->tasks;
+            wq->tasks = t;
+            t->waiting = wq;
+        }
+        spin_unlock_irqrestore(&wq->lock, flags);
+    }
+    if (t->deadline && !timer_pending(&t->timer))
+        timer_add(&t->timer, t->deadline, async_timeout, t);
+}
+
+void async_wait_finish(struct async_task *t, struct wait_queue *wq)
+{
+    if (wq) {
+        uint64_t flags = spin_lock_irqsave(&wq->lock);
+        if (t->waiting == wq) {
+            struct async_task **pp = &wq->tasks;
+            while (*pp && *pp != t) pp = &(*pp)->wait_next;
+            if (*pp) *pp = t->wait_next;
+            t->wait_next = NULL;
+            t->waiting = NULL;
+        }
+        spin_unlock_irqrestore(&wq->lock, flags);
+    }
+    timer_cancel(&t->timer);
+    t->deadline = 0;
+}
+
+static void wait_timeout(void *arg)
+{
+    process_wake(arg);
+}
+
+uint64_t wait_prepare(struct wait_queue *wq, uint32_t deadline_ms)
+{
+    uint64_t flags = irq_save();
+    struct cpu *c = this_cpu();
+    struct process *p = c->current;
+    if (!p || p == c->idle) {              /* boot or idle context: wait_block halts */
+        if (deadline_ms) timer_arm(deadline_ms);
+        return flags;
+    }
+    __atomic_store_n(&p->state, PROC_BLOCKED, __ATOMIC_SEQ_CST);
+    if (wq) {
+        spin_lock(&wq->lock);
+        if (!p->wait_queue) {
+            p->wait_next = NULL;
+            if (wq->tail) wq->tail->wait_next = p;
+            else wq->head = p;
+            wq->tail = p;
+            p->wait_queue = wq;
+        }
+        spin_unlock(&wq->lock);
+    }
+    if (deadline_ms) timer_add(&p->timeout, deadline_ms, wait_timeout, p);
+    return flags;
+}
+
+void wait_block(void)
+{
+    struct cpu *c = this_cpu();
+    struct process *p = c->current;
+    if (!p || p == c->idle) {
+        __asm__ volatile ("sti; hlt; cli" : : : "memory");
+        return;
+    }
+    if (__atomic_load_n(&p->state, __ATOMIC_SEQ_CST) == PROC_BLOCKED)
+        process_block();
+}
+
+void wait_finish(struct wait_queue *wq, uint64_t flags)
+{
+    struct cpu *c = this_cpu();
+    struct process *p = c->current;
+    if (p && p != c->idle) {
+        if (wq) {
+            spin_lock(&wq->lock);
+            if (p->wait_queue == wq) wq_unlink(wq, p);
+            spin_unlock(&wq->lock);
+        }
+        timer_cancel(&p->timeout);
+        process_resume_self(p);
+    }
+    irq_restore(flags);
+}
+
+void sleep_ms(uint32_t ms)
+{
+    if (!ms) {
+        process_yield();
+        return;
+    }
+    uint32_t end = timer_get_ms() + ms;
+    while ((int32_t)(end - timer_get_ms()) > 0) {
+        uint64_t flags = wait_prepare(NULL, end ? end : 1);
+        wait_block();
+        wait_finish(NULL, flags);
+    }
+}
@@ -0,0 +1,92 @@
+/**
+ * Workqueues: a FIFO of struct work and one kernel thread draining it.
+ * queue_work links the item under the queue lock (interrupts off, so
+ * interrupt handlers, softirqs and the scheduler may queue) and wakes the
+ * worker. The worker clears WORK_PENDING before calling fn, so an item that
+ * is queued again while running is run once more afterwards.
+ */
+
+#include <kernel/workqueue.h>
+#include <kernel/process.h>
+#include <kernel/mm.h>
+#include <kernel/types.h>
+
+struct workqueue *system_wq;
+
+static struct work *dequeue(struct workqueue *wq)
+{
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    struct work *w = wq->head;
+    if (w) {
+        wq->head = w->next;
+        if (!wq->head) wq->tail = NULL;
+        w->next = NULL;
+        __atomic_store_n(&w->flags, WORK_RUNNING, __ATOMIC_RELEASE);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return w;
+}
+
+static void worker_loop(void *arg)
+{
+    struct workqueue *wq = arg;
+    for (;;) {
+        wait_event(wq->wait, __atomic_load_n(&wq->head, __ATOMIC_ACQUIRE) != NULL);
+        struct work *w;
+        while ((w = dequeue(wq)) != NULL) {
+            w->fn(w);
+            __atomic_and_fetch(&w->flags, ~WORK_RUNNING, __ATOMIC_RELEASE);
+            wq->done++;
+        }
+    }
+}
+
+struct workqueue *workqueue_create(const char *name, int level)
+{
+    struct workqueue *wq = kmalloc(sizeof(*wq));
+    if (!wq) return NULL;
+    wq->name = name;
+    wq->lock = (spinlock_t)SPINLOCK_INIT;
+    wq->head = wq->tail = NULL;
+    wait_queue_init(&wq->wait);
+    wq->done = 0;
+    wq->worker = process_create_arg(worker_loop, wq, level);
+    if (!wq->worker) {
+        kfree(wq);
+        return NULL;
+    }
+    process_set_name(wq->worker, name);
+    process_detach(wq->worker);
+    return wq;
+}
+
+void workqueue_init(void)
+{
+    system_wq = workqueue_create("events", SCHED_PRIO_HIGH);
+}
+
+bool queue_work(struct workqueue *wq, struct work *w)
+{
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    bool queued = !(w->flags & WORK_PENDING);
+    if (queued) {
+        __atomic_or_fetch(&w->flags, WORK_PENDING, __ATOMIC_RELAXED);
+        w->next = NULL;
+        if (wq->tail) wq->tail->next = w;
+        else wq->head = w;
+        wq->tail = w;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    if (queued) wake_up(&wq->wait);
+    return queued;
+}
+
+bool schedule_work(struct work *w)
+{
+    return queue_work(system_wq, w);
+}
+
+bool work_busy(const struct work *w)
+{
+    return __atomic_load_n(&w->flags, __ATOMIC_ACQUIRE) != 0;
+}
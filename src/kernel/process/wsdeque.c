@@ -0,0 +1,46 @@
+/**
+ * Chase-Lev work-stealing deque (Le et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models", push and steal). The buffer never
+ * grows, so stale reads of a slot are harmless: the CAS on top decides who
+ * owns the entry.
+ */
+
+#include <kernel/wsdeque.h>
+
+#define WS_MASK (WS_DEQUE_SIZE - 1)
+
+int ws_push(struct ws_deque *d, struct process *p)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - t >= WS_DEQUE_SIZE) return -1;
+    __atomic_store_n(&d->buf[b & WS_MASK], p, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+struct process *ws_steal(struct ws_deque *d)
+{
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return NULL;
+    struct process *p = __atomic_load_n(&d->buf[t & WS_MASK], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return p;
+}
+
+struct process *ws_peek(const struct ws_deque *d)
+{
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    return t < b ? __atomic_load_n(&d->buf[t & WS_MASK], __ATOMIC_RELAXED) : NULL;
+}
+
+int ws_size(const struct ws_deque *d)
+{
+    int64_t n = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE) - __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    return n > 0 ? (int)n : 0;
+}
@@ -8,6 +8,7 @@
 #include <kernel/video_mode13.h>
 #include <kernel/doom_host.h>
 #include <kernel/posix.h>
+#include <kernel/vclock.h>
 #include <kernel/types.h>
 
 /* Video: same as DOOM (VGA mode 13h) */
@@ -47,10 +48,10 @@ void redalert_input_clear(void)
     doom_input_clear();
 }
 
-/* Time: reuse DOOM time (PIT) */
+/* Time: the clock page, as DOOM does */
 uint32_t redalert_time_ms(void)
 {
-    return doom_time_ms();
+    return (uint32_t)(vclock_read_ns(&vclock_page.data) / 1000000);
 }
 
 void redalert_time_delay_ms(uint32_t ms)
@@ -1,6 +1,7 @@
 /**
  * Simple shell: read line, expand aliases, dispatch commands.
- * Commands: help, clear, echo, ls, cd, mkdir, cat, edit, alias.
+ * Commands: help, clear, echo, ls, cd, mkdir, cat, edit, alias, meminfo, sched,
+ * irqstat, irq, lspci, top, syscall, async.
  */
 
 #include <kernel/shell.h>
@@ -12,6 +13,18 @@
 #include <kernel/doom_host.h>
 #include <kernel/redalert_host.h>
 #include <kernel/mouse.h>
+#include <kernel/memstat.h>
+#include <kernel/smp.h>
+#include <kernel/softirq.h>
+#include <kernel/irq.h>
+#include <kernel/pci.h>
+#include <kernel/workqueue.h>
+#include <kernel/timer.h>
+#include <kernel/syscall.h>
+#include <kernel/async.h>
+#include <kernel/ata.h>
+#include <kernel/process.h>
+#include <kernel/mm.h>
 #include <kernel/types.h>
 #if ENABLE_GUI
 #include <kernel/gui.h>
@@ -38,7 +51,7 @@ static void next_arg(const char **p, char *buf, size_t max_len)
 
 static void cmd_help(void)
 {
-    vga_puts("Commands: help clear echo ls cd mkdir cat edit alias fatcat fatput DOOM REDALERT");
+    vga_puts("Commands: help clear echo ls cd mkdir cat edit alias meminfo sched irqstat irq lspci top syscall async fatcat fatput DOOM REDALERT");
 #if ENABLE_GUI
     vga_puts(" gui");
 #endif
@@ -173,8 +186,7 @@ static void cmd_edit(const char *args)
     char content[FS_FILE_BUF];
     size_t i = 0;
     for (;;) {
-        char c = keyboard_getchar();
-        if (!c) { __asm__ volatile ("hlt"); continue; }
+        char c = keyboard_getchar_wait();
         if (c == '\n') break;
         if (i < sizeof(content) - 1) content[i++] = c;
         vga_putchar(c);
@@ -201,6 +213,537 @@ static void cmd_alias(const char *args)
     else vga_puts("ok\n");
 }
 
+static void put_kb(size_t bytes)
+{
+    vga_putdec((uint32_t)(bytes / 1024));
+    vga_puts(" KB");
+}
+
+static void meminfo_trace_dump(void)
+{
+    static struct memtrace_entry ents[20];   /* one screenful */
+    static const char *const ops[] = { "alloc  ", "free   ", "realloc", "FAIL   " };
+    int n = memtrace_read(ents, 20);
+    if (!n) vga_puts("trace empty\n");
+    for (int i = 0; i < n; i++) {
+        vga_putdec(ents[i].ms);
+        vga_puts("ms ");
+        vga_puts(ents[i].name);
+        vga_putchar(' ');
+        vga_puts(ops[ents[i].op]);
+        vga_putchar(' ');
+        vga_puthex((uint64_t)(uintptr_t)ents[i].ptr);
+        vga_putchar(' ');
+        vga_putdec((uint32_t)ents[i].size);
+        vga_putchar('\n');
+    }
+}
+
+/* meminfo [trace [on|off]] */
+static void cmd_meminfo(const char *args)
+{
+    char sub[8], arg[8];
+    next_arg(&args, sub, sizeof(sub));
+    next_arg(&args, arg, sizeof(arg));
+    if (sub[0] == 't' && sub[1] == 'r' && sub[2] == 'a' && sub[3] == 'c' && sub[4] == 'e' && !sub[5]) {
+        if (arg[0] == 'o' && arg[1] == 'n' && !arg[2]) { memtrace_enable(true); vga_puts("trace on\n"); return; }
+        if (arg[0] == 'o' && arg[1] == 'f' && arg[2] == 'f' && !arg[3]) { memtrace_enable(false); vga_puts("trace off\n"); return; }
+        meminfo_trace_dump();
+        return;
+    }
+    if (sub[0]) { vga_puts("meminfo: usage meminfo [trace [on|off]]\n"); return; }
+
+    struct mem_stats *s;
+    for (int i = 0; (s = memstat_get(i)) != NULL; i++) {
+        vga_puts(s->name);
+        vga_puts(": in use ");
+        put_kb(s->in_use);
+        vga_puts(" (peak ");
+        put_kb(s->peak);
+        vga_puts("), allocs ");
+        vga_putdec((uint32_t)s->allocs);
+        vga_puts(" frees ");
+        vga_putdec((uint32_t)s->frees);
+        vga_puts(" failed ");
+        vga_putdec((uint32_t)s->failures);
+        vga_putchar('\n');
+        if (s->refresh) {
+            vga_puts("  free ");
+            put_kb(s->free_bytes);
+            vga_puts(", largest ");
+            put_kb(s->largest_free);
+            vga_puts(", fragmentation ");
+            vga_putdec(memstat_frag_percent(s));
+            vga_puts("%\n");
+        }
+        /* Histogram buckets are powers of two from 16 bytes; only non-empty ones. */
+        vga_puts("  sizes");
+        for (int b = 0; b < MEMSTAT_BUCKETS; b++) {
+            if (!s->hist[b]) continue;
+            vga_putchar(' ');
+            if (b == MEMSTAT_BUCKETS - 1) vga_putchar('>');
+            else vga_puts("<=");
+            vga_putdec((uint32_t)16 << (b == MEMSTAT_BUCKETS - 1 ? b - 1 : b));
+            vga_putchar(':');
+            vga_putdec((uint32_t)s->hist[b]);
+        }
+        vga_putchar('\n');
+    }
+    if (memtrace_enabled()) vga_puts("trace on (meminfo trace to dump)\n");
+}
+
+/* Per-CPU load and work-stealing counters. */
+static void cmd_sched(void)
+{
+    struct cpu *c;
+    vga_puts("processes ");
+    vga_putdec(process_count());
+    vga_puts(", pooled stacks ");
+    vga_putdec(kstack_pooled());
+    vga_putchar('\n');
+    for (int i = 0; (c = smp_cpu(i)) != NULL; i++) {
+        const struct sched_stats *s = &c->stats;
+        uint64_t total = s->idle_ms + s->busy_ms;
+        vga_puts("cpu");
+        vga_putdec((uint32_t)i);
+        vga_puts(": load ");
+        vga_putdec(scheduler_load(c));
+        vga_puts(" avg ");
+        vga_putdec(s->load_avg / 256);
+        vga_putchar('.');
+        uint32_t frac = (s->load_avg % 256) * 100 / 256;
+        if (frac < 10) vga_putchar('0');
+        vga_putdec(frac);
+        vga_puts(", busy ");
+        vga_putdec(total ? (uint32_t)(s->busy_ms * 100 / total) : 0);
+        vga_puts("%\n  switches ");
+        vga_putdec((uint32_t)s->switches);
+        vga_puts(" migrations ");
+        vga_putdec((uint32_t)s->migrations);
+        vga_puts(" steals ");
+        vga_putdec((uint32_t)s->steals);
+        vga_puts(" stolen ");
+        vga_putdec((uint32_t)s->stolen);
+        vga_puts(" hot skips ");
+        vga_putdec((uint32_t)s->steal_skips);
+        vga_puts("\n  demotions ");
+        vga_putdec((uint32_t)s->demotions);
+        vga_puts(" boosts ");
+        vga_putdec((uint32_t)s->boosts);
+        vga_puts(" queued");
+        for (int l = 0; l < SCHED_LEVELS; l++) {
+            int n = ws_size(&c->rq[l]);
+            if (!n) continue;
+            vga_puts(" L");
+            vga_putdec((uint32_t)l);
+            vga_putchar(':');
+            vga_putdec((uint32_t)n);
+        }
+        vga_putchar('\n');
+    }
+}
+
+/* TSC cycles as microseconds (raw cycles if the TSC was not calibrated). */
+static void put_cycles(uint64_t cycles)
+{
+    uint32_t khz = timer_tsc_khz();
+    if (!khz) {
+        vga_putdec((uint32_t)cycles);
+        vga_puts(" cyc");
+        return;
+    }
+    vga_putdec((uint32_t)(cycles * 1000 / khz));
+    vga_puts(" us");
+}
+
+/* Per-CPU interrupt and softirq time, and interrupts-off sections. */
+static void cmd_irqstat(const char *args)
+{
+    static const char *const names[SOFTIRQ_COUNT] = { "timer", "input", "async" };
+    char sub[8], arg[8];
+    next_arg(&args, sub, sizeof(sub));
+    next_arg(&args, arg, sizeof(arg));
+    if (sub[0] == 't' && sub[1] == 'r' && sub[2] == 'a' && sub[3] == 'c' && sub[4] == 'e' && !sub[5]) {
+        if (arg[0] == 'o' && arg[1] == 'n' && !arg[2]) { irqoff_trace_enable(true); vga_puts("trace on\n"); return; }
+        if (arg[0] == 'o' && arg[1] == 'f' && arg[2] == 'f' && !arg[3]) { irqoff_trace_enable(false); vga_puts("trace off\n"); return; }
+    }
+    if (sub[0] == 'r' && sub[1] == 'e' && sub[2] == 's' && sub[3] == 'e' && sub[4] == 't' && !sub[5]) { irq_stats_reset(); return; }
+    if (sub[0]) { vga_puts("irqstat: usage irqstat [reset | trace on|off]\n"); return; }
+
+    struct cpu *c;
+    for (int i = 0; (c = smp_cpu(i)) != NULL; i++) {
+        const struct irq_stats *s = &c->irq;
+        vga_puts("cpu");
+        vga_putdec((uint32_t)i);
+        vga_puts(": hardirqs ");
+        vga_putdec((uint32_t)s->hardirqs);
+        vga_puts(" avg ");
+        put_cycles(s->hardirqs ? s->hardirq_cycles / s->hardirqs : 0);
+        vga_puts(" max ");
+        put_cycles(s->hardirq_max);
+        vga_puts("\n  softirqs");
+        for (int n = 0; n < SOFTIRQ_COUNT; n++) {
+            vga_putchar(' ');
+            vga_puts(names[n]);
+            vga_putchar(':');
+            vga_putdec((uint32_t)s->softirqs[n]);
+        }
+        vga_puts(", total ");
+        put_cycles(s->softirq_cycles);
+        vga_puts(" max ");
+        put_cycles(s->softirq_max);
+        vga_putchar('\n');
+        if (irqoff_trace_enabled()) {
+            vga_puts("  irqs off max ");
+            put_cycles(s->irqoff_max);
+            vga_puts(" over ");
+            vga_putdec((uint32_t)s->irqoff_sections);
+            vga_puts(" sections\n");
+        }
+    }
+    vga_puts(system_wq->name);
+    vga_puts(" workqueue: ");
+    vga_putdec((uint32_t)system_wq->done);
+    vga_puts(" items run\n");
+    if (!irqoff_trace_enabled()) vga_puts("trace off (irqstat trace on to time irqs-off sections)\n");
+}
+
+static int parse_uint(const char *s)
+{
+    if (*s < '0' || *s > '9') return -1;
+    int n = 0;
+    while (*s >= '0' && *s <= '9' && n < 100000) n = n * 10 + (*s++ - '0');
+    return *s ? -1 : n;
+}
+
+/* ISA IRQ routing; "irq <n> <cpu>" moves an IRQ to another CPU. */
+static void cmd_irq(const char *args)
+{
+    char a1[8], a2[8];
+    next_arg(&args, a1, sizeof(a1));
+    next_arg(&args, a2, sizeof(a2));
+    if (a1[0]) {
+        int irq = parse_uint(a1), cpu = parse_uint(a2);
+        if (irq < 0 || cpu < 0) { vga_puts("irq: usage irq [<irq> <cpu>]\n"); return; }
+        if (irq_set_affinity((uint8_t)irq, cpu) != 0) { vga_puts("irq: cannot move that IRQ there\n"); return; }
+    }
+    vga_puts(irq_apic_mode() ? "I/O APIC, EOI via local APIC\n" : "8259 PIC\n");
+    for (int i = 0; i < ISA_IRQS; i++) {
+        struct irq_route r;
+        if (!irq_get_route((uint8_t)i, &r) || r.gsi < 0 || r.masked) continue;
+        vga_puts("irq");
+        vga_putdec((uint32_t)i);
+        vga_puts(": gsi ");
+        vga_putdec((uint32_t)r.gsi);
+        vga_puts(" vector ");
+        vga_putdec((uint32_t)(IRQ_BASE + i));
+        vga_puts(" cpu");
+        vga_putdec((uint32_t)r.cpu);
+        vga_puts(r.level ? " level" : " edge");
+        vga_puts(r.active_low ? " low\n" : " high\n");
+    }
+}
+
+static void put_hex(uint32_t n, int digits)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (int i = digits - 1; i >= 0; i--) vga_putchar(hex[(n >> (i * 4)) & 0xF]);
+}
+
+/* PCI functions: bus:slot.fn vendor:device class, driver, BARs. */
+static void cmd_lspci(void)
+{
+    struct pci_dev *d;
+    for (int i = 0; (d = pci_dev_get(i)) != NULL; i++) {
+        put_hex(d->bus, 2);
+        vga_putchar(':');
+        put_hex(d->slot, 2);
+        vga_putchar('.');
+        put_hex(d->fn, 1);
+        vga_putchar(' ');
+        put_hex(d->vendor, 4);
+        vga_putchar(':');
+        put_hex(d->device, 4);
+        vga_puts(" class ");
+        put_hex(d->class, 2);
+        put_hex(d->subclass, 2);
+        if (d->driver) {
+            vga_puts(" [");
+            vga_puts(d->driver->name);
+            vga_putchar(']');
+        }
+        vga_putchar('\n');
+        for (int b = 0; b < 6; b++) {
+            const struct pci_bar *bar = &d->bar[b];
+            if (!bar->size) continue;
+            vga_puts("  bar");
+            vga_putdec((uint32_t)b);
+            vga_puts(bar->io ? " io " : bar->prefetch ? " mem prefetch " : " mem ");
+            vga_puthex(bar->addr);
+            vga_putchar(' ');
+            if (bar->size < 1024) {
+                vga_putdec((uint32_t)bar->size);
+                vga_puts(" B\n");
+            } else {
+                put_kb(bar->size);
+                vga_putchar('\n');
+            }
+        }
+    }
+    if (!pci_dev_count()) vga_puts("no PCI functions\n");
+}
+
+#define TOP_MAX   64              /* processes sampled */
+#define TOP_ROWS  16              /* processes shown */
+#define TOP_MS    1000            /* refresh interval */
+
+struct top_sample {
+    uint64_t tsc;
+    int n;
+    struct process_info procs[TOP_MAX];
+    uint64_t idle[MAX_CPUS];      /* idle process runtime */
+    uint64_t irq[MAX_CPUS];       /* interrupt time */
+};
+
+static void top_sample(struct top_sample *s)
+{
+    struct cpu *c;
+    s->tsc = rdtsc();
+    for (int i = 0; (c = smp_cpu(i)) != NULL; i++) {
+        s->idle[i] = c->idle ? process_runtime(c->idle) : 0;
+        s->irq[i] = c->irq_tsc;
+    }
+    s->n = process_list(s->procs, TOP_MAX);
+}
+
+static void put_padded(uint32_t n, int width)
+{
+    int digits = 1;
+    for (uint32_t v = n; v >= 10; v /= 10) digits++;
+    for (int i = digits; i < width; i++) vga_putchar(' ');
+    vga_putdec(n);
+}
+
+/* part/whole as a percentage with one decimal, 6 columns. */
+static void put_pct(uint64_t part, uint64_t whole)
+{
+    uint32_t t = whole ? (uint32_t)(part * 1000 / whole) : 0;
+    put_padded(t / 10, 4);
+    vga_putchar('.');
+    vga_putdec(t % 10);
+}
+
+static uint64_t delta(uint64_t now, uint64_t then)
+{
+    return now > then ? now - then : 0;
+}
+
+/* Live per-CPU and per-process CPU usage over the last TOP_MS, until a key. */
+static void cmd_top(void)
+{
+    static const char *const states[] = { "ready ", "run   ", "wait  ", "zombie", "dead  " };
+    static struct top_sample samples[2];
+    struct top_sample *prev = &samples[0], *cur = &samples[1];
+    uint32_t khz = timer_tsc_khz();
+    top_sample(prev);
+    vga_puts("top: sampling, any key quits\n");
+    while (!keyboard_getchar_timeout(TOP_MS)) {
+        top_sample(cur);
+        uint64_t wall = cur->tsc - prev->tsc;
+        vga_clear();
+        vga_puts("top: ");
+        vga_putdec((uint32_t)cur->n);
+        vga_puts(" processes, any key quits\n");
+        struct cpu *c;
+        for (int i = 0; (c = smp_cpu(i)) != NULL; i++) {
+            uint64_t idle = delta(cur->idle[i], prev->idle[i]);
+            uint64_t irq = delta(cur->irq[i], prev->irq[i]);
+            vga_puts("cpu");
+            vga_putdec((uint32_t)i);
+            vga_puts(": busy");
+            put_pct(delta(wall, idle + irq), wall);
+            vga_puts("%  irq");
+            put_pct(irq, wall);
+            vga_puts("%  idle");
+            put_pct(idle, wall);
+            vga_puts("%\n");
+        }
+        vga_puts("  PID CPU LV STATE   %CPU  TIME ms    VOL  INVOL NAME\n");
+        uint64_t used[TOP_MAX];
+        bool shown[TOP_MAX];
+        for (int i = 0; i < cur->n; i++) {
+            const struct process_info *p = &cur->procs[i];
+            uint64_t before = 0;
+            for (int j = 0; j < prev->n; j++)
+                if (prev->procs[j].pid == p->pid) before = prev->procs[j].runtime_tsc;
+            used[i] = delta(p->runtime_tsc, before);
+            shown[i] = false;
+        }
+        for (int row = 0; row < TOP_ROWS && row < cur->n; row++) {
+            int best = -1;
+            for (int i = 0; i < cur->n; i++)
+                if (!shown[i] && (best < 0 || used[i] > used[best])) best = i;
+            shown[best] = true;
+            const struct process_info *p = &cur->procs[best];
+            put_padded((uint32_t)p->pid, 5);
+            put_padded(p->cpu, 4);
+            put_padded((uint32_t)p->level, 3);
+            vga_putchar(' ');
+            vga_puts(states[p->state]);
+            put_pct(used[best], wall);
+            put_padded(khz ? (uint32_t)(p->runtime_tsc / khz) : 0, 9);
+            put_padded((uint32_t)p->nvcsw, 7);
+            put_padded((uint32_t)p->nivcsw, 7);
+            vga_putchar(' ');
+            vga_puts(p->name ? p->name : "-");
+            vga_putchar('\n');
+        }
+        struct top_sample *t = prev;
+        prev = cur;
+        cur = t;
+    }
+}
+
+#define SYSCALL_BENCH_CALLS 100000
+
+/* Run a ring-3 benchmark that exits with the cycles one operation took. */
+static void user_bench(const char *what, const void *entry, uint32_t n)
+{
+    struct process *p = process_create_user(entry, n, SCHED_PRIO_NORMAL);
+    if (!p) { vga_puts("syscall: cannot start a user process\n"); return; }
+    int cycles = process_join(p);
+    vga_puts(what);
+    if (cycles < 0) { vga_puts(": user process died\n"); return; }
+    vga_puts(": ");
+    vga_putdec((uint32_t)cycles);
+    vga_puts(" cycles");
+    uint32_t khz = timer_tsc_khz();
+    if (khz) {
+        vga_puts(", ");
+        vga_putdec((uint32_t)((uint64_t)cycles * 1000000 / khz));
+        vga_puts(" ns");
+    }
+    vga_putchar('\n');
+}
+
+/* Time null system calls and vclock reads from ring 3. */
+static void cmd_syscall(const char *args)
+{
+    char arg[12];
+    next_arg(&args, arg, sizeof(arg));
+    uint32_t n = 0;
+    for (int i = 0; arg[i] >= '0' && arg[i] <= '9'; i++) n = n * 10 + (uint32_t)(arg[i] - '0');
+    if (!n) n = SYSCALL_BENCH_CALLS;
+    vga_putdec(n);
+    vga_puts(" iterations each\n");
+    user_bench("getpid round trip", user_syscall_bench, n);
+    user_bench("clock read (no syscall)", user_clock_bench, n);
+}
+
+#define ASYNC_DEMO_TASKS  1000
+#define ASYNC_DEMO_SLEEPS 5
+
+struct sleeper {
+    struct async_task task;
+    int i;
+};
+
+static int sleeper_fn(struct async_task *t)
+{
+    struct sleeper *s = (struct sleeper *)t;
+    ASYNC_BEGIN(t);
+    for (s->i = 0; s->i < ASYNC_DEMO_SLEEPS; s->i++)
+        async_sleep(t, 10);
+    ASYNC_END(t, 0);
+}
+
+static uint64_t async_polls_total(void)
+{
+    uint64_t n = 0;
+    struct cpu *c;
+    for (int i = 0; (c = smp_cpu(i)) != NULL; i++) n += c->async_polls;
+    return n;
+}
+
+#define ASYNC_DISK_SECTORS 8
+
+/* Reads the first sectors through queued ATA requests, all in flight at once. */
+struct disk_reader {
+    struct async_task task;
+    struct ata_request req[ASYNC_DISK_SECTORS];
+    int i;
+    int errors;
+};
+
+static int disk_reader_fn(struct async_task *t)
+{
+    struct disk_reader *d = (struct disk_reader *)t;
+    ASYNC_BEGIN(t);
+    for (int i = 0; i < ASYNC_DISK_SECTORS; i++) ata_submit(&d->req[i]);
+    for (d->i = 0; d->i < ASYNC_DISK_SECTORS; d->i++) {
+        async_wait_event(t, ata_wait,
+                         __atomic_load_n(&d->req[d->i].status, __ATOMIC_ACQUIRE) != ATA_REQ_PENDING);
+        if (d->req[d->i].status != 0) d->errors++;
+    }
+    ASYNC_END(t, d->errors ? -1 : 0);
+}
+
+static void async_disk(void)
+{
+    struct disk_reader *d = kmalloc(sizeof(*d));
+    uint8_t *buf = kmalloc(ASYNC_DISK_SECTORS * ATA_SECTOR_SIZE);
+    if (!d || !buf) {
+        vga_puts("async: out of memory\n");
+        if (d) kfree(d);
+        if (buf) kfree(buf);
+        return;
+    }
+    d->errors = 0;
+    for (int i = 0; i < ASYNC_DISK_SECTORS; i++)
+        d->req[i] = (struct ata_request){ .lba = (uint32_t)i, .count = 1, .buf = buf + i * ATA_SECTOR_SIZE };
+    uint32_t start = timer_get_ms();
+    async_start(&d->task, disk_reader_fn, NULL);
+    int r = async_join(&d->task);
+    uint32_t ms = timer_get_ms() - start;
+    kfree(buf);
+    kfree(d);
+    if (r != 0) { vga_puts("async: disk read failed\n"); return; }
+    vga_putdec(ASYNC_DISK_SECTORS);
+    vga_puts(" sectors read by one task through ata_submit: ");
+    vga_putdec(ms);
+    vga_puts(" ms\n");
+}
+
+/* "async [n]": n tasks each sleeping 5 x 10 ms at once, in one allocation.
+ * "async disk": one task awaiting queued disk reads. */
+static void cmd_async(const char *args)
+{
+    char arg[12];
+    next_arg(&args, arg, sizeof(arg));
+    if (arg[0] == 'd' && arg[1] == 'i' && arg[2] == 's' && arg[3] == 'k' && !arg[4]) { async_disk(); return; }
+    int n = arg[0] ? parse_uint(arg) : ASYNC_DEMO_TASKS;
+    if (n <= 0) { vga_puts("usage: async [tasks] | async disk\n"); return; }
+    struct sleeper *s = kmalloc((size_t)n * sizeof(*s));
+    if (!s) { vga_puts("async: out of memory\n"); return; }
+    uint64_t polls = async_polls_total();
+    uint32_t start = timer_get_ms();
+    for (int i = 0; i < n; i++) async_start(&s[i].task, sleeper_fn, NULL);
+    for (int i = 0; i < n; i++) async_join(&s[i].task);
+    uint32_t ms = timer_get_ms() - start;
+    polls = async_polls_total() - polls;
+    kfree(s);
+    vga_putdec((uint32_t)n);
+    vga_puts(" tasks x 5 sleeps of 10 ms: ");
+    vga_putdec(ms);
+    vga_puts(" ms, ");
+    vga_putdec((uint32_t)polls);
+    vga_puts(" polls, ");
+    vga_putdec((uint32_t)sizeof(*s));
+    vga_puts(" bytes per task (a process stack is ");
+    vga_putdec(PROCESS_STACK_SIZE / 1024);
+    vga_puts(" KiB)\n");
+}
+
 static void cmd_doom(const char *args)
 {
     (void)args;
@@ -299,6 +842,14 @@ static void run_command(char *line)
     if (cmd[0] == 'c' && cmd[1] == 'a' && cmd[2] == 't' && !cmd[3]) { cmd_cat(p); return; }
     if (cmd[0] == 'e' && cmd[1] == 'd' && cmd[2] == 'i' && cmd[3] == 't' && !cmd[4]) { cmd_edit(p); return; }
     if (cmd[0] == 'a' && cmd[1] == 'l' && cmd[2] == 'i' && cmd[3] == 'a' && cmd[4] == 's' && !cmd[5]) { cmd_alias(p); return; }
+    if (cmd[0] == 'm' && cmd[1] == 'e' && cmd[2] == 'm' && cmd[3] == 'i' && cmd[4] == 'n' && cmd[5] == 'f' && cmd[6] == 'o' && !cmd[7]) { cmd_meminfo(p); return; }
+    if (cmd[0] == 's' && cmd[1] == 'c' && cmd[2] == 'h' && cmd[3] == 'e' && cmd[4] == 'd' && !cmd[5]) { cmd_sched(); return; }
+    if (cmd[0] == 'i' && cmd[1] == 'r' && cmd[2] == 'q' && cmd[3] == 's' && cmd[4] == 't' && cmd[5] == 'a' && cmd[6] == 't' && !cmd[7]) { cmd_irqstat(p); return; }
+    if (cmd[0] == 'i' && cmd[1] == 'r' && cmd[2] == 'q' && !cmd[3]) { cmd_irq(p); return; }
+    if (cmd[0] == 'l' && cmd[1] == 's' && cmd[2] == 'p' && cmd[3] == 'c' && cmd[4] == 'i' && !cmd[5]) { cmd_lspci(); return; }
+    if (cmd[0] == 't' && cmd[1] == 'o' && cmd[2] == 'p' && !cmd[3]) { cmd_top(); return; }
+    if (cmd[0] == 's' && cmd[1] == 'y' && cmd[2] == 's' && cmd[3] == 'c' && cmd[4] == 'a' && cmd[5] == 'l' && cmd[6] == 'l' && !cmd[7]) { cmd_syscall(p); return; }
+    if (cmd[0] == 'a' && cmd[1] == 's' && cmd[2] == 'y' && cmd[3] == 'n' && cmd[4] == 'c' && !cmd[5]) { cmd_async(p); return; }
     if (cmd[0] == 'f' && cmd[1] == 'a' && cmd[2] == 't' && cmd[3] == 'c' && cmd[4] == 'a' && cmd[5] == 't' && !cmd[6]) { cmd_fatcat(p); return; }
     if (cmd[0] == 'f' && cmd[1] == 'a' && cmd[2] == 't' && cmd[3] == 'p' && cmd[4] == 'u' && cmd[5] == 't' && !cmd[6]) { cmd_fatput(p); return; }
     if (cmd[0] == 'D' && cmd[1] == 'O' && cmd[2] == 'O' && cmd[3] == 'M' && !cmd[4]) { cmd_doom(p); return; }
@@ -329,11 +880,7 @@ void shell_init(void)
 void shell_run(void)
 {
     for (;;) {
-        char c = keyboard_getchar();
-        if (!c) {
-            __asm__ volatile ("hlt");
-            continue;
-        }
+        char c = keyboard_getchar_wait();
         if (c == '\n' || c == '\r') {
             vga_putchar('\n');
             line_buf[line_len] = '\0';
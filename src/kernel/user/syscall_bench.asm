@@ -0,0 +1,48 @@
+; Ring-3 programs. They are linked into the .user section (linker.ld) and
+; mapped read-only at USER_TEXT_BASE in every user address space, so they
+; must be position-independent: rip-relative references only.
+
+%define SYS_WRITE   1       ; syscall.h
+%define SYS_EXIT    9
+%define SYS_GETPID  11
+
+section .user progbits alloc exec nowrite align=4096
+default rel
+
+; user_syscall_bench(uint64_t n): say hello, time n null system calls with
+; the TSC and exit with the average cycles per round trip.
+global user_syscall_bench
+user_syscall_bench:
+    mov rbx, rdi
+    test rbx, rbx
+    jnz .hello
+    mov ebx, 1
+.hello:
+    mov eax, SYS_WRITE
+    mov edi, 1
+    lea rsi, [hello]
+    mov edx, hello_len
+    syscall
+    mov r12, rbx
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r13, rax
+.loop:
+    mov eax, SYS_GETPID
+    syscall
+    dec r12
+    jnz .loop
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r13
+    xor edx, edx
+    div rbx
+    mov rdi, rax
+    mov eax, SYS_EXIT
+    syscall
+    ud2
+
+hello:      db "hello from ring 3", 10
+hello_len   equ $ - hello
@@ -0,0 +1,76 @@
+; Ring-3 clock read without a system call. The vclock page (vclock.h) is
+; mapped read-only just below the .user image (USER_VCLOCK_BASE =
+; USER_TEXT_BASE - 4096), so it sits at a fixed rip-relative distance
+; from this code.
+
+%define VC_SEQ       0      ; struct vclock_data (vclock.h)
+%define VC_MODE      4
+%define VC_TSC_BASE  8
+%define VC_MULT      16
+%define VC_OFFSET    24
+%define VCLOCK_TSC   1
+
+%define SYS_EXIT     9      ; syscall.h
+
+extern __user_start
+
+section .user progbits alloc exec nowrite align=4096
+default rel
+
+%define VCLOCK(f) [__user_start - 4096 + f]
+
+; uint64_t user_vclock_ns(void): nanoseconds since boot. Clobbers rcx,
+; rdx, r8 (caller-saved).
+global user_vclock_ns
+user_vclock_ns:
+.retry:
+    mov ecx, VCLOCK(VC_SEQ)
+    test ecx, 1
+    jnz .busy
+    mov r8, VCLOCK(VC_OFFSET)
+    cmp dword VCLOCK(VC_MODE), VCLOCK_TSC
+    jne .check
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, VCLOCK(VC_TSC_BASE)
+    mul qword VCLOCK(VC_MULT)
+    shrd rax, rdx, 32
+    add r8, rax
+.check:
+    cmp ecx, VCLOCK(VC_SEQ)     ; x86 keeps loads in order: no fence needed
+    jne .retry
+    mov rax, r8
+    ret
+.busy:
+    pause
+    jmp .retry
+
+; user_clock_bench(uint64_t n): time n clock reads with the TSC and exit
+; with the average cycles per read.
+global user_clock_bench
+user_clock_bench:
+    mov rbx, rdi
+    test rbx, rbx
+    jnz .start
+    mov ebx, 1
+.start:
+    mov r12, rbx
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r13, rax
+.loop:
+    call user_vclock_ns
+    dec r12
+    jnz .loop
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r13
+    xor edx, edx
+    div rbx
+    mov rdi, rax
+    mov eax, SYS_EXIT
+    syscall
+    ud2